@@ -1,6 +1,8 @@
 #ifndef AA_TREE_HPP
 #define AA_TREE_HPP
 
+#include <algorithm>
+
 #include "binary_search_tree.hpp"
 
 template <typename T>
@@ -14,7 +16,7 @@ class AATreeNode {
     size_t size, count, repeat, level;
 
     AATreeNode() = default;
-    AATreeNode(const T& value, size_t repeat = 1)
+    AATreeNode(T value, size_t repeat = 1)
         : value(std::move(value)), size(repeat), count(repeat), repeat(repeat), level(1) {}
 
     ~AATreeNode() = default;
@@ -25,60 +27,115 @@ class AATreeNode {
     }
 };
 
-template <typename T, typename Compare = std::less<T>, typename Node = AATreeNode<T>>
-class AATree : public BinarySearchTree<T, Compare, Node> {
-    using BinarySearchTree<T, Compare, Node>::root;
-    using BinarySearchTree<T, Compare, Node>::compare;
-    using BinarySearchTree<T, Compare, Node>::rotateLeft;
-    using BinarySearchTree<T, Compare, Node>::rotateRight;
-    using BinarySearchTree<T, Compare, Node>::rotate;
+template <typename T, typename SizeType = std::uint32_t>
+struct CompactAATreeNode : CompactNodeBase<CompactAATreeNode<T, SizeType>, T, SizeType> {
+   public:
+    std::uint8_t level;
 
-   protected:
-    std::shared_ptr<Node> skew(const std::shared_ptr<Node>& node);
-    std::shared_ptr<Node> split(const std::shared_ptr<Node>& node);
-    std::shared_ptr<Node> decreaseLevel(const std::shared_ptr<Node>& node);
+    CompactAATreeNode() = default;
+    CompactAATreeNode(T value, SizeType repeat = 1)
+        : CompactNodeBase<CompactAATreeNode<T, SizeType>, T, SizeType>(std::move(value), repeat), level(1) {}
+};
 
-    std::shared_ptr<Node> insert(std::shared_ptr<Node> node, const T& value);
-    std::shared_ptr<Node> remove(std::shared_ptr<Node> node, const T& value);
+template <typename T, typename Compare = std::less<T>, typename Node = AATreeNode<T>, typename Allocator = std::allocator<Node>, typename Stats = NoTreeStats>
+class AATree : public BinarySearchTree<T, Compare, Node, Allocator, Stats, AATree<T, Compare, Node, Allocator, Stats>> {
+    using Base = BinarySearchTree<T, Compare, Node, Allocator, Stats, AATree>;
+    friend Base;
+    using Base::root;
+    using Base::compare;
+    using Base::createNode;
+    using Base::destroyNode;
+    using Base::rotateLeft;
+    using Base::rotateRight;
+    using Base::rotate;
+    using Base::stats;
+
+   protected:
+    NodePtr<Node> skew(const NodePtr<Node>& node);
+    NodePtr<Node> split(const NodePtr<Node>& node);
+    NodePtr<Node> decreaseLevel(const NodePtr<Node>& node);
+
+    template <typename Value>
+    NodePtr<Node> insert(NodePtr<Node> node, Value&& value, NodePtr<Node>& holder);
+    template <typename Key>
+    NodePtr<Node> remove(NodePtr<Node> node, const Key& key);
+    // From the root only: the rebalancing rides a recursive descent.
+    template <typename Value>
+    NodePtr<Node> insertValue(Value&& value);
+    template <typename Key>
+    void removeKey(const Key& key);
+
+    NodePtr<Node> buildSorted(NodePtr<Node> head, size_t n);
+    void assignLevels(const NodePtr<Node>& node);
 
    public:
+    using typename Base::iterator;
+
     AATree() = default;
+    explicit AATree(const Allocator& allocator) : Base(allocator) {}
+    template <typename InputIt>
+    AATree(InputIt first, InputIt last) { this->assign_sorted(first, last); }
     AATree(const AATree&) = delete;
     AATree(AATree&&) = default;
     AATree& operator=(const AATree&) = delete;
     AATree& operator=(AATree&&) = default;
     ~AATree() = default;
 
-    void insert(const T& value) override;
-    void remove(const T& value) override;
+    void insert(const T& value) { insertValue(value); }
+    void insert(T&& value) { insertValue(std::move(value)); }
+    // The hint is not used: insertion skews and splits on the way back up a recursive descent from the root.
+    iterator insert(iterator, const T& value) { return this->iteratorAt(insertValue(value)); }
+    iterator insert(iterator, T&& value) { return this->iteratorAt(insertValue(std::move(value))); }
+    void remove(const T& value) { removeKey(value); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    void remove(const Key& key) { removeKey(key); }
 };
 
-template <typename T, typename Compare, typename Node>
-std::shared_ptr<Node> AATree<T, Compare, Node>::skew(const std::shared_ptr<Node>& node) {
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+NodePtr<Node> AATree<T, Compare, Node, Allocator, Stats>::buildSorted(NodePtr<Node> head, size_t n) {
+    NodePtr<Node> node = this->buildBalanced(head, n);
+    assignLevels(node);
+    return node;
+}
+
+// In a balanced tree whose left subtrees are never larger than the right ones,
+// taking the distance to the nearest empty subtree as the level satisfies all
+// of the AA invariants.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+void AATree<T, Compare, Node, Allocator, Stats>::assignLevels(const NodePtr<Node>& node) {
+    if (node == nullptr)
+        return;
+    assignLevels(node->left);
+    assignLevels(node->right);
+    node->level = 1 + std::min<size_t>(node->left ? node->left->level : 0, node->right ? node->right->level : 0);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+NodePtr<Node> AATree<T, Compare, Node, Allocator, Stats>::skew(const NodePtr<Node>& node) {
     if (node == nullptr || node->left == nullptr)
         return node;
     if (node->left->level != node->level)
         return node;
+    stats.skew();
     return rotateRight(node);
 }
 
-template <typename T, typename Compare, typename Node>
-std::shared_ptr<Node> AATree<T, Compare, Node>::split(const std::shared_ptr<Node>& node) {
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+NodePtr<Node> AATree<T, Compare, Node, Allocator, Stats>::split(const NodePtr<Node>& node) {
     if (node == nullptr || node->right == nullptr || node->right->right == nullptr)
         return node;
     if (node->right->right->level != node->level)
         return node;
+    stats.split();
     (node->right->level)++;
     return rotateLeft(node);
 }
 
-template <typename T, typename Compare, typename Node>
-std::shared_ptr<Node> AATree<T, Compare, Node>::decreaseLevel(const std::shared_ptr<Node>& node) {
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+NodePtr<Node> AATree<T, Compare, Node, Allocator, Stats>::decreaseLevel(const NodePtr<Node>& node) {
     if (node == nullptr)
         return node;
-    size_t minLevel = std::min(node->left ? node->left->level : node->level,
-                               node->right ? node->right->level : node->level) +
-                      1;
+    size_t minLevel = std::min<size_t>(node->left ? node->left->level : 0, node->right ? node->right->level : 0) + 1;
     if (minLevel >= node->level)
         return node;
     node->level = minLevel;
@@ -87,20 +144,23 @@ std::shared_ptr<Node> AATree<T, Compare, Node>::decreaseLevel(const std::shared_
     return node;
 }
 
-template <typename T, typename Compare, typename Node>
-std::shared_ptr<Node> AATree<T, Compare, Node>::insert(std::shared_ptr<Node> node, const T& value) {
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+template <typename Value>
+NodePtr<Node> AATree<T, Compare, Node, Allocator, Stats>::insert(NodePtr<Node> node, Value&& value, NodePtr<Node>& holder) {
     if (node == nullptr)
-        return std::make_shared<Node>(value);
+        return holder = createNode(std::forward<Value>(value));
+    stats.visit();
     if (compare(value, node->value)) {
-        node->left = insert(node->left, value);
+        node->left = insert(node->left, std::forward<Value>(value), holder);
         if (node->left)
             node->left->parent = node;
     } else if (compare(node->value, value)) {
-        node->right = insert(node->right, value);
+        node->right = insert(node->right, std::forward<Value>(value), holder);
         if (node->right)
             node->right->parent = node;
     } else {
         node->repeat++;
+        holder = node;
     }
 
     node->update();
@@ -109,29 +169,32 @@ std::shared_ptr<Node> AATree<T, Compare, Node>::insert(std::shared_ptr<Node> nod
     return node;
 }
 
-template <typename T, typename Compare, typename Node>
-std::shared_ptr<Node> AATree<T, Compare, Node>::remove(std::shared_ptr<Node> node, const T& value) {
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+template <typename Key>
+NodePtr<Node> AATree<T, Compare, Node, Allocator, Stats>::remove(NodePtr<Node> node, const Key& key) {
     if (node == nullptr)
         return node;
-    if (compare(value, node->value)) {
-        node->left = remove(node->left, value);
+    stats.visit();
+    if (compare(key, node->value)) {
+        node->left = remove(node->left, key);
         if (node->left)
             node->left->parent = node;
-    } else if (compare(node->value, value)) {
-        node->right = remove(node->right, value);
+    } else if (compare(node->value, key)) {
+        node->right = remove(node->right, key);
         if (node->right)
             node->right->parent = node;
     } else {
         if (node->repeat > 1)
             node->repeat--;
-        else if (node->left == nullptr && node->right == nullptr)
-            return nullptr;
-        else if (node->left == nullptr || node->right == nullptr)
-            return node->left ? node->left : node->right;
-        else {
-            std::shared_ptr<Node> successor = getSuccessor(node);
+        else if (node->left == nullptr || node->right == nullptr) {
+            NodePtr<Node> child = node->left ? node->left : node->right;
+            destroyNode(node);
+            return child;
+        } else {
+            NodePtr<Node> successor = getSuccessor(node);
             std::swap(node->value, successor->value);
-            node->right = remove(node->right, value);
+            std::swap(node->repeat, successor->repeat);
+            node->right = remove(node->right, key);
             if (node->right)
                 node->right->parent = node;
         }
@@ -148,16 +211,20 @@ std::shared_ptr<Node> AATree<T, Compare, Node>::remove(std::shared_ptr<Node> nod
     return node;
 }
 
-template <typename T, typename Compare, typename Node>
-void AATree<T, Compare, Node>::insert(const T& value) {
-    root = insert(root, value);
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+template <typename Value>
+NodePtr<Node> AATree<T, Compare, Node, Allocator, Stats>::insertValue(Value&& value) {
+    NodePtr<Node> holder;
+    root = insert(root, std::forward<Value>(value), holder);
     if (root)
         root->parent.reset();
+    return holder;
 }
 
-template <typename T, typename Compare, typename Node>
-void AATree<T, Compare, Node>::remove(const T& value) {
-    root = remove(root, value);
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+template <typename Key>
+void AATree<T, Compare, Node, Allocator, Stats>::removeKey(const Key& key) {
+    root = remove(root, key);
     if (root)
         root->parent.reset();
 }
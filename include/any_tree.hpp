@@ -0,0 +1,105 @@
+#ifndef ANY_TREE_HPP
+#define ANY_TREE_HPP
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Any of the binary trees behind one type, for code that picks the balancing
+// scheme at run time (from a configuration, say, or to keep a heterogeneous
+// collection of trees). The trees themselves have no virtual functions, so the
+// indirection lives here instead: every call goes through one virtual call on
+// the wrapped tree, whose own implementation is then resolved statically.
+//
+//     AnyTree<int> tree = AnyTree<int>::make<AVLTree<int>>();
+//     tree.insert(1);
+template <typename T>
+class AnyTree {
+   private:
+    struct Concept {
+        virtual ~Concept() = default;
+
+        virtual size_t size() const noexcept = 0;
+        virtual bool empty() const noexcept = 0;
+        virtual void clear() noexcept = 0;
+        virtual size_t height() noexcept = 0;
+        virtual bool contains(const T& value) = 0;
+        virtual void insert(const T& value) = 0;
+        virtual void insert(T&& value) = 0;
+        virtual void remove(const T& value) = 0;
+        virtual size_t rank(const T& value) = 0;
+        virtual T select(size_t rank) = 0;
+        virtual T min() = 0;
+        virtual T max() = 0;
+        virtual T floor(const T& value) = 0;
+        virtual T ceil(const T& value) = 0;
+        virtual std::vector<T> nsmallest(size_t n) = 0;
+        virtual std::vector<T> nlargest(size_t n) = 0;
+    };
+
+    template <typename Tree>
+    struct Model final : Concept {
+        Tree tree;
+
+        template <typename... Args>
+        explicit Model(Args&&... args) : tree(std::forward<Args>(args)...) {}
+
+        size_t size() const noexcept override { return tree.size(); }
+        bool empty() const noexcept override { return tree.empty(); }
+        void clear() noexcept override { tree.clear(); }
+        size_t height() noexcept override { return tree.height(); }
+        bool contains(const T& value) override { return tree.contains(value); }
+        void insert(const T& value) override { tree.insert(value); }
+        void insert(T&& value) override { tree.insert(std::move(value)); }
+        void remove(const T& value) override { tree.remove(value); }
+        size_t rank(const T& value) override { return tree.rank(value); }
+        T select(size_t rank) override { return tree.select(rank); }
+        T min() override { return tree.min(); }
+        T max() override { return tree.max(); }
+        T floor(const T& value) override { return tree.floor(value); }
+        T ceil(const T& value) override { return tree.ceil(value); }
+        std::vector<T> nsmallest(size_t n) override { return tree.nsmallest(n); }
+        std::vector<T> nlargest(size_t n) override { return tree.nlargest(n); }
+    };
+
+    std::unique_ptr<Concept> self;
+
+    explicit AnyTree(std::unique_ptr<Concept> self) : self(std::move(self)) {}
+
+   public:
+    // Takes over an existing tree.
+    template <typename Tree, typename = std::enable_if_t<!std::is_same_v<std::decay_t<Tree>, AnyTree>>>
+    explicit AnyTree(Tree&& tree) : self(std::make_unique<Model<std::decay_t<Tree>>>(std::forward<Tree>(tree))) {}
+    AnyTree(const AnyTree&) = delete;
+    AnyTree(AnyTree&&) noexcept = default;
+    AnyTree& operator=(const AnyTree&) = delete;
+    AnyTree& operator=(AnyTree&&) noexcept = default;
+    ~AnyTree() = default;
+
+    // Builds a Tree in place from args.
+    template <typename Tree, typename... Args>
+    static AnyTree make(Args&&... args) {
+        return AnyTree(std::unique_ptr<Concept>(std::make_unique<Model<Tree>>(std::forward<Args>(args)...)));
+    }
+
+    size_t size() const noexcept { return self->size(); }
+    bool empty() const noexcept { return self->empty(); }
+    void clear() noexcept { self->clear(); }
+    size_t height() noexcept { return self->height(); }
+    bool contains(const T& value) { return self->contains(value); }
+    void insert(const T& value) { self->insert(value); }
+    void insert(T&& value) { self->insert(std::move(value)); }
+    void remove(const T& value) { self->remove(value); }
+    size_t rank(const T& value) { return self->rank(value); }
+    T select(size_t rank) { return self->select(rank); }
+    T min() { return self->min(); }
+    T max() { return self->max(); }
+    T floor(const T& value) { return self->floor(value); }
+    T ceil(const T& value) { return self->ceil(value); }
+    std::vector<T> nsmallest(size_t n) { return self->nsmallest(n); }
+    std::vector<T> nlargest(size_t n) { return self->nlargest(n); }
+};
+
+#endif  // ANY_TREE_HPP
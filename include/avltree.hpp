@@ -14,8 +14,8 @@ struct AVLTreeNode {
     size_t size, count, repeat, height;
 
     AVLTreeNode() = default;
-    AVLTreeNode(const T& value, size_t repeat = 1)
-        : value(std::move(value)), count(repeat), repeat(repeat), height(1) {}
+    AVLTreeNode(T value, size_t repeat = 1)
+        : value(std::move(value)), size(repeat), count(repeat), repeat(repeat), height(1) {}
 
     ~AVLTreeNode() = default;
 
@@ -36,44 +36,98 @@ struct AVLTreeNode {
     }
 };
 
-template <typename T, typename Compare = std::less<T>, typename Node = AVLTreeNode<T>>
-class AVLTree : public BinarySearchTree<T, Compare, Node> {
-    using BinarySearchTree<T, Compare, Node>::root;
-    using BinarySearchTree<T, Compare, Node>::compare;
-    using BinarySearchTree<T, Compare, Node>::rotate;
-    using BinarySearchTree<T, Compare, Node>::rotateLeft;
-    using BinarySearchTree<T, Compare, Node>::rotateRight;
+template <typename T, typename SizeType = std::uint32_t>
+struct CompactAVLTreeNode : CompactNodeBase<CompactAVLTreeNode<T, SizeType>, T, SizeType> {
+   public:
+    using CompactNodeBase<CompactAVLTreeNode<T, SizeType>, T, SizeType>::left;
+    using CompactNodeBase<CompactAVLTreeNode<T, SizeType>, T, SizeType>::right;
+    std::uint8_t height;
+
+    CompactAVLTreeNode() = default;
+    CompactAVLTreeNode(T value, SizeType repeat = 1)
+        : CompactNodeBase<CompactAVLTreeNode<T, SizeType>, T, SizeType>(std::move(value), repeat), height(1) {}
+
+    inline void update() {
+        CompactNodeBase<CompactAVLTreeNode<T, SizeType>, T, SizeType>::update();
+        height = 1 + std::max(left ? left->height : 0, right ? right->height : 0);
+    }
+
+    inline int factor() const noexcept {
+        return (right ? right->height : 0) - (left ? left->height : 0);
+    }
+};
+
+// Insertion and deletion are iterative and retrace the heights only as far up
+// as they change; above that, the ancestors just have their counts and sizes
+// adjusted by the node or occurrence that came or went.
+template <typename T, typename Compare = std::less<T>, typename Node = AVLTreeNode<T>, typename Allocator = std::allocator<Node>, typename Stats = NoTreeStats>
+class AVLTree : public BinarySearchTree<T, Compare, Node, Allocator, Stats, AVLTree<T, Compare, Node, Allocator, Stats>> {
+    using Base = BinarySearchTree<T, Compare, Node, Allocator, Stats, AVLTree>;
+    using Base::root;
+    using Base::compare;
+    using Base::createNode;
+    using Base::destroyNode;
+    using Base::rotateLeft;
+    using Base::rotateRight;
+    using Base::stats;
+    using Base::transplant;
 
    protected:
-    std::shared_ptr<Node> maintain(const std::shared_ptr<Node>& node);
-    std::shared_ptr<Node> insert(const std::shared_ptr<Node>& node, const T& value);
-    std::shared_ptr<Node> remove(const std::shared_ptr<Node>& node, const T& value);
+    NodePtr<Node> maintain(const NodePtr<Node>& node);
+    // Brings node and its ancestors up to date from below until a subtree
+    // height comes out unchanged, rebalancing on the way, and returns the
+    // first ancestor left as it was. moved, the occurrences the nodes below
+    // successor have lost, drops to 1 once successor is passed (see removeKey).
+    NodePtr<Node> retrace(NodePtr<Node> node, const NodePtr<Node>& successor, size_t& moved);
+    NodePtr<Node> retrace(NodePtr<Node> node) {
+        size_t moved = 1;
+        return retrace(std::move(node), nullptr, moved);
+    }
+    template <typename Value>
+    NodePtr<Node> insertValue(Value&& value) { return insertValue(std::forward<Value>(value), root); }
+    template <typename Value>
+    NodePtr<Node> insertValue(Value&& value, NodePtr<Node> from);
+    template <typename Key>
+    void removeKey(const Key& key);
 
    public:
+    using typename Base::iterator;
+
     AVLTree() = default;
+    explicit AVLTree(const Allocator& allocator) : Base(allocator) {}
+    template <typename InputIt>
+    AVLTree(InputIt first, InputIt last) { this->assign_sorted(first, last); }
     AVLTree(const AVLTree&) = delete;
     AVLTree(AVLTree&&) = default;
     AVLTree& operator=(const AVLTree&) = delete;
     AVLTree& operator=(AVLTree&&) = default;
     ~AVLTree() = default;
 
-    void insert(const T& value) override;
-    void remove(const T& value) override;
+    void insert(const T& value) { insertValue(value); }
+    void insert(T&& value) { insertValue(std::move(value)); }
+    iterator insert(iterator hint, const T& value) { return this->iteratorAt(insertValue(value, this->fingerNode(hint, value))); }
+    iterator insert(iterator hint, T&& value) {
+        NodePtr<Node> from = this->fingerNode(hint, value);
+        return this->iteratorAt(insertValue(std::move(value), from));
+    }
+    void remove(const T& value) { removeKey(value); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    void remove(const Key& key) { removeKey(key); }
 };
 
-template <typename T, typename Compare, typename Node>
-std::shared_ptr<Node> AVLTree<T, Compare, Node>::maintain(const std::shared_ptr<Node>& node) {
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+NodePtr<Node> AVLTree<T, Compare, Node, Allocator, Stats>::maintain(const NodePtr<Node>& node) {
     if (node == nullptr)
         return nullptr;
     if (node->factor() < -1) {
-        if (node->left->factor() < 0) {
+        if (node->left->factor() <= 0) {
             return rotateRight(node);
         } else {
             rotateLeft(node->left);
             return rotateRight(node);
         }
     } else if (node->factor() > 1) {
-        if (node->right->factor() > 0) {
+        if (node->right->factor() >= 0) {
             return rotateLeft(node);
         } else {
             rotateRight(node->right);
@@ -83,69 +137,109 @@ std::shared_ptr<Node> AVLTree<T, Compare, Node>::maintain(const std::shared_ptr<
     return node;
 }
 
-template <typename T, typename Compare, typename Node>
-std::shared_ptr<Node> AVLTree<T, Compare, Node>::insert(const std::shared_ptr<Node>& node, const T& value) {
-    if (node == nullptr) {
-        return std::make_shared<Node>(value);
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+NodePtr<Node> AVLTree<T, Compare, Node, Allocator, Stats>::retrace(NodePtr<Node> node, const NodePtr<Node>& successor, size_t& moved) {
+    while (node) {
+        if (node == successor)
+            moved = 1;
+        auto height = node->height;
+        node->update();
+        node = maintain(node);
+        bool changed = node->height != height;
+        node = node->parent.lock();
+        if (!changed)
+            break;
     }
-    if (compare(value, node->value)) {
-        node->left = insert(node->left, value);
-        node->left->parent = node;
-    } else if (compare(node->value, value)) {
-        node->right = insert(node->right, value);
-        node->right->parent = node;
-    } else {
-        node->repeat++;
+    return node;
+}
+
+// After an insertion the retrace ends at the latest with a rotation, which
+// gives the subtree back the height it had before.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+template <typename Value>
+NodePtr<Node> AVLTree<T, Compare, Node, Allocator, Stats>::insertValue(Value&& value, NodePtr<Node> from) {
+    if (root == nullptr)
+        return root = createNode(std::forward<Value>(value));
+
+    NodePtr<Node> node = std::move(from), parent = nullptr;
+    while (node != nullptr) {
+        stats.visit();
+        parent = node;
+        if (compare(value, node->value))
+            node = node->left;
+        else if (compare(node->value, value))
+            node = node->right;
+        else
+            break;
+    }
+    if (node != nullptr) {
+        ++(node->repeat);
+        for (NodePtr<Node> current = node; current != nullptr; current = current->parent.lock())
+            ++(current->size);
+        return node;
+    }
+
+    size_t direction = compare(parent->value, value);
+    node = createNode(std::forward<Value>(value));
+    childOf(parent, direction) = node;
+    node->parent = parent;
+    for (NodePtr<Node> current = retrace(parent); current != nullptr; current = current->parent.lock()) {
+        ++(current->count);
+        ++(current->size);
     }
-    node->update();
-    return maintain(node);
+    return node;
 }
 
-template <typename T, typename Compare, typename Node>
-std::shared_ptr<Node> AVLTree<T, Compare, Node>::remove(const std::shared_ptr<Node>& node, const T& value) {
+// The node leaves as in RBTree::removeKey: its successor takes its place if it
+// has two children. The ancestors of the successor's old place up to the
+// successor lose the successor's occurrences from their sizes, those above
+// only the one removed, and the successor itself is recomputed in full.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+template <typename Key>
+void AVLTree<T, Compare, Node, Allocator, Stats>::removeKey(const Key& key) {
+    NodePtr<Node> node = this->findNode(key);
     if (node == nullptr)
-        return nullptr;
+        return;
+    if (node->repeat > 1) {
+        --(node->repeat);
+        for (; node != nullptr; node = node->parent.lock())
+            --(node->size);
+        return;
+    }
 
-    if (compare(value, node->value)) {
-        node->left = remove(node->left, value);
-        if (node->left != nullptr)
-            node->left->parent = node;
-    } else if (compare(node->value, value)) {
-        node->right = remove(node->right, value);
-        if (node->right != nullptr)
-            node->right->parent = node;
-    } else {
-        if (node->repeat > 1) {
-            node->repeat--;
-        } else if (node->left == nullptr) {
-            return node->right;
-        } else if (node->right == nullptr) {
-            return node->left;
-        } else {
-            std::shared_ptr<Node> successor = getSuccessor(node);
-            std::swap(node->value, successor->value);
-            std::swap(node->repeat, successor->repeat);
-            node->right = remove(node->right, value);
-            if (node->right != nullptr)
-                node->right->parent = node;
+    NodePtr<Node> parent, successor = nullptr;
+    if (node->left && node->right) {
+        successor = node->right;
+        while (successor->left)
+            successor = successor->left;
+        if (successor == node->right)
+            parent = successor;
+        else {
+            parent = successor->parent.lock();
+            transplant(successor, successor->right);
+            successor->right = node->right;
+            successor->right->parent = successor;
         }
+        transplant(node, successor);
+        successor->left = node->left;
+        successor->left->parent = successor;
+        successor->height = node->height;
+    } else {
+        parent = node->parent.lock();
+        transplant(node, node->left ? node->left : node->right);
     }
-    node->update();
-    return maintain(node);
-}
 
-template <typename T, typename Compare, typename Node>
-void AVLTree<T, Compare, Node>::insert(const T& value) {
-    root = insert(root, value);
-    if (root != nullptr)
-        root->parent.reset();
-}
-
-template <typename T, typename Compare, typename Node>
-void AVLTree<T, Compare, Node>::remove(const T& value) {
-    root = remove(root, value);
-    if (root != nullptr)
-        root->parent.reset();
+    size_t moved = successor ? successor->repeat : 1;
+    for (NodePtr<Node> current = retrace(parent, successor, moved); current != nullptr; current = current->parent.lock()) {
+        if (current == successor) {
+            current->update();
+            moved = 1;
+            continue;
+        }
+        --(current->count);
+        current->size -= moved;
+    }
+    destroyNode(node);
 }
 
-#endif  // AVL_TREE_HPP
\ No newline at end of file
+#endif  // AVL_TREE_HPP
@@ -4,11 +4,18 @@
 #include <cassert>
 #include <functional>
 #include <iostream>
+#include <iterator>
 #include <memory>
 #include <stack>
+#include <utility>
 #include <vector>
 
+#include "compact_node.hpp"
+#include "eytzinger_index.hpp"
+#include "frozen_tree.hpp"
 #include "node.hpp"
+#include "node_pool.hpp"
+#include "tree_stats.hpp"
 
 template <typename T>
 struct BinaryNode {
@@ -21,8 +28,8 @@ struct BinaryNode {
     size_t size, count, repeat;
 
     BinaryNode() = default;
-    BinaryNode(const T& value, size_t repeat = 1)
-        : value(std::move(value)), count(repeat), repeat(repeat) {}
+    BinaryNode(T value, size_t repeat = 1)
+        : value(std::move(value)), size(repeat), count(repeat), repeat(repeat) {}
 
     ~BinaryNode() = default;
 
@@ -32,47 +39,501 @@ struct BinaryNode {
     }
 };
 
-template <typename T, typename Compare = std::less<T>, typename Node = BinaryNode<T>>
+template <typename T, typename SizeType = std::uint32_t>
+struct CompactBinaryNode : CompactNodeBase<CompactBinaryNode<T, SizeType>, T, SizeType> {
+    using CompactNodeBase<CompactBinaryNode<T, SizeType>, T, SizeType>::CompactNodeBase;
+};
+
+// Shared algorithms of all the binary trees, and a plain unbalanced one itself.
+// Nothing is virtual: a balancing scheme derives with itself as Derived (CRTP)
+// and replaces insert, remove and whatever else it needs by hiding them, and
+// the few shared algorithms that lead into those (emplace, assign_sorted,
+// select_in_range) reach them through derived(). Calls on a concrete tree type
+// are therefore resolved, and inlined, at compile time; AnyTree type-erases a
+// tree for the places that need to pick one at run time.
+template <typename T, typename Compare = std::less<T>, typename Node = BinaryNode<T>, typename Allocator = std::allocator<Node>, typename Stats = NoTreeStats, typename Derived = void>
 class BinarySearchTree {
    protected:
-    std::shared_ptr<Node> root;
-    Compare compare = Compare();
+    using Self = std::conditional_t<std::is_void_v<Derived>, BinarySearchTree, Derived>;
+    Self& derived() noexcept { return static_cast<Self&>(*this); }
+
+    NodePtr<Node> root = nullptr;
+    StatsCompare<Compare, Stats> compare = StatsCompare<Compare, Stats>();
+    Allocator allocator = Allocator();
+    // Counted from const lookups too, like the comparisons.
+    mutable Stats stats = Stats();
+
+    template <typename... Args>
+    NodePtr<Node> createNode(Args&&... args);
+    void destroyNode(const NodePtr<Node>& node) noexcept;
+    void destroySubtree(NodePtr<Node> node) noexcept;
+
+    // Descents shared by the T and the heterogeneous overloads; Key is T unless
+    // the comparator is transparent.
+    template <typename Key>
+    NodePtr<Node> findNode(const Key& key) const { return findNode(key, root); }
+    template <typename Key>
+    NodePtr<Node> findNode(const Key& key, NodePtr<Node> from) const;
+    template <typename Key>
+    NodePtr<Node> floorNode(const Key& key) const;
+    template <typename Key>
+    NodePtr<Node> ceilNode(const Key& key) const { return ceilNode(key, root, nullptr); }
+    // Least key not below key within from's subtree, or bound if there is none.
+    template <typename Key>
+    NodePtr<Node> ceilNode(const Key& key, NodePtr<Node> from, NodePtr<Node> bound) const;
+    template <typename Key>
+    size_t countBefore(const Key& key, bool inclusive, bool repeats) const;
+    template <typename Key>
+    NodePtr<Node> upperNode(const Key& key) const;
+    // Finger search: climbs from finger (the maximum if it is empty) to the
+    // lowest node whose subtree spans key, comparing key only against the
+    // ancestors that bound the subtrees on the way, so a descent from there
+    // finds key or where it belongs. Nearby keys are reached without going up
+    // to the root. above gets the least node greater than key outside it.
+    template <typename Key>
+    NodePtr<Node> fingerNode(NodePtr<Node> finger, const Key& key, NodePtr<Node>& above) const;
+    // Returns the node that holds the key afterwards. The descent starts from
+    // from, which must be the root or a node whose subtree spans the key.
+    template <typename Value>
+    NodePtr<Node> insertValue(Value&& value) { return insertValue(std::forward<Value>(value), root); }
+    template <typename Value>
+    NodePtr<Node> insertValue(Value&& value, NodePtr<Node> from);
+    template <typename Key>
+    void removeKey(const Key& key);
+    template <typename InputIt>
+    NodePtr<Node> buildFromSorted(InputIt first, InputIt last, bool distinct = false);
+    // assign_sorted, keeping only the first of each run of equal keys when
+    // distinct is set.
+    template <typename InputIt>
+    void assignSorted(InputIt first, InputIt last, bool distinct);
+    NodePtr<Node> buildSorted(NodePtr<Node> head, size_t n);
+    NodePtr<Node> buildBalanced(NodePtr<Node>& head, size_t n);
+    NodePtr<Node> minimum() const noexcept;
+    NodePtr<Node> maximum() const noexcept;
+
+    NodePtr<Node> rotateLeft(const NodePtr<Node> node);
+    NodePtr<Node> rotateRight(const NodePtr<Node> node);
+    NodePtr<Node> rotate(const NodePtr<Node> node, size_t direction);
+    // Puts replacement, which may be empty, where node hangs from its parent.
+    void transplant(const NodePtr<Node>& node, const NodePtr<Node>& replacement);
+
+   public:
+    // The order the tree keeps its keys in, for containers built on top of it.
+    using key_compare = Compare;
+
+    // Bidirectional iterator over the distinct keys in order. It only follows the
+    // child and parent links, so walking the tree never allocates; end() keeps a
+    // pointer to the tree so that it can be decremented.
+    class iterator {
+        friend class BinarySearchTree;
+
+        NodePtr<Node> node = nullptr;
+        const BinarySearchTree* tree = nullptr;
+
+        iterator(NodePtr<Node> node, const BinarySearchTree* tree) noexcept : node(std::move(node)), tree(tree) {}
+
+       public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        iterator() = default;
+
+        reference operator*() const noexcept { return node->value; }
+        pointer operator->() const noexcept { return &node->value; }
+        size_t repeat() const noexcept { return node->repeat; }
 
-    std::shared_ptr<Node> rotateLeft(const std::shared_ptr<Node> node);
-    std::shared_ptr<Node> rotateRight(const std::shared_ptr<Node> node);
-    std::shared_ptr<Node> rotate(const std::shared_ptr<Node> node, size_t direction);
+        iterator& operator++() noexcept {
+            node = getSuccessor(node);
+            return *this;
+        }
+        iterator operator++(int) noexcept {
+            iterator result = *this;
+            ++*this;
+            return result;
+        }
+        iterator& operator--() noexcept {
+            node = node ? getPredecessor(node) : tree->maximum();
+            return *this;
+        }
+        iterator operator--(int) noexcept {
+            iterator result = *this;
+            --*this;
+            return result;
+        }
+
+        bool operator==(const iterator& other) const noexcept { return node == other.node; }
+        bool operator!=(const iterator& other) const noexcept { return node != other.node; }
+    };
+    using const_iterator = iterator;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = reverse_iterator;
+
+   protected:
+    iterator iteratorAt(NodePtr<Node> node) const noexcept { return iterator(std::move(node), this); }
+    template <typename Key>
+    NodePtr<Node> fingerNode(const iterator& finger, const Key& key) const {
+        NodePtr<Node> above;
+        return fingerNode(finger.node, key, above);
+    }
 
    public:
     BinarySearchTree() = default;
+    explicit BinarySearchTree(const Allocator& allocator) : allocator(allocator) {}
+    template <typename InputIt>
+    BinarySearchTree(InputIt first, InputIt last) { assign_sorted(first, last); }
     BinarySearchTree(const BinarySearchTree&) = delete;
-    BinarySearchTree(BinarySearchTree&&) = default;
+    BinarySearchTree(BinarySearchTree&& other) noexcept;
     BinarySearchTree& operator=(const BinarySearchTree&) = delete;
-    BinarySearchTree& operator=(BinarySearchTree&&) = default;
-    ~BinarySearchTree() = default;
-
-    virtual size_t size() const noexcept { return root ? root->count : 0; }
-    virtual bool empty() const noexcept { return root == nullptr; }
-    virtual void clear() noexcept { root = nullptr; }
-    virtual size_t height() noexcept { return root ? getHeight(root) : 0; }
-    virtual void print();
-    virtual void check();
-
-    virtual bool contains(const T& value);
-    virtual void insert(const T& value);
-    virtual void remove(const T& value);
-    virtual size_t rank(const T& value);
-    virtual T select(size_t rank);
-    virtual T min();
-    virtual T max();
-    virtual T floor(const T& value);
-    virtual T ceil(const T& value);
-    virtual std::vector<T> nsmallest(size_t n);
-    virtual std::vector<T> nlargest(size_t n);
+    BinarySearchTree& operator=(BinarySearchTree&& other) noexcept;
+    ~BinarySearchTree() { clear(); }
+
+    size_t size() const noexcept { return root ? root->count : 0; }
+    bool empty() const noexcept { return root == nullptr; }
+    void clear() noexcept;
+    size_t height() noexcept { return root ? getHeight(root) : 0; }
+    void print();
+    void check();
+
+    bool contains(const T& value);
+    void insert(const T& value);
+    void insert(T&& value);
+    void remove(const T& value);
+    size_t rank(const T& value);
+    T select(size_t rank);
+    T min();
+    T max();
+    T floor(const T& value);
+    T ceil(const T& value);
+    std::vector<T> nsmallest(size_t n);
+    std::vector<T> nlargest(size_t n);
+
+    // Builds the key from args and moves it into the new node, if one is needed.
+    template <typename... Args>
+    void emplace(Args&&... args) { derived().insert(T(std::forward<Args>(args)...)); }
+
+    // With a transparent comparator (std::less<>, for one) these accept any key
+    // it orders against T, such as a std::string_view for std::string keys,
+    // without building a T. Every tree that changes removal declares its own
+    // remove alongside.
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    bool contains(const Key& key) const { return findNode(key) != nullptr; }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    size_t rank(const Key& key) const { return countBefore(key, true, false); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    T floor(const Key& key) const;
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    T ceil(const Key& key) const;
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    void remove(const Key& key) { removeKey(key); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const Key& key) const { return iterator(findNode(key), this); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    iterator lower_bound(const Key& key) const { return iterator(ceilNode(key), this); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    iterator upper_bound(const Key& key) const { return iterator(upperNode(key), this); }
+
+    // Replaces the contents with the sorted range [first, last) in O(n), folding
+    // equal keys into the repeat count of a single node.
+    template <typename InputIt>
+    void assign_sorted(InputIt first, InputIt last);
+
+    iterator begin() const noexcept { return iterator(minimum(), this); }
+    iterator end() const noexcept { return iterator(nullptr, this); }
+    reverse_iterator rbegin() const noexcept { return reverse_iterator(end()); }
+    reverse_iterator rend() const noexcept { return reverse_iterator(begin()); }
+
+    iterator find(const T& value) const;
+    iterator lower_bound(const T& value) const;
+    iterator upper_bound(const T& value) const;
+    std::pair<iterator, iterator> equal_range(const T& value) const;
+
+    // The same searches and insertion starting from an iterator instead of the
+    // root (end() stands for the maximum), which only climbs as far as the key
+    // requires: a key a few positions away from the finger costs a few
+    // comparisons instead of a full descent, so walking or appending keys in
+    // order through the returned iterators is cheap. Subtree sizes above the
+    // new node are still updated up to the root. Trees that insert from the
+    // root by construction take the hint but do not use it.
+    iterator find_from(iterator finger, const T& value) const;
+    iterator lower_bound_from(iterator finger, const T& value) const;
+    iterator insert(iterator hint, const T& value) { return iteratorAt(insertValue(value, fingerNode(hint, value))); }
+    iterator insert(iterator hint, T&& value) {
+        NodePtr<Node> from = fingerNode(hint, value);
+        return iteratorAt(insertValue(std::move(value), from));
+    }
+
+    // Order statistics over the closed range [lo, hi]. Like rank() and select(),
+    // count_range() and select_in_range() count distinct keys, size_range()
+    // counts every repeat. visit_range() calls visitor(key, repeat) in order.
+    size_t count_range(const T& lo, const T& hi) const;
+    size_t size_range(const T& lo, const T& hi) const;
+    T select_in_range(const T& lo, const T& hi, size_t rank);
+    template <typename Visitor>
+    void visit_range(const T& lo, const T& hi, Visitor&& visitor) const;
+
+    // Contiguous read-only copy of the current contents, see FrozenTree.
+    FrozenTree<T, Compare> freeze() const { return FrozenTree<T, Compare>(begin(), end(), compare); }
+    // Pointer-free point lookup index over the distinct keys, see EytzingerIndex.
+    EytzingerIndex<T, Compare> to_eytzinger() const { return EytzingerIndex<T, Compare>(begin(), end(), compare); }
+
+    Allocator get_allocator() const noexcept { return allocator; }
+
+    // Operation counters, all zero unless the tree was instantiated with
+    // Stats = TreeStats; see TreeStatistics.
+    TreeStatistics statistics() const noexcept;
+    void reset_statistics() noexcept;
+    // Walks the whole tree, whatever the Stats policy.
+    ShapeReport shape_report() const;
 };
 
-template <typename T, typename Compare, typename Node>
-std::shared_ptr<Node> BinarySearchTree<T, Compare, Node>::rotateLeft(const std::shared_ptr<Node> node) {
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+TreeStatistics BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::statistics() const noexcept {
+    TreeStatistics result;
+    if constexpr (Stats::enabled) {
+        result = stats;
+        result.comparisons = compare.comparisons;
+    }
+    return result;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+void BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::reset_statistics() noexcept {
+    if constexpr (Stats::enabled) {
+        stats = Stats();
+        compare.comparisons = 0;
+    }
+}
+
+// Iterative, so that degenerate trees do not overflow the stack.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+ShapeReport BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::shape_report() const {
+    ShapeReport report;
+    // allocate_shared puts the node behind a control block holding a vtable
+    // pointer and the two reference counts.
+    report.bytesPerNode = sizeof(Node) + (std::is_pointer_v<NodePtr<Node>> ? 0 : sizeof(void*) + 2 * sizeof(int));
+    size_t depths = 0;
+    std::vector<std::pair<NodePtr<Node>, size_t>> pending;
+    if (root)
+        pending.emplace_back(root, 0);
+    while (!pending.empty()) {
+        auto [node, depth] = pending.back();
+        pending.pop_back();
+        if (report.depthHistogram.size() <= depth)
+            report.depthHistogram.resize(depth + 1);
+        ++report.depthHistogram[depth];
+        ++report.nodes;
+        depths += depth;
+        for (const NodePtr<Node>& child : {node->left, node->right})
+            if (child)
+                pending.emplace_back(child, depth + 1);
+    }
+    report.height = report.depthHistogram.size();
+    report.averageDepth = report.nodes ? static_cast<double>(depths) / report.nodes : 0;
+    return report;
+}
+
+// Number of keys ordered before value, or not after it when inclusive, found in
+// a single descent from the root. Keys are weighted by their repeat count when
+// repeats is set.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+template <typename Key>
+size_t BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::countBefore(const Key& key, bool inclusive, bool repeats) const {
+    size_t result = 0;
+    NodePtr<Node> current = root;
+    while (current) {
+        stats.visit();
+        if (inclusive ? !compare(key, current->value) : compare(current->value, key)) {
+            if (current->left)
+                result += repeats ? current->left->size : current->left->count;
+            result += repeats ? current->repeat : 1;
+            current = current->right;
+        } else
+            current = current->left;
+    }
+    return result;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+template <typename InputIt>
+void BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::assign_sorted(InputIt first, InputIt last) {
+    assignSorted(first, last, false);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+template <typename InputIt>
+void BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::assignSorted(InputIt first, InputIt last, bool distinct) {
+    clear();
+    root = buildFromSorted(first, last, distinct);
+    if (root)
+        root->parent.reset();
+}
+
+// Creates the nodes of the sorted range as a vine, folding equal keys into a
+// single node (or dropping all but the first, if distinct), and links them
+// with buildSorted. The tree itself is untouched.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+template <typename InputIt>
+NodePtr<Node> BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::buildFromSorted(InputIt first, InputIt last, bool distinct) {
+    NodePtr<Node> head = nullptr, tail = nullptr;
+    size_t n = 0;
+    try {
+        for (; first != last; ++first) {
+            if (tail && !compare(tail->value, *first)) {
+                assert(!compare(*first, tail->value));
+                if (!distinct)
+                    ++(tail->repeat);
+                continue;
+            }
+            NodePtr<Node> node = createNode(*first);
+            if (tail)
+                tail->right = node;
+            else
+                head = node;
+            tail = node;
+            ++n;
+        }
+    } catch (...) {
+        while (head) {
+            NodePtr<Node> next = head->right;
+            destroyNode(head);
+            head = next;
+        }
+        throw;
+    }
+    return derived().buildSorted(head, n);
+}
+
+// Links the n nodes of a vine, chained in order through their right pointers,
+// into a tree and returns its root. Balanced trees refine this with the
+// metadata of their own invariant.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+NodePtr<Node> BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::buildSorted(NodePtr<Node> head, size_t n) {
+    return buildBalanced(head, n);
+}
+
+// Builds a perfectly balanced tree in order from the first n nodes of the vine,
+// advancing head past them. The left half never holds more nodes than the right.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+NodePtr<Node> BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::buildBalanced(NodePtr<Node>& head, size_t n) {
+    if (n == 0)
+        return nullptr;
+    size_t leftCount = (n - 1) / 2;
+    NodePtr<Node> left = buildBalanced(head, leftCount);
+    NodePtr<Node> node = head;
+    head = node->right;
+    node->left = left;
+    if (left)
+        left->parent = node;
+    node->right = buildBalanced(head, n - 1 - leftCount);
+    if (node->right)
+        node->right->parent = node;
+    node->update();
+    return node;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+NodePtr<Node> BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::minimum() const noexcept {
+    NodePtr<Node> current = root;
+    if (current)
+        while (current->left)
+            current = current->left;
+    return current;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+NodePtr<Node> BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::maximum() const noexcept {
+    NodePtr<Node> current = root;
+    if (current)
+        while (current->right)
+            current = current->right;
+    return current;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+template <typename... Args>
+NodePtr<Node> BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::createNode(Args&&... args) {
+    if constexpr (std::is_pointer_v<NodePtr<Node>>) {
+        using Traits = std::allocator_traits<Allocator>;
+        Node* node = Traits::allocate(allocator, 1);
+        try {
+            Traits::construct(allocator, node, std::forward<Args>(args)...);
+        } catch (...) {
+            Traits::deallocate(allocator, node, 1);
+            throw;
+        }
+        return node;
+    } else
+        return std::allocate_shared<Node>(allocator, std::forward<Args>(args)...);
+}
+
+// Called once a node has been unlinked from the tree. Reference counted nodes
+// go away with their last owner, raw ones are handed back to the allocator.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+void BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::destroyNode(const NodePtr<Node>& node) noexcept {
+    if constexpr (std::is_pointer_v<NodePtr<Node>>) {
+        using Traits = std::allocator_traits<Allocator>;
+        Traits::destroy(allocator, node);
+        Traits::deallocate(allocator, node, 1);
+    }
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::BinarySearchTree(BinarySearchTree&& other) noexcept
+    : root(std::exchange(other.root, nullptr)), compare(std::move(other.compare)), allocator(std::move(other.allocator)), stats(std::move(other.stats)) {}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>& BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::operator=(BinarySearchTree&& other) noexcept {
+    if (this != &other) {
+        clear();
+        root = std::exchange(other.root, nullptr);
+        compare = std::move(other.compare);
+        allocator = std::move(other.allocator);
+        stats = std::move(other.stats);
+    }
+    return *this;
+}
+
+// Tears the tree down in O(n) time and O(1) space: left children are rotated
+// up until the current node has none, so every node is released with at most a
+// right child that has already been detached, and no destructor ever recurses.
+// Trivially destructible raw nodes living in an exclusively owned pool are not
+// visited at all, the pool just drops its chunks.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+void BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::clear() noexcept {
+    if constexpr (std::is_pointer_v<NodePtr<Node>> && std::is_trivially_destructible_v<Node> && HasRelease<Allocator>::value) {
+        if (allocator.release()) {
+            root = nullptr;
+            return;
+        }
+    }
+    destroySubtree(std::exchange(root, nullptr));
+    releaseAllocator(allocator);
+}
+
+// Frees the nodes of a subtree already unlinked from the tree, as clear() does.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+void BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::destroySubtree(NodePtr<Node> current) noexcept {
+    while (current) {
+        if (current->left) {
+            NodePtr<Node> left = std::move(current->left);
+            current->left = std::move(left->right);
+            left->right = std::move(current);
+            current = std::move(left);
+        } else {
+            NodePtr<Node> right = std::move(current->right);
+            destroyNode(current);
+            current = std::move(right);
+        }
+    }
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+NodePtr<Node> BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::rotateLeft(const NodePtr<Node> node) {
     assert(node != nullptr && node->right != nullptr);
+    stats.rotation();
 
     auto right = node->right;
     node->right = right->left;
@@ -95,9 +556,10 @@ std::shared_ptr<Node> BinarySearchTree<T, Compare, Node>::rotateLeft(const std::
     return right;
 }
 
-template <typename T, typename Compare, typename Node>
-std::shared_ptr<Node> BinarySearchTree<T, Compare, Node>::rotateRight(const std::shared_ptr<Node> node) {
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+NodePtr<Node> BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::rotateRight(const NodePtr<Node> node) {
     assert(node != nullptr && node->left != nullptr);
+    stats.rotation();
 
     auto left = node->left;
     node->left = left->right;
@@ -107,7 +569,7 @@ std::shared_ptr<Node> BinarySearchTree<T, Compare, Node>::rotateRight(const std:
     if (isRoot(node))
         root = left;
     else
-        node->parent.lock()->children[isRightChild(node)] = left;
+        childOf(node->parent.lock(), isRightChild(node)) = left;
 
     left->right = node;
     node->parent = left;
@@ -118,23 +580,34 @@ std::shared_ptr<Node> BinarySearchTree<T, Compare, Node>::rotateRight(const std:
     return left;
 }
 
-template <typename T, typename Compare, typename Node>
-std::shared_ptr<Node> BinarySearchTree<T, Compare, Node>::rotate(const std::shared_ptr<Node> node, size_t direction) {
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+NodePtr<Node> BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::rotate(const NodePtr<Node> node, size_t direction) {
     assert(direction == Direction::LEFT || direction == Direction::RIGHT);
     return direction == Direction::LEFT ? rotateLeft(node) : rotateRight(node);
 }
 
-template <typename T, typename Compare, typename Node>
-void BinarySearchTree<T, Compare, Node>::print() {
-    std::function<void(const std::shared_ptr<Node>&)> printNode = [](const std::shared_ptr<Node>& node) { std::cout << node->value << " "; };
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+void BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::transplant(const NodePtr<Node>& node, const NodePtr<Node>& replacement) {
+    NodePtr<Node> parent = node->parent.lock();
+    if (parent == nullptr)
+        root = replacement;
+    else
+        childOf(parent, parent->right == node) = replacement;
+    if (replacement)
+        replacement->parent = parent;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+void BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::print() {
+    std::function<void(const NodePtr<Node>&)> printNode = [](const NodePtr<Node>& node) { std::cout << node->value << " "; };
     inorderTraversal(root, printNode);
     std::cout << std::endl;
 }
 
-template <typename T, typename Compare, typename Node>
-void BinarySearchTree<T, Compare, Node>::check() {
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+void BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::check() {
     // Compare compare = Compare();
-    std::function<void(const std::shared_ptr<Node>&)> checkNode = [&](const std::shared_ptr<Node>& node) {
+    std::function<void(const NodePtr<Node>&)> checkNode = [&](const NodePtr<Node>& node) {
         size_t count = 1, size = node->repeat;
         if (node->left) {
             assert(compare(node->left->value, node->value));
@@ -154,78 +627,107 @@ void BinarySearchTree<T, Compare, Node>::check() {
     inorderTraversal(root, checkNode);
 }
 
-template <typename T, typename Compare, typename Node>
-bool BinarySearchTree<T, Compare, Node>::contains(const T& value) {
-    std::shared_ptr<Node> current = root;
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+template <typename Key>
+NodePtr<Node> BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::findNode(const Key& key, NodePtr<Node> from) const {
+    NodePtr<Node> current = std::move(from);
     while (current) {
-        if (!compare(value, current->value) && !compare(current->value, value))
-            return true;
-        current = current->children[compare(value, current->value)];
+        stats.visit();
+        if (!compare(key, current->value) && !compare(current->value, key))
+            break;
+        current = childOf(current, compare(current->value, key));
     }
-    return false;
+    return current;
 }
 
-template <typename T, typename Compare, typename Node>
-void BinarySearchTree<T, Compare, Node>::insert(const T& value) {
-    if (root == nullptr) {
-        root = std::make_shared<Node>(value);
-        return;
-    }
-    std::shared_ptr<Node> current = root;
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+bool BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::contains(const T& value) {
+    return findNode(value) != nullptr;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+void BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::insert(const T& value) {
+    insertValue(value);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+void BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::insert(T&& value) {
+    insertValue(std::move(value));
+}
+
+// The value is only moved into a new node, and not looked at after that.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+template <typename Value>
+NodePtr<Node> BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::insertValue(Value&& value, NodePtr<Node> from) {
+    if (root == nullptr)
+        return root = createNode(std::forward<Value>(value));
+    NodePtr<Node> current = std::move(from), holder;
     while (true) {
+        stats.visit();
         if (!compare(value, current->value) && !compare(current->value, value)) {
             ++(current->repeat);
+            holder = current;
             break;
         }
         size_t dir = compare(current->value, value);
-        if (current->children[dir] == nullptr) {
-            current->children[dir] = std::make_shared<Node>(value);
-            current->children[dir]->parent = current;
+        if (childOf(current, dir) == nullptr) {
+            childOf(current, dir) = holder = createNode(std::forward<Value>(value));
+            holder->parent = current;
             break;
         }
-        current = current->children[dir];
+        current = childOf(current, dir);
     }
     while (current) {
         current->update();
         current = current->parent.lock();
     }
+    return holder;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+void BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::remove(const T& value) {
+    removeKey(value);
 }
 
-template <typename T, typename Compare, typename Node>
-void BinarySearchTree<T, Compare, Node>::remove(const T& value) {
-    std::shared_ptr<Node> current = root;
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+template <typename Key>
+void BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::removeKey(const Key& key) {
+    NodePtr<Node> current = root;
+    NodePtr<Node> removed = nullptr;
     while (current) {
-        if (!compare(value, current->value) && !compare(current->value, value)) {
+        stats.visit();
+        if (!compare(key, current->value) && !compare(current->value, key)) {
             if (current->repeat > 1) {
                 --(current->repeat);
                 break;
             }
+            removed = current;
             if (current->left == nullptr && current->right == nullptr) {
                 if (isRoot(current)) {
                     root = nullptr;
                     current = nullptr;
                 } else {
                     size_t dir = isRightChild(current);
-                    current->parent.lock()->children[dir] = nullptr;
+                    childOf(current->parent.lock(), dir) = nullptr;
                     current = current->parent.lock();
                 }
             } else if (current->left == nullptr) {
                 if (isRoot(current))
                     root = current->right;
                 else
-                    current->parent.lock()->children[isRightChild(current)] = current->right;
+                    childOf(current->parent.lock(), isRightChild(current)) = current->right;
                 current->right->parent = current->parent;
                 current = current->right;
             } else if (current->right == nullptr) {
                 if (isRoot(current))
                     root = current->left;
                 else
-                    current->parent.lock()->children[isRightChild(current)] = current->left;
+                    childOf(current->parent.lock(), isRightChild(current)) = current->left;
                 current->left->parent = current->parent;
                 current = current->left;
             } else {
-                std::shared_ptr<Node> successor = getSuccessor(current);
-                std::shared_ptr<Node> replacement;
+                NodePtr<Node> successor = getSuccessor(current);
+                NodePtr<Node> replacement;
                 if (isRightChild(successor)) {
                     successor->left = current->left;
                     current->left->parent = successor;
@@ -243,143 +745,259 @@ void BinarySearchTree<T, Compare, Node>::remove(const T& value) {
                 if (isRoot(current))
                     root = successor;
                 else
-                    current->parent.lock()->children[isRightChild(current)] = successor;
+                    childOf(current->parent.lock(), isRightChild(current)) = successor;
                 successor->parent = current->parent;
                 current = replacement;
             }
             break;
         }
-        current = current->children[compare(current->value, value)];
+        current = childOf(current, compare(current->value, key));
     }
     while (current) {
         current->update();
         current = current->parent.lock();
     }
+    if (removed)
+        destroyNode(removed);
 }
 
-template <typename T, typename Compare, typename Node>
-size_t BinarySearchTree<T, Compare, Node>::rank(const T& value) {
-    size_t rank = 0;
-    std::shared_ptr<Node> current = root;
-    while (current) {
-        if (!compare(value, current->value) && !compare(current->value, value))
-            return rank + (current->left ? current->left->count : 0) + 1;
-        if (compare(value, current->value))
-            current = current->left;
-        else {
-            rank += (current->left ? current->left->count : 0) + current->repeat;
-            current = current->right;
-        }
-    }
-    return rank;
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+size_t BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::rank(const T& value) {
+    return countBefore(value, true, false);
 }
 
-template <typename T, typename Compare, typename Node>
-T BinarySearchTree<T, Compare, Node>::select(size_t rank) {
-    std::shared_ptr<Node> current = root;
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+T BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::select(size_t rank) {
+    NodePtr<Node> current = root;
     while (current) {
+        stats.visit();
         size_t leftCount = current->left ? current->left->count : 0;
         if (rank <= leftCount)
             current = current->left;
-        else if (rank <= leftCount + current->repeat)
+        else if (rank <= leftCount + 1)
             return current->value;
         else {
-            rank -= leftCount + current->repeat;
+            rank -= leftCount + 1;
             current = current->right;
         }
     }
     return T();
 }
 
-template <typename T, typename Compare, typename Node>
-T BinarySearchTree<T, Compare, Node>::min() {
-    std::shared_ptr<Node> current = root;
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+T BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::min() {
+    NodePtr<Node> current = root;
     while (current->left)
         current = current->left;
     return current->value;
 }
 
-template <typename T, typename Compare, typename Node>
-T BinarySearchTree<T, Compare, Node>::max() {
-    std::shared_ptr<Node> current = root;
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+T BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::max() {
+    NodePtr<Node> current = root;
     while (current->right)
         current = current->right;
     return current->value;
 }
 
-template <typename T, typename Compare, typename Node>
-T BinarySearchTree<T, Compare, Node>::floor(const T& value) {
-    std::shared_ptr<Node> current = root;
-    std::shared_ptr<Node> result = nullptr;
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+template <typename Key>
+NodePtr<Node> BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::floorNode(const Key& key) const {
+    NodePtr<Node> current = root;
+    NodePtr<Node> result = nullptr;
     while (current) {
-        if (!compare(value, current->value) && !compare(current->value, value))
-            return current->value;
-        if (compare(value, current->value))
+        stats.visit();
+        if (!compare(key, current->value) && !compare(current->value, key))
+            return current;
+        if (compare(key, current->value))
             current = current->left;
         else {
             result = current;
             current = current->right;
         }
     }
-    return result ? result->value : T();
+    return result;
 }
 
-template <typename T, typename Compare, typename Node>
-T BinarySearchTree<T, Compare, Node>::ceil(const T& value) {
-    std::shared_ptr<Node> current = root;
-    std::shared_ptr<Node> result = nullptr;
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+template <typename Key>
+NodePtr<Node> BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::ceilNode(const Key& key, NodePtr<Node> from, NodePtr<Node> bound) const {
+    NodePtr<Node> current = std::move(from);
+    NodePtr<Node> result = std::move(bound);
     while (current) {
-        if (!compare(value, current->value) && !compare(current->value, value))
-            return current->value;
-        if (compare(value, current->value)) {
+        stats.visit();
+        if (!compare(key, current->value) && !compare(current->value, key))
+            return current;
+        if (compare(key, current->value)) {
             result = current;
             current = current->left;
         } else
             current = current->right;
     }
+    return result;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+T BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::floor(const T& value) {
+    NodePtr<Node> result = floorNode(value);
+    return result ? result->value : T();
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+T BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::ceil(const T& value) {
+    NodePtr<Node> result = ceilNode(value);
+    return result ? result->value : T();
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+template <typename Key, typename C, typename>
+T BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::floor(const Key& key) const {
+    NodePtr<Node> result = floorNode(key);
+    return result ? result->value : T();
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+template <typename Key, typename C, typename>
+T BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::ceil(const Key& key) const {
+    NodePtr<Node> result = ceilNode(key);
     return result ? result->value : T();
 }
 
-template <typename T, typename Compare, typename Node>
-std::vector<T> BinarySearchTree<T, Compare, Node>::nsmallest(size_t n) {
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+std::vector<T> BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::nsmallest(size_t n) {
     std::vector<T> result;
-    if (n == 0 || this->empty())
-        return result;
-
-    std::shared_ptr<Node> current = root;
-    std::stack<std::shared_ptr<Node>> stack;
-    while (current || !stack.empty()) {
-        for (; current; current = current->left)
-            stack.push(current);
-        current = stack.top();
-        stack.pop();
-        result.push_back(current->value);
-        if (result.size() == n)
-            break;
-        current = current->right;
-    }
+    for (auto it = begin(); it != end() && result.size() < n; ++it)
+        result.push_back(*it);
     return result;
 }
 
-template <typename T, typename Compare, typename Node>
-std::vector<T> BinarySearchTree<T, Compare, Node>::nlargest(size_t n) {
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+std::vector<T> BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::nlargest(size_t n) {
     std::vector<T> result;
-    if (n == 0 || this->empty())
-        return result;
-
-    std::shared_ptr<Node> current = root;
-    std::stack<std::shared_ptr<Node>> stack;
-    while (current || !stack.empty()) {
-        for (; current; current = current->right)
-            stack.push(current);
-        current = stack.top();
-        stack.pop();
-        result.push_back(current->value);
-        if (result.size() == n)
-            break;
-        current = current->left;
+    for (auto it = rbegin(); it != rend() && result.size() < n; ++it)
+        result.push_back(*it);
+    return result;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+typename BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::iterator
+BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::find(const T& value) const {
+    return iterator(findNode(value), this);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+typename BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::iterator
+BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::lower_bound(const T& value) const {
+    return iterator(ceilNode(value), this);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+typename BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::iterator
+BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::upper_bound(const T& value) const {
+    return iterator(upperNode(value), this);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+template <typename Key>
+NodePtr<Node> BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::upperNode(const Key& key) const {
+    NodePtr<Node> current = root;
+    NodePtr<Node> result = nullptr;
+    while (current) {
+        stats.visit();
+        if (compare(key, current->value)) {
+            result = current;
+            current = current->left;
+        } else
+            current = current->right;
     }
     return result;
 }
 
+// Once key is known to lie on one side of node, the ancestors reached through
+// links from that same side only bound node's subtree on the other one, so
+// they are climbed past without a comparison; the first one reached from the
+// other side bounds it on key's side. Either key falls short of that bound and
+// the search goes down from node, or the climb carries on from the bound.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+template <typename Key>
+NodePtr<Node> BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::fingerNode(NodePtr<Node> finger, const Key& key, NodePtr<Node>& above) const {
+    NodePtr<Node> node = finger ? std::move(finger) : maximum();
+    above = nullptr;
+    while (node) {
+        stats.visit();
+        bool less = compare(key, node->value);
+        if (!less && !compare(node->value, key))
+            return node;
+        NodePtr<Node> up = node, parent = node->parent.lock();
+        while (parent && childOf(parent, !less) == up) {
+            up = parent;
+            parent = up->parent.lock();
+        }
+        if (less)
+            above = node;
+        if (parent == nullptr)
+            return node;
+        if (less ? compare(parent->value, key) : compare(key, parent->value)) {
+            if (!less)
+                above = parent;
+            return node;
+        }
+        node = parent;
+    }
+    return node;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+typename BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::iterator
+BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::find_from(iterator finger, const T& value) const {
+    NodePtr<Node> above;
+    return iterator(findNode(value, fingerNode(finger.node, value, above)), this);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+typename BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::iterator
+BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::lower_bound_from(iterator finger, const T& value) const {
+    NodePtr<Node> above;
+    NodePtr<Node> from = fingerNode(finger.node, value, above);
+    return iterator(ceilNode(value, std::move(from), std::move(above)), this);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+std::pair<typename BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::iterator,
+          typename BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::iterator>
+BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::equal_range(const T& value) const {
+    iterator first = lower_bound(value);
+    if (first != end() && !compare(value, *first))
+        return {first, std::next(first)};
+    return {first, first};
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+size_t BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::count_range(const T& lo, const T& hi) const {
+    if (compare(hi, lo))
+        return 0;
+    return countBefore(hi, true, false) - countBefore(lo, false, false);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+size_t BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::size_range(const T& lo, const T& hi) const {
+    if (compare(hi, lo))
+        return 0;
+    return countBefore(hi, true, true) - countBefore(lo, false, true);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+T BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::select_in_range(const T& lo, const T& hi, size_t rank) {
+    if (rank == 0 || rank > count_range(lo, hi))
+        return T();
+    return derived().select(countBefore(lo, false, false) + rank);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+template <typename Visitor>
+void BinarySearchTree<T, Compare, Node, Allocator, Stats, Derived>::visit_range(const T& lo, const T& hi, Visitor&& visitor) const {
+    for (auto it = lower_bound(lo); it != end() && !compare(hi, *it); ++it)
+        visitor(*it, it.repeat());
+}
+
 #endif  // BINART_SEARCH_TREE_HPP
\ No newline at end of file
@@ -0,0 +1,844 @@
+#ifndef BTREE_HPP
+#define BTREE_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "node_pool.hpp"
+
+// Compare-and-movemask kernels over an aligned block of `lanes` keys: bit i of
+// the result is set when keys[i] is ordered before (less) or after (greater)
+// value. Only signed integer and floating point keys have one, and only when
+// the build targets the matching instruction set; every other key type searches
+// its nodes with a scalar binary search.
+template <typename T, typename = void>
+struct SimdKeyKernel : std::false_type {};
+
+#if defined(__AVX2__)
+template <typename T>
+struct SimdKeyKernel<T, std::enable_if_t<std::is_integral_v<T> && std::is_signed_v<T> && sizeof(T) == 4>> : std::true_type {
+    static constexpr size_t lanes = 8;
+    static unsigned less(const T* keys, T value) noexcept {
+        __m256i block = _mm256_load_si256(reinterpret_cast<const __m256i*>(keys));
+        return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(value), block)));
+    }
+    static unsigned greater(const T* keys, T value) noexcept {
+        __m256i block = _mm256_load_si256(reinterpret_cast<const __m256i*>(keys));
+        return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(block, _mm256_set1_epi32(value))));
+    }
+};
+
+template <typename T>
+struct SimdKeyKernel<T, std::enable_if_t<std::is_integral_v<T> && std::is_signed_v<T> && sizeof(T) == 8>> : std::true_type {
+    static constexpr size_t lanes = 4;
+    static unsigned less(const T* keys, T value) noexcept {
+        __m256i block = _mm256_load_si256(reinterpret_cast<const __m256i*>(keys));
+        return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_set1_epi64x(value), block)));
+    }
+    static unsigned greater(const T* keys, T value) noexcept {
+        __m256i block = _mm256_load_si256(reinterpret_cast<const __m256i*>(keys));
+        return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(block, _mm256_set1_epi64x(value))));
+    }
+};
+
+template <>
+struct SimdKeyKernel<float> : std::true_type {
+    static constexpr size_t lanes = 8;
+    static unsigned less(const float* keys, float value) noexcept {
+        return _mm256_movemask_ps(_mm256_cmp_ps(_mm256_load_ps(keys), _mm256_set1_ps(value), _CMP_LT_OQ));
+    }
+    static unsigned greater(const float* keys, float value) noexcept {
+        return _mm256_movemask_ps(_mm256_cmp_ps(_mm256_load_ps(keys), _mm256_set1_ps(value), _CMP_GT_OQ));
+    }
+};
+
+template <>
+struct SimdKeyKernel<double> : std::true_type {
+    static constexpr size_t lanes = 4;
+    static unsigned less(const double* keys, double value) noexcept {
+        return _mm256_movemask_pd(_mm256_cmp_pd(_mm256_load_pd(keys), _mm256_set1_pd(value), _CMP_LT_OQ));
+    }
+    static unsigned greater(const double* keys, double value) noexcept {
+        return _mm256_movemask_pd(_mm256_cmp_pd(_mm256_load_pd(keys), _mm256_set1_pd(value), _CMP_GT_OQ));
+    }
+};
+#elif defined(__SSE2__)
+template <typename T>
+struct SimdKeyKernel<T, std::enable_if_t<std::is_integral_v<T> && std::is_signed_v<T> && sizeof(T) == 4>> : std::true_type {
+    static constexpr size_t lanes = 4;
+    static unsigned less(const T* keys, T value) noexcept {
+        __m128i block = _mm_load_si128(reinterpret_cast<const __m128i*>(keys));
+        return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(block, _mm_set1_epi32(value))));
+    }
+    static unsigned greater(const T* keys, T value) noexcept {
+        __m128i block = _mm_load_si128(reinterpret_cast<const __m128i*>(keys));
+        return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(block, _mm_set1_epi32(value))));
+    }
+};
+
+#if defined(__SSE4_2__)
+template <typename T>
+struct SimdKeyKernel<T, std::enable_if_t<std::is_integral_v<T> && std::is_signed_v<T> && sizeof(T) == 8>> : std::true_type {
+    static constexpr size_t lanes = 2;
+    static unsigned less(const T* keys, T value) noexcept {
+        __m128i block = _mm_load_si128(reinterpret_cast<const __m128i*>(keys));
+        return _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(_mm_set1_epi64x(value), block)));
+    }
+    static unsigned greater(const T* keys, T value) noexcept {
+        __m128i block = _mm_load_si128(reinterpret_cast<const __m128i*>(keys));
+        return _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(block, _mm_set1_epi64x(value))));
+    }
+};
+#endif
+
+template <>
+struct SimdKeyKernel<float> : std::true_type {
+    static constexpr size_t lanes = 4;
+    static unsigned less(const float* keys, float value) noexcept {
+        return _mm_movemask_ps(_mm_cmplt_ps(_mm_load_ps(keys), _mm_set1_ps(value)));
+    }
+    static unsigned greater(const float* keys, float value) noexcept {
+        return _mm_movemask_ps(_mm_cmpgt_ps(_mm_load_ps(keys), _mm_set1_ps(value)));
+    }
+};
+
+template <>
+struct SimdKeyKernel<double> : std::true_type {
+    static constexpr size_t lanes = 2;
+    static unsigned less(const double* keys, double value) noexcept {
+        return _mm_movemask_pd(_mm_cmplt_pd(_mm_load_pd(keys), _mm_set1_pd(value)));
+    }
+    static unsigned greater(const double* keys, double value) noexcept {
+        return _mm_movemask_pd(_mm_cmpgt_pd(_mm_load_pd(keys), _mm_set1_pd(value)));
+    }
+};
+#endif
+
+// The keys of a node fill one cache line, which also fixes the fanout: a node
+// holds at most 2t - 1 keys, where t is half the number of key slots, and every
+// node but the root holds at least t - 1. Equal keys are folded into a repeat
+// count, like in the binary trees.
+template <typename T>
+struct BTreeLeaf {
+    static constexpr size_t slots = std::max<size_t>(4, 64 / sizeof(T));
+    static constexpr size_t minDegree = slots / 2;
+    static constexpr size_t capacity = 2 * minDegree - 1;
+
+    alignas(std::max<size_t>(64, alignof(T))) T keys[slots] = {};
+    std::uint32_t repeats[capacity] = {};
+    std::uint16_t length = 0;
+    bool leaf = true;
+};
+
+// Inner nodes also record the number of distinct keys below each child, which
+// is what rank() and select() descend on.
+template <typename T>
+struct BTreeInner : BTreeLeaf<T> {
+    BTreeLeaf<T>* children[BTreeLeaf<T>::capacity + 1] = {};
+    std::uint32_t counts[BTreeLeaf<T>::capacity + 1] = {};
+
+    BTreeInner() { this->leaf = false; }
+};
+
+// Ordered multiset with the query interface of BinarySearchTree, stored as a
+// B-tree of cache-line-sized nodes. Lookups touch one key block per level, and
+// with std::less over signed integer or floating point keys each block is
+// searched with SIMD compares instead of a chain of branches. Insertion splits
+// and deletion refills full or minimal nodes on the way down, so both work in a
+// single pass from the root.
+template <typename T, typename Compare = std::less<T>, typename Allocator = std::allocator<T>>
+class BTree {
+    using Leaf = BTreeLeaf<T>;
+    using Inner = BTreeInner<T>;
+
+    static constexpr size_t minDegree = Leaf::minDegree;
+    static constexpr size_t capacity = Leaf::capacity;
+    static constexpr bool simdSearch =
+        SimdKeyKernel<T>::value && (std::is_same_v<Compare, std::less<T>> || std::is_same_v<Compare, std::less<>>);
+
+    Leaf* root = nullptr;
+    size_t count = 0;
+    Compare compare = Compare();
+    Allocator allocator = Allocator();
+
+    static Inner* inner(Leaf* node) noexcept { return static_cast<Inner*>(node); }
+    static const Inner* inner(const Leaf* node) noexcept { return static_cast<const Inner*>(node); }
+
+    template <typename Node>
+    Node* createNode();
+    void destroyNode(Leaf* node) noexcept;
+    void destroySubtree(Leaf* node) noexcept;
+
+    template <typename Key>
+    size_t lowerIndex(const Leaf* node, const Key& key) const noexcept;
+    template <typename Key>
+    size_t upperIndex(const Leaf* node, const Key& key) const noexcept;
+    static void insertKey(Leaf* node, size_t index, T value, std::uint32_t repeat);
+    static void eraseKey(Leaf* node, size_t index);
+    void splitChild(Inner* parent, size_t index);
+    void borrowFromLeft(Inner* parent, size_t index);
+    void borrowFromRight(Inner* parent, size_t index);
+    void merge(Inner* parent, size_t index);
+    size_t refill(Inner* parent, size_t index);
+
+    template <typename Value>
+    bool insert(Leaf* node, Value&& value);
+    template <typename Key>
+    bool remove(Leaf* node, const Key& key, bool all);
+    template <typename Value>
+    void insertValue(Value&& value);
+    template <typename Key>
+    void removeKey(const Key& key);
+    template <typename Key>
+    bool containsKey(const Key& key) const;
+    template <typename Key>
+    size_t rankKey(const Key& key) const;
+    template <typename Key>
+    T floorKey(const Key& key) const;
+    template <typename Key>
+    T ceilKey(const Key& key) const;
+    Leaf* build(std::vector<T>& keys, const std::vector<std::uint32_t>& repeats, size_t lo, size_t hi, size_t reach);
+    size_t check(const Leaf* node, size_t depth, size_t& leafDepth) const;
+    void collect(const Leaf* node, size_t n, bool reverse, std::vector<T>& result) const;
+
+   public:
+    BTree() = default;
+    explicit BTree(const Allocator& allocator) : allocator(allocator) {}
+    template <typename InputIt>
+    BTree(InputIt first, InputIt last) { assign_sorted(first, last); }
+    BTree(const BTree&) = delete;
+    BTree(BTree&& other) noexcept;
+    BTree& operator=(const BTree&) = delete;
+    BTree& operator=(BTree&& other) noexcept;
+    ~BTree() { clear(); }
+
+    size_t size() const noexcept { return count; }
+    bool empty() const noexcept { return root == nullptr; }
+    void clear() noexcept;
+    size_t height() const noexcept;
+    void print() const;
+    void check() const;
+
+    bool contains(const T& value) const { return containsKey(value); }
+    void insert(const T& value) { insertValue(value); }
+    void insert(T&& value) { insertValue(std::move(value)); }
+    void remove(const T& value) { removeKey(value); }
+    size_t rank(const T& value) const { return rankKey(value); }
+    T select(size_t rank) const;
+    T min() const;
+    T max() const;
+    T floor(const T& value) const { return floorKey(value); }
+    T ceil(const T& value) const { return ceilKey(value); }
+    std::vector<T> nsmallest(size_t n) const;
+    std::vector<T> nlargest(size_t n) const;
+
+    template <typename... Args>
+    void emplace(Args&&... args) { insert(T(std::forward<Args>(args)...)); }
+
+    // Lookups with any key a transparent comparator orders against T. Keys of
+    // another type than T are searched for with scalar compares.
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    bool contains(const Key& key) const { return containsKey(key); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    void remove(const Key& key) { removeKey(key); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    size_t rank(const Key& key) const { return rankKey(key); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    T floor(const Key& key) const { return floorKey(key); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    T ceil(const Key& key) const { return ceilKey(key); }
+
+    // Replaces the contents with the sorted range [first, last) in O(n), folding
+    // equal keys into one and spreading the rest evenly over the fewest levels.
+    template <typename InputIt>
+    void assign_sorted(InputIt first, InputIt last);
+
+    Allocator get_allocator() const noexcept { return allocator; }
+};
+
+template <typename T, typename Compare, typename Allocator>
+template <typename Node>
+Node* BTree<T, Compare, Allocator>::createNode() {
+    using NodeAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+    using Traits = std::allocator_traits<NodeAllocator>;
+    NodeAllocator nodeAllocator(allocator);
+    Node* node = Traits::allocate(nodeAllocator, 1);
+    try {
+        Traits::construct(nodeAllocator, node);
+    } catch (...) {
+        Traits::deallocate(nodeAllocator, node, 1);
+        throw;
+    }
+    return node;
+}
+
+template <typename T, typename Compare, typename Allocator>
+void BTree<T, Compare, Allocator>::destroyNode(Leaf* node) noexcept {
+    auto destroy = [this](auto* node) {
+        using Node = std::remove_pointer_t<decltype(node)>;
+        using NodeAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+        using Traits = std::allocator_traits<NodeAllocator>;
+        NodeAllocator nodeAllocator(allocator);
+        Traits::destroy(nodeAllocator, node);
+        Traits::deallocate(nodeAllocator, node, 1);
+    };
+    if (node->leaf)
+        destroy(node);
+    else
+        destroy(inner(node));
+}
+
+// The tree is only O(log_t n) levels deep, so a recursive walk is fine here.
+template <typename T, typename Compare, typename Allocator>
+void BTree<T, Compare, Allocator>::destroySubtree(Leaf* node) noexcept {
+    if (!node->leaf)
+        for (size_t i = 0; i <= node->length; ++i)
+            destroySubtree(inner(node)->children[i]);
+    destroyNode(node);
+}
+
+template <typename T, typename Compare, typename Allocator>
+BTree<T, Compare, Allocator>::BTree(BTree&& other) noexcept
+    : root(std::exchange(other.root, nullptr)),
+      count(std::exchange(other.count, 0)),
+      compare(std::move(other.compare)),
+      allocator(std::move(other.allocator)) {}
+
+template <typename T, typename Compare, typename Allocator>
+BTree<T, Compare, Allocator>& BTree<T, Compare, Allocator>::operator=(BTree&& other) noexcept {
+    if (this != &other) {
+        clear();
+        root = std::exchange(other.root, nullptr);
+        count = std::exchange(other.count, 0);
+        compare = std::move(other.compare);
+        allocator = std::move(other.allocator);
+    }
+    return *this;
+}
+
+template <typename T, typename Compare, typename Allocator>
+void BTree<T, Compare, Allocator>::clear() noexcept {
+    if (root)
+        destroySubtree(std::exchange(root, nullptr));
+    count = 0;
+    releaseAllocator(allocator);
+}
+
+template <typename T, typename Compare, typename Allocator>
+size_t BTree<T, Compare, Allocator>::height() const noexcept {
+    size_t height = 0;
+    for (const Leaf* node = root; node; node = node->leaf ? nullptr : inner(node)->children[0])
+        ++height;
+    return height;
+}
+
+// Number of keys in the node ordered before value. The SIMD path compares the
+// whole key block and masks off the unused slots, so it never branches on keys.
+template <typename T, typename Compare, typename Allocator>
+template <typename Key>
+size_t BTree<T, Compare, Allocator>::lowerIndex(const Leaf* node, const Key& key) const noexcept {
+    if constexpr (simdSearch && std::is_same_v<Key, T>) {
+        using Kernel = SimdKeyKernel<T>;
+        std::uint64_t mask = 0;
+        for (size_t i = 0; i < Leaf::slots; i += Kernel::lanes)
+            mask |= std::uint64_t(Kernel::less(node->keys + i, key)) << i;
+        return __builtin_popcountll(mask & ((std::uint64_t(1) << node->length) - 1));
+    } else
+        return std::lower_bound(node->keys, node->keys + node->length, key, compare) - node->keys;
+}
+
+// Number of keys in the node not ordered after value.
+template <typename T, typename Compare, typename Allocator>
+template <typename Key>
+size_t BTree<T, Compare, Allocator>::upperIndex(const Leaf* node, const Key& key) const noexcept {
+    if constexpr (simdSearch && std::is_same_v<Key, T>) {
+        using Kernel = SimdKeyKernel<T>;
+        std::uint64_t mask = 0;
+        for (size_t i = 0; i < Leaf::slots; i += Kernel::lanes)
+            mask |= std::uint64_t(Kernel::greater(node->keys + i, key)) << i;
+        return node->length - __builtin_popcountll(mask & ((std::uint64_t(1) << node->length) - 1));
+    } else
+        return std::upper_bound(node->keys, node->keys + node->length, key, compare) - node->keys;
+}
+
+template <typename T, typename Compare, typename Allocator>
+void BTree<T, Compare, Allocator>::insertKey(Leaf* node, size_t index, T value, std::uint32_t repeat) {
+    std::move_backward(node->keys + index, node->keys + node->length, node->keys + node->length + 1);
+    std::copy_backward(node->repeats + index, node->repeats + node->length, node->repeats + node->length + 1);
+    node->keys[index] = std::move(value);
+    node->repeats[index] = repeat;
+    ++node->length;
+}
+
+template <typename T, typename Compare, typename Allocator>
+void BTree<T, Compare, Allocator>::eraseKey(Leaf* node, size_t index) {
+    std::move(node->keys + index + 1, node->keys + node->length, node->keys + index);
+    std::copy(node->repeats + index + 1, node->repeats + node->length, node->repeats + index);
+    --node->length;
+}
+
+// Splits the full child at index around its median key, which moves up into the
+// parent. The parent must not be full itself.
+template <typename T, typename Compare, typename Allocator>
+void BTree<T, Compare, Allocator>::splitChild(Inner* parent, size_t index) {
+    Leaf* left = parent->children[index];
+    assert(left->length == capacity && parent->length < capacity);
+    Leaf* right = left->leaf ? createNode<Leaf>() : createNode<Inner>();
+    std::move(left->keys + minDegree, left->keys + capacity, right->keys);
+    std::copy(left->repeats + minDegree, left->repeats + capacity, right->repeats);
+    size_t moved = minDegree - 1;
+    if (!left->leaf) {
+        std::copy(inner(left)->children + minDegree, inner(left)->children + capacity + 1, inner(right)->children);
+        std::copy(inner(left)->counts + minDegree, inner(left)->counts + capacity + 1, inner(right)->counts);
+        for (size_t i = 0; i < minDegree; ++i)
+            moved += inner(right)->counts[i];
+    }
+    right->length = left->length = minDegree - 1;
+
+    std::copy_backward(parent->children + index + 1, parent->children + parent->length + 1, parent->children + parent->length + 2);
+    std::copy_backward(parent->counts + index + 1, parent->counts + parent->length + 1, parent->counts + parent->length + 2);
+    insertKey(parent, index, std::move(left->keys[minDegree - 1]), left->repeats[minDegree - 1]);
+    parent->children[index + 1] = right;
+    parent->counts[index + 1] = moved;
+    parent->counts[index] -= moved + 1;
+}
+
+// Rotates the last key of the left sibling through the parent into the child at
+// index, together with the last subtree of the sibling.
+template <typename T, typename Compare, typename Allocator>
+void BTree<T, Compare, Allocator>::borrowFromLeft(Inner* parent, size_t index) {
+    Leaf* child = parent->children[index];
+    Leaf* sibling = parent->children[index - 1];
+    insertKey(child, 0, std::move(parent->keys[index - 1]), parent->repeats[index - 1]);
+    size_t moved = 1;
+    if (!child->leaf) {
+        Inner* to = inner(child);
+        Inner* from = inner(sibling);
+        std::copy_backward(to->children, to->children + child->length, to->children + child->length + 1);
+        std::copy_backward(to->counts, to->counts + child->length, to->counts + child->length + 1);
+        to->children[0] = from->children[sibling->length];
+        to->counts[0] = from->counts[sibling->length];
+        moved += to->counts[0];
+    }
+    parent->keys[index - 1] = std::move(sibling->keys[sibling->length - 1]);
+    parent->repeats[index - 1] = sibling->repeats[sibling->length - 1];
+    --sibling->length;
+    parent->counts[index] += moved;
+    parent->counts[index - 1] -= moved;
+}
+
+// Mirror image of borrowFromLeft, taking the first key of the right sibling.
+template <typename T, typename Compare, typename Allocator>
+void BTree<T, Compare, Allocator>::borrowFromRight(Inner* parent, size_t index) {
+    Leaf* child = parent->children[index];
+    Leaf* sibling = parent->children[index + 1];
+    insertKey(child, child->length, std::move(parent->keys[index]), parent->repeats[index]);
+    size_t moved = 1;
+    if (!child->leaf) {
+        Inner* to = inner(child);
+        Inner* from = inner(sibling);
+        to->children[child->length] = from->children[0];
+        to->counts[child->length] = from->counts[0];
+        moved += from->counts[0];
+        std::copy(from->children + 1, from->children + sibling->length + 1, from->children);
+        std::copy(from->counts + 1, from->counts + sibling->length + 1, from->counts);
+    }
+    parent->keys[index] = std::move(sibling->keys[0]);
+    parent->repeats[index] = sibling->repeats[0];
+    eraseKey(sibling, 0);
+    parent->counts[index] += moved;
+    parent->counts[index + 1] -= moved;
+}
+
+// Folds the key at index and the child to its right into the child to its left.
+// Both children must be minimal, so that the result fits into one node.
+template <typename T, typename Compare, typename Allocator>
+void BTree<T, Compare, Allocator>::merge(Inner* parent, size_t index) {
+    Leaf* left = parent->children[index];
+    Leaf* right = parent->children[index + 1];
+    assert(left->length + right->length < capacity);
+    left->keys[left->length] = std::move(parent->keys[index]);
+    left->repeats[left->length] = parent->repeats[index];
+    std::move(right->keys, right->keys + right->length, left->keys + left->length + 1);
+    std::copy(right->repeats, right->repeats + right->length, left->repeats + left->length + 1);
+    if (!left->leaf) {
+        std::copy(inner(right)->children, inner(right)->children + right->length + 1, inner(left)->children + left->length + 1);
+        std::copy(inner(right)->counts, inner(right)->counts + right->length + 1, inner(left)->counts + left->length + 1);
+    }
+    left->length += right->length + 1;
+
+    parent->counts[index] += parent->counts[index + 1] + 1;
+    std::copy(parent->children + index + 2, parent->children + parent->length + 1, parent->children + index + 1);
+    std::copy(parent->counts + index + 2, parent->counts + parent->length + 1, parent->counts + index + 1);
+    eraseKey(parent, index);
+    destroyNode(right);
+}
+
+// Makes sure the child at index holds at least t keys before the deletion steps
+// into it, and returns the index of the child now covering its key range.
+template <typename T, typename Compare, typename Allocator>
+size_t BTree<T, Compare, Allocator>::refill(Inner* parent, size_t index) {
+    if (parent->children[index]->length >= minDegree)
+        return index;
+    if (index > 0 && parent->children[index - 1]->length >= minDegree)
+        borrowFromLeft(parent, index);
+    else if (index < parent->length && parent->children[index + 1]->length >= minDegree)
+        borrowFromRight(parent, index);
+    else if (index < parent->length)
+        merge(parent, index);
+    else
+        merge(parent, --index);
+    return index;
+}
+
+// Inserts value below a node that is not full, splitting full children before
+// stepping into them. Returns whether a new distinct key was added.
+template <typename T, typename Compare, typename Allocator>
+template <typename Value>
+bool BTree<T, Compare, Allocator>::insert(Leaf* node, Value&& value) {
+    size_t index = lowerIndex(node, value);
+    if (index < node->length && !compare(value, node->keys[index])) {
+        ++node->repeats[index];
+        return false;
+    }
+    if (node->leaf) {
+        insertKey(node, index, std::forward<Value>(value), 1);
+        return true;
+    }
+    Inner* parent = inner(node);
+    if (parent->children[index]->length == capacity) {
+        splitChild(parent, index);
+        if (!compare(value, parent->keys[index])) {
+            if (!compare(parent->keys[index], value)) {
+                ++parent->repeats[index];
+                return false;
+            }
+            ++index;
+        }
+    }
+    if (!insert(parent->children[index], std::forward<Value>(value)))
+        return false;
+    ++parent->counts[index];
+    return true;
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename Value>
+void BTree<T, Compare, Allocator>::insertValue(Value&& value) {
+    if (root == nullptr) {
+        root = createNode<Leaf>();
+        insertKey(root, 0, std::forward<Value>(value), 1);
+        count = 1;
+        return;
+    }
+    assert(count < std::numeric_limits<std::uint32_t>::max());
+    if (root->length == capacity) {
+        Inner* top = createNode<Inner>();
+        top->children[0] = root;
+        top->counts[0] = count;
+        root = top;
+        splitChild(top, 0);
+    }
+    if (insert(root, std::forward<Value>(value)))
+        ++count;
+}
+
+// Removes one occurrence of value below a node holding at least t keys (or the
+// root), or the key with all its repeats when all is set. Returns whether a
+// distinct key went away.
+template <typename T, typename Compare, typename Allocator>
+template <typename Key>
+bool BTree<T, Compare, Allocator>::remove(Leaf* node, const Key& key, bool all) {
+    size_t index = lowerIndex(node, key);
+    bool found = index < node->length && !compare(key, node->keys[index]);
+    if (found && !all && node->repeats[index] > 1) {
+        --node->repeats[index];
+        return false;
+    }
+    if (node->leaf) {
+        if (found)
+            eraseKey(node, index);
+        return found;
+    }
+    Inner* parent = inner(node);
+    if (found) {
+        Leaf* left = parent->children[index];
+        Leaf* right = parent->children[index + 1];
+        if (left->length >= minDegree || right->length >= minDegree) {
+            // Replace the key by its predecessor or successor, taken out of the
+            // fuller side with all of its repeats.
+            size_t side = left->length < minDegree;
+            Leaf* current = parent->children[index + side];
+            while (!current->leaf)
+                current = inner(current)->children[side ? 0 : current->length];
+            size_t position = side ? 0 : current->length - 1;
+            T replacement = current->keys[position];
+            std::uint32_t repeat = current->repeats[position];
+            remove(parent->children[index + side], replacement, true);
+            --parent->counts[index + side];
+            parent->keys[index] = std::move(replacement);
+            parent->repeats[index] = repeat;
+            return true;
+        }
+        merge(parent, index);
+    } else
+        index = refill(parent, index);
+    if (!remove(parent->children[index], key, all))
+        return false;
+    --parent->counts[index];
+    return true;
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename Key>
+void BTree<T, Compare, Allocator>::removeKey(const Key& key) {
+    if (root == nullptr)
+        return;
+    if (remove(root, key, false))
+        --count;
+    if (root->length == 0) {
+        Leaf* empty = root;
+        root = root->leaf ? nullptr : inner(root)->children[0];
+        destroyNode(empty);
+    }
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename Key>
+bool BTree<T, Compare, Allocator>::containsKey(const Key& key) const {
+    const Leaf* node = root;
+    while (node) {
+        size_t index = lowerIndex(node, key);
+        if (index < node->length && !compare(key, node->keys[index]))
+            return true;
+        node = node->leaf ? nullptr : inner(node)->children[index];
+    }
+    return false;
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename Key>
+size_t BTree<T, Compare, Allocator>::rankKey(const Key& key) const {
+    size_t rank = 0;
+    const Leaf* node = root;
+    while (node) {
+        size_t index = upperIndex(node, key);
+        rank += index;
+        if (!node->leaf)
+            for (size_t i = 0; i < index; ++i)
+                rank += inner(node)->counts[i];
+        if (index > 0 && !compare(node->keys[index - 1], key))
+            return rank;
+        node = node->leaf ? nullptr : inner(node)->children[index];
+    }
+    return rank;
+}
+
+template <typename T, typename Compare, typename Allocator>
+T BTree<T, Compare, Allocator>::select(size_t rank) const {
+    const Leaf* node = root;
+    while (node) {
+        if (node->leaf)
+            return rank >= 1 && rank <= node->length ? node->keys[rank - 1] : T();
+        size_t index = 0;
+        for (; index < node->length; ++index) {
+            if (rank <= inner(node)->counts[index])
+                break;
+            rank -= inner(node)->counts[index];
+            if (rank == 1)
+                return node->keys[index];
+            --rank;
+        }
+        node = inner(node)->children[index];
+    }
+    return T();
+}
+
+template <typename T, typename Compare, typename Allocator>
+T BTree<T, Compare, Allocator>::min() const {
+    const Leaf* node = root;
+    while (!node->leaf)
+        node = inner(node)->children[0];
+    return node->keys[0];
+}
+
+template <typename T, typename Compare, typename Allocator>
+T BTree<T, Compare, Allocator>::max() const {
+    const Leaf* node = root;
+    while (!node->leaf)
+        node = inner(node)->children[node->length];
+    return node->keys[node->length - 1];
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename Key>
+T BTree<T, Compare, Allocator>::floorKey(const Key& key) const {
+    const T* result = nullptr;
+    const Leaf* node = root;
+    while (node) {
+        size_t index = upperIndex(node, key);
+        if (index > 0) {
+            result = &node->keys[index - 1];
+            if (!compare(*result, key))
+                break;
+        }
+        node = node->leaf ? nullptr : inner(node)->children[index];
+    }
+    return result ? *result : T();
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename Key>
+T BTree<T, Compare, Allocator>::ceilKey(const Key& key) const {
+    const T* result = nullptr;
+    const Leaf* node = root;
+    while (node) {
+        size_t index = lowerIndex(node, key);
+        if (index < node->length) {
+            result = &node->keys[index];
+            if (!compare(key, *result))
+                break;
+        }
+        node = node->leaf ? nullptr : inner(node)->children[index];
+    }
+    return result ? *result : T();
+}
+
+// Appends keys of the subtree in order, or in reverse order, until result holds n.
+template <typename T, typename Compare, typename Allocator>
+void BTree<T, Compare, Allocator>::collect(const Leaf* node, size_t n, bool reverse, std::vector<T>& result) const {
+    for (size_t i = 0; i <= node->length && result.size() < n; ++i) {
+        size_t index = reverse ? node->length - i : i;
+        if (!node->leaf)
+            collect(inner(node)->children[index], n, reverse, result);
+        if (i < node->length && result.size() < n)
+            result.push_back(node->keys[reverse ? index - 1 : index]);
+    }
+}
+
+template <typename T, typename Compare, typename Allocator>
+std::vector<T> BTree<T, Compare, Allocator>::nsmallest(size_t n) const {
+    std::vector<T> result;
+    if (root)
+        collect(root, n, false, result);
+    return result;
+}
+
+template <typename T, typename Compare, typename Allocator>
+std::vector<T> BTree<T, Compare, Allocator>::nlargest(size_t n) const {
+    std::vector<T> result;
+    if (root)
+        collect(root, n, true, result);
+    return result;
+}
+
+template <typename T, typename Compare, typename Allocator>
+void BTree<T, Compare, Allocator>::print() const {
+    for (const T& value : nsmallest(count))
+        std::cout << value << " ";
+    std::cout << std::endl;
+}
+
+template <typename T, typename Compare, typename Allocator>
+void BTree<T, Compare, Allocator>::check() const {
+    size_t leafDepth = 0;
+    if (root)
+        assert(check(root, 1, leafDepth) == count);
+    else
+        assert(count == 0);
+}
+
+// Verifies the node invariants of a subtree and returns its number of keys.
+template <typename T, typename Compare, typename Allocator>
+size_t BTree<T, Compare, Allocator>::check(const Leaf* node, size_t depth, size_t& leafDepth) const {
+    assert(node->length >= (node == root ? 1 : minDegree - 1) && node->length <= capacity);
+    for (size_t i = 0; i < node->length; ++i) {
+        assert(node->repeats[i] >= 1);
+        assert(i == 0 || compare(node->keys[i - 1], node->keys[i]));
+    }
+    if (node->leaf) {
+        assert(leafDepth == 0 || leafDepth == depth);
+        leafDepth = depth;
+        return node->length;
+    }
+    size_t total = node->length;
+    for (size_t i = 0; i <= node->length; ++i) {
+        const Leaf* child = inner(node)->children[i];
+        assert(i == 0 || compare(node->keys[i - 1], child->keys[0]));
+        assert(i == node->length || compare(child->keys[child->length - 1], node->keys[i]));
+        size_t size = check(child, depth + 1, leafDepth);
+        assert(size == inner(node)->counts[i]);
+        total += size;
+    }
+    return total;
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename InputIt>
+void BTree<T, Compare, Allocator>::assign_sorted(InputIt first, InputIt last) {
+    clear();
+    std::vector<T> keys;
+    std::vector<std::uint32_t> repeats;
+    for (; first != last; ++first) {
+        if (!keys.empty() && !compare(keys.back(), *first)) {
+            assert(!compare(*first, keys.back()));
+            ++repeats.back();
+            continue;
+        }
+        keys.push_back(*first);
+        repeats.push_back(1);
+    }
+    if (keys.empty())
+        return;
+    assert(keys.size() < std::numeric_limits<std::uint32_t>::max());
+    // reach is the bound on keys + 1 of a subtree one level below the root.
+    size_t reach = 1;
+    while (reach * (capacity + 1) < keys.size() + 1)
+        reach *= capacity + 1;
+    root = build(keys, repeats, 0, keys.size(), reach);
+    count = keys.size();
+}
+
+// Builds a subtree over keys [lo, hi), where every child can hold fewer than
+// reach keys. The keys are dealt out so that the children differ by at most one,
+// which keeps every node at least half full.
+template <typename T, typename Compare, typename Allocator>
+typename BTree<T, Compare, Allocator>::Leaf* BTree<T, Compare, Allocator>::build(
+    std::vector<T>& keys, const std::vector<std::uint32_t>& repeats, size_t lo, size_t hi, size_t reach) {
+    size_t n = hi - lo;
+    if (reach == 1) {
+        Leaf* node = createNode<Leaf>();
+        std::move(keys.begin() + lo, keys.begin() + hi, node->keys);
+        std::copy(repeats.begin() + lo, repeats.begin() + hi, node->repeats);
+        node->length = n;
+        return node;
+    }
+    size_t children = (n + reach) / reach;
+    Inner* node = createNode<Inner>();
+    for (size_t i = 0, start = lo; i < children; ++i) {
+        size_t end = lo + (n + 1) * (i + 1) / children - 1;
+        node->children[i] = build(keys, repeats, start, end, reach / (capacity + 1));
+        node->counts[i] = end - start;
+        if (i + 1 < children) {
+            node->keys[i] = std::move(keys[end]);
+            node->repeats[i] = repeats[end];
+        }
+        start = end + 1;
+    }
+    node->length = children - 1;
+    return node;
+}
+
+#endif  // BTREE_HPP
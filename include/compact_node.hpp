@@ -0,0 +1,55 @@
+#ifndef COMPACT_NODE_HPP
+#define COMPACT_NODE_HPP
+
+#include <cstdint>
+
+#include "node.hpp"
+
+// Raw parent pointer exposing the subset of the std::weak_ptr interface the
+// trees rely on, so that the helpers in node.hpp work on compact nodes as is.
+template <typename Node>
+class ParentLink {
+    Node* pointer = nullptr;
+
+   public:
+    ParentLink() = default;
+    ParentLink(Node* pointer) noexcept : pointer(pointer) {}
+    ParentLink& operator=(Node* other) noexcept {
+        pointer = other;
+        return *this;
+    }
+
+    Node* lock() const noexcept { return pointer; }
+    bool expired() const noexcept { return pointer == nullptr; }
+    void reset() noexcept { pointer = nullptr; }
+};
+
+// Common part of the compact node family: intrusive raw links owned by the
+// tree, `left`/`right` as plain members rather than references into a
+// `children[]` array (the trees reach them by side through childOf), and
+// counters of a configurable width. Balancing metadata of the derived nodes is
+// a single byte, which lands in what would otherwise be tail padding, so that
+// a node with a small key fits in one cache line.
+template <typename Derived, typename T, typename SizeType>
+struct CompactNodeBase {
+   public:
+    using pointer = Derived*;
+    using size_type = SizeType;
+
+    T value;
+    ParentLink<Derived> parent;
+    pointer left = nullptr;
+    pointer right = nullptr;
+    SizeType size, count, repeat;
+
+    CompactNodeBase() = default;
+    CompactNodeBase(T value, SizeType repeat = 1)
+        : value(std::move(value)), size(repeat), count(repeat), repeat(repeat) {}
+
+    inline void update() {
+        count = 1 + (left ? left->count : 0) + (right ? right->count : 0);
+        size = repeat + (left ? left->size : 0) + (right ? right->size : 0);
+    }
+};
+
+#endif  // COMPACT_NODE_HPP
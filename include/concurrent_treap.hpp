@@ -0,0 +1,565 @@
+#ifndef CONCURRENT_TREAP_HPP
+#define CONCURRENT_TREAP_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "epoch.hpp"
+#include "priority.hpp"
+
+// Treap node that is never modified once it has been published. `version` is
+// the epoch of the update that created it: only nodes of the update in progress
+// are still private to the writer and may be changed in place.
+template <typename T>
+struct ConcurrentTreapNode {
+    using pointer = ConcurrentTreapNode*;
+
+    T value;
+    pointer left = nullptr;
+    pointer right = nullptr;
+    std::uint32_t size, count, repeat, priority;
+    std::uint64_t version;
+
+    ConcurrentTreapNode(T value, std::uint64_t version)
+        : value(std::move(value)), size(1), count(1), repeat(1), priority(0), version(version) {}
+    ConcurrentTreapNode(const ConcurrentTreapNode& other, std::uint64_t version)
+        : value(other.value), left(other.left), right(other.right), size(other.size), count(other.count),
+          repeat(other.repeat), priority(other.priority), version(version) {}
+
+    inline void update() {
+        count = 1 + (left ? left->count : 0) + (right ? right->count : 0);
+        size = repeat + (left ? left->size : 0) + (right ? right->size : 0);
+    }
+};
+
+// Single-writer, many-reader ordered multiset. Updates go through the split and
+// merge of NonRotatingTreap, but copy every published node they would change,
+// so the writer builds the next version next to the current one and publishes
+// it by storing the new root. Readers pin a version through a Snapshot and see
+// it unchanged for as long as they hold it, without locks and without touching
+// any reference count. The nodes an update replaced are freed by the writer
+// once no reader can still be in a version that contained them (see
+// EpochDomain). Writers are serialised by a mutex; the allocator is only ever
+// used under it.
+template <typename T, typename Compare = std::less<T>, typename Allocator = std::allocator<T>, typename Priority = RandomPriority>
+class ConcurrentTreap {
+    using Node = ConcurrentTreapNode<T>;
+    using NodeAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+    using Traits = std::allocator_traits<NodeAllocator>;
+    using Garbage = std::vector<Node*>;
+
+    // Nodes an update took out of the published version, and the ones it
+    // allocated, which have to go if the update does not complete.
+    struct Update {
+        Garbage unlinked, created;
+    };
+
+    // Number of retired batches after which the writer scans the reader slots.
+    static constexpr size_t reclaimBatches = 32;
+
+    std::atomic<Node*> root{nullptr};
+    std::atomic<size_t> count{0};
+    Compare compare = Compare();
+    // Drawn from by the writer only, under the mutex.
+    Priority priorities;
+    NodeAllocator allocator;
+    mutable EpochDomain domain;
+    std::mutex writer;
+    std::uint64_t version = 0;
+    std::vector<std::pair<std::uint64_t, Garbage>> retired;
+
+    // Makes sure the next push_back does not allocate, so that recording a node
+    // can never fail after the node itself was created or unlinked.
+    template <typename Vector>
+    static void reserveOne(Vector& vector) {
+        if (vector.size() == vector.capacity())
+            vector.reserve(std::max<size_t>(16, 2 * vector.size()));
+    }
+    template <typename... Args>
+    Node* createNode(Update& update, Args&&... args);
+    void destroyNode(Node* node) noexcept;
+    void destroySubtree(Node* node) noexcept;
+    Node* own(Node* node, Update& update);
+    template <typename Key>
+    std::tuple<Node*, Node*, Node*> splitByValue(Node* node, const Key& key, Update& update);
+    Node* merge(Node* left, Node* right, Update& update);
+    template <typename Key>
+    const Node* find(const Key& key) const;
+    template <typename Value>
+    void insertValue(Value&& value);
+    template <typename Key>
+    void removeKey(const Key& key);
+    template <typename Operation>
+    void write(Operation&& operation);
+    void reclaim(std::uint64_t oldest) noexcept;
+
+   public:
+    // A consistent version of the set. It stays valid, and keeps its nodes
+    // alive, until it is destroyed. A Reader may hold several at once, and run
+    // one-off queries while it does.
+    class Snapshot {
+        friend class ConcurrentTreap;
+
+        const ConcurrentTreap* tree;
+        size_t slot;
+        const Node* root;
+
+        Snapshot(const ConcurrentTreap* tree, size_t slot) noexcept : tree(tree), slot(slot) {
+            tree->domain.enter(slot);
+            root = tree->root.load(std::memory_order_seq_cst);
+        }
+
+        template <typename Key>
+        size_t countBefore(const Key& key, bool inclusive, bool repeats) const;
+        template <typename Key>
+        bool containsKey(const Key& key) const;
+        template <typename Key>
+        T floorKey(const Key& key) const;
+        template <typename Key>
+        T ceilKey(const Key& key) const;
+        template <typename Visitor>
+        void visit(const Node* node, const T& lo, const T& hi, Visitor& visitor) const;
+
+       public:
+        Snapshot(const Snapshot&) = delete;
+        Snapshot(Snapshot&& other) noexcept
+            : tree(std::exchange(other.tree, nullptr)), slot(other.slot), root(other.root) {}
+        Snapshot& operator=(const Snapshot&) = delete;
+        Snapshot& operator=(Snapshot&&) = delete;
+        ~Snapshot() {
+            if (tree)
+                tree->domain.leave(slot);
+        }
+
+        size_t size() const noexcept { return root ? root->count : 0; }
+        bool empty() const noexcept { return root == nullptr; }
+        bool contains(const T& value) const { return containsKey(value); }
+        size_t rank(const T& value) const { return countBefore(value, true, false); }
+        T select(size_t rank) const;
+        T floor(const T& value) const { return floorKey(value); }
+        T ceil(const T& value) const { return ceilKey(value); }
+        template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+        bool contains(const Key& key) const { return containsKey(key); }
+        template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+        size_t rank(const Key& key) const { return countBefore(key, true, false); }
+        template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+        T floor(const Key& key) const { return floorKey(key); }
+        template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+        T ceil(const Key& key) const { return ceilKey(key); }
+        size_t count_range(const T& lo, const T& hi) const;
+        size_t size_range(const T& lo, const T& hi) const;
+        template <typename Visitor>
+        void visit_range(const T& lo, const T& hi, Visitor&& visitor) const;
+    };
+
+    // Reader slot of one thread. Every query on it runs on a snapshot of its own;
+    // take a Snapshot explicitly to run several queries on the same version.
+    class Reader {
+        const ConcurrentTreap* tree;
+        size_t slot;
+
+       public:
+        explicit Reader(const ConcurrentTreap& tree) : tree(&tree), slot(tree.domain.acquire()) {}
+        Reader(const Reader&) = delete;
+        Reader(Reader&& other) noexcept : tree(std::exchange(other.tree, nullptr)), slot(other.slot) {}
+        Reader& operator=(const Reader&) = delete;
+        Reader& operator=(Reader&&) = delete;
+        ~Reader() {
+            if (tree)
+                tree->domain.release(slot);
+        }
+
+        Snapshot snapshot() const noexcept { return Snapshot(tree, slot); }
+        bool contains(const T& value) const { return snapshot().contains(value); }
+        size_t rank(const T& value) const { return snapshot().rank(value); }
+        T select(size_t rank) const { return snapshot().select(rank); }
+        T floor(const T& value) const { return snapshot().floor(value); }
+        T ceil(const T& value) const { return snapshot().ceil(value); }
+        template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+        bool contains(const Key& key) const { return snapshot().contains(key); }
+        template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+        size_t rank(const Key& key) const { return snapshot().rank(key); }
+        template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+        T floor(const Key& key) const { return snapshot().floor(key); }
+        template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+        T ceil(const Key& key) const { return snapshot().ceil(key); }
+    };
+
+    ConcurrentTreap() = default;
+    explicit ConcurrentTreap(const Allocator& allocator) : allocator(allocator) {}
+    explicit ConcurrentTreap(const Priority& priorities, const Allocator& allocator = Allocator())
+        : priorities(priorities), allocator(allocator) {}
+    // Builds the treap from keys in sorted order in O(n), before any reader exists.
+    template <typename InputIt>
+    ConcurrentTreap(InputIt first, InputIt last, const Allocator& allocator = Allocator());
+    ConcurrentTreap(const ConcurrentTreap&) = delete;
+    ConcurrentTreap& operator=(const ConcurrentTreap&) = delete;
+    // No reader may be left when the treap goes away.
+    ~ConcurrentTreap();
+
+    // Number of distinct keys in the latest version.
+    size_t size() const noexcept { return count.load(std::memory_order_relaxed); }
+    bool empty() const noexcept { return size() == 0; }
+
+    void insert(const T& value) { insertValue(value); }
+    void insert(T&& value) { insertValue(std::move(value)); }
+    void remove(const T& value) { removeKey(value); }
+    // With a transparent comparator, removes by any key it orders against T.
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    void remove(const Key& key) { removeKey(key); }
+    template <typename... Args>
+    void emplace(Args&&... args) { insert(T(std::forward<Args>(args)...)); }
+
+    Reader reader() const { return Reader(*this); }
+    Allocator get_allocator() const noexcept { return Allocator(allocator); }
+};
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+template <typename... Args>
+typename ConcurrentTreap<T, Compare, Allocator, Priority>::Node* ConcurrentTreap<T, Compare, Allocator, Priority>::createNode(Update& update, Args&&... args) {
+    reserveOne(update.created);
+    Node* node = Traits::allocate(allocator, 1);
+    try {
+        Traits::construct(allocator, node, std::forward<Args>(args)..., version);
+    } catch (...) {
+        Traits::deallocate(allocator, node, 1);
+        throw;
+    }
+    update.created.push_back(node);
+    return node;
+}
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+void ConcurrentTreap<T, Compare, Allocator, Priority>::destroyNode(Node* node) noexcept {
+    Traits::destroy(allocator, node);
+    Traits::deallocate(allocator, node, 1);
+}
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+void ConcurrentTreap<T, Compare, Allocator, Priority>::destroySubtree(Node* node) noexcept {
+    while (node) {
+        destroySubtree(node->left);
+        Node* right = node->right;
+        destroyNode(node);
+        node = right;
+    }
+}
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+template <typename InputIt>
+ConcurrentTreap<T, Compare, Allocator, Priority>::ConcurrentTreap(InputIt first, InputIt last, const Allocator& allocator)
+    : allocator(allocator) {
+    // Cartesian tree construction, with the right spine kept on a stack.
+    std::vector<Node*> spine;
+    Update update;
+    try {
+        for (; first != last; ++first) {
+            if (!spine.empty() && !compare(spine.back()->value, *first)) {
+                assert(!compare(*first, spine.back()->value));
+                ++spine.back()->repeat;
+                continue;
+            }
+            Node* node = createNode(update, *first);
+            node->priority = priorities(node->value);
+            Node* child = nullptr;
+            while (!spine.empty() && node->priority < spine.back()->priority) {
+                spine.back()->update();
+                child = spine.back();
+                spine.pop_back();
+            }
+            node->left = child;
+            if (!spine.empty())
+                spine.back()->right = node;
+            spine.push_back(node);
+        }
+    } catch (...) {
+        for (Node* node : update.created)
+            destroyNode(node);
+        throw;
+    }
+    for (auto it = spine.rbegin(); it != spine.rend(); ++it)
+        (*it)->update();
+    root.store(spine.empty() ? nullptr : spine.front(), std::memory_order_release);
+    count.store(update.created.size(), std::memory_order_relaxed);
+}
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+ConcurrentTreap<T, Compare, Allocator, Priority>::~ConcurrentTreap() {
+    assert(domain.oldest() == EpochDomain::idle);
+    reclaim(EpochDomain::idle);
+    destroySubtree(root.load(std::memory_order_relaxed));
+}
+
+// The node itself if the current update created it, a private copy otherwise.
+template <typename T, typename Compare, typename Allocator, typename Priority>
+typename ConcurrentTreap<T, Compare, Allocator, Priority>::Node* ConcurrentTreap<T, Compare, Allocator, Priority>::own(Node* node, Update& update) {
+    if (node->version == version)
+        return node;
+    reserveOne(update.unlinked);
+    Node* copy = createNode(update, *node);
+    update.unlinked.push_back(node);
+    return copy;
+}
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+template <typename Key>
+std::tuple<typename ConcurrentTreap<T, Compare, Allocator, Priority>::Node*,
+           typename ConcurrentTreap<T, Compare, Allocator, Priority>::Node*,
+           typename ConcurrentTreap<T, Compare, Allocator, Priority>::Node*>
+ConcurrentTreap<T, Compare, Allocator, Priority>::splitByValue(Node* node, const Key& key, Update& update) {
+    if (node == nullptr)
+        return std::make_tuple(nullptr, nullptr, nullptr);
+    node = own(node, update);
+    if (compare(node->value, key)) {
+        auto [left, middle, right] = splitByValue(node->right, key, update);
+        node->right = left;
+        node->update();
+        return std::make_tuple(node, middle, right);
+    } else if (compare(key, node->value)) {
+        auto [left, middle, right] = splitByValue(node->left, key, update);
+        node->left = right;
+        node->update();
+        return std::make_tuple(left, middle, node);
+    }
+    Node* left = std::exchange(node->left, nullptr);
+    Node* right = std::exchange(node->right, nullptr);
+    node->update();
+    return std::make_tuple(left, node, right);
+}
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+typename ConcurrentTreap<T, Compare, Allocator, Priority>::Node* ConcurrentTreap<T, Compare, Allocator, Priority>::merge(Node* left, Node* right, Update& update) {
+    if (left == nullptr || right == nullptr)
+        return left ? left : right;
+    if (left->priority < right->priority) {
+        left = own(left, update);
+        left->right = merge(left->right, right, update);
+        left->update();
+        return left;
+    }
+    right = own(right, update);
+    right->left = merge(left, right->left, update);
+    right->update();
+    return right;
+}
+
+// Only called by the writer, which is the one freeing nodes.
+template <typename T, typename Compare, typename Allocator, typename Priority>
+template <typename Key>
+const typename ConcurrentTreap<T, Compare, Allocator, Priority>::Node* ConcurrentTreap<T, Compare, Allocator, Priority>::find(const Key& key) const {
+    const Node* current = root.load(std::memory_order_relaxed);
+    while (current && (compare(key, current->value) || compare(current->value, key)))
+        current = compare(current->value, key) ? current->right : current->left;
+    return current;
+}
+
+// Runs the operation on the current root under the writer lock and publishes
+// the root it returns. The nodes it replaced are retired with the epoch of the
+// update; if it throws, the published version was never touched and only the
+// nodes it created are freed.
+template <typename T, typename Compare, typename Allocator, typename Priority>
+template <typename Operation>
+void ConcurrentTreap<T, Compare, Allocator, Priority>::write(Operation&& operation) {
+    version = domain.current();
+    Update update;
+    Node* next;
+    try {
+        reserveOne(retired);
+        next = operation(root.load(std::memory_order_relaxed), update);
+    } catch (...) {
+        for (Node* node : update.created)
+            destroyNode(node);
+        throw;
+    }
+    root.store(next, std::memory_order_seq_cst);
+    std::uint64_t epoch = domain.advance();
+    assert(epoch == version);
+    retired.emplace_back(epoch, std::move(update.unlinked));
+    if (retired.size() >= reclaimBatches)
+        reclaim(domain.oldest());
+}
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+void ConcurrentTreap<T, Compare, Allocator, Priority>::reclaim(std::uint64_t oldest) noexcept {
+    size_t freed = 0;
+    for (; freed < retired.size() && retired[freed].first < oldest; ++freed)
+        for (Node* node : retired[freed].second)
+            destroyNode(node);
+    retired.erase(retired.begin(), retired.begin() + freed);
+}
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+template <typename Value>
+void ConcurrentTreap<T, Compare, Allocator, Priority>::insertValue(Value&& value) {
+    std::lock_guard<std::mutex> lock(writer);
+    bool found = find(value) != nullptr;
+    assert(found || size() < UINT32_MAX);
+    write([&](Node* current, Update& update) {
+        auto [left, middle, right] = splitByValue(current, value, update);
+        if (middle) {
+            ++middle->repeat;
+            middle->update();
+        } else {
+            middle = createNode(update, std::forward<Value>(value));
+            middle->priority = priorities(middle->value);
+        }
+        return merge(merge(left, middle, update), right, update);
+    });
+    if (!found)
+        count.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+template <typename Key>
+void ConcurrentTreap<T, Compare, Allocator, Priority>::removeKey(const Key& key) {
+    std::lock_guard<std::mutex> lock(writer);
+    const Node* node = find(key);
+    if (node == nullptr)
+        return;
+    bool last = node->repeat == 1;
+    write([&](Node* current, Update& update) {
+        auto [left, middle, right] = splitByValue(current, key, update);
+        if (last) {
+            reserveOne(update.unlinked);
+            update.unlinked.push_back(middle);
+            return merge(left, right, update);
+        }
+        --middle->repeat;
+        middle->update();
+        return merge(merge(left, middle, update), right, update);
+    });
+    if (last)
+        count.fetch_sub(1, std::memory_order_relaxed);
+}
+
+// Number of keys ordered before key, or not after it when inclusive, weighted
+// by their repeat count when repeats is set.
+template <typename T, typename Compare, typename Allocator, typename Priority>
+template <typename Key>
+size_t ConcurrentTreap<T, Compare, Allocator, Priority>::Snapshot::countBefore(const Key& key, bool inclusive, bool repeats) const {
+    size_t result = 0;
+    const Node* current = root;
+    while (current) {
+        if (inclusive ? !tree->compare(key, current->value) : tree->compare(current->value, key)) {
+            if (current->left)
+                result += repeats ? current->left->size : current->left->count;
+            result += repeats ? current->repeat : 1;
+            current = current->right;
+        } else
+            current = current->left;
+    }
+    return result;
+}
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+template <typename Key>
+bool ConcurrentTreap<T, Compare, Allocator, Priority>::Snapshot::containsKey(const Key& key) const {
+    const Node* current = root;
+    while (current) {
+        if (tree->compare(key, current->value))
+            current = current->left;
+        else if (tree->compare(current->value, key))
+            current = current->right;
+        else
+            return true;
+    }
+    return false;
+}
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+T ConcurrentTreap<T, Compare, Allocator, Priority>::Snapshot::select(size_t rank) const {
+    const Node* current = root;
+    while (current) {
+        size_t leftCount = current->left ? current->left->count : 0;
+        if (rank <= leftCount)
+            current = current->left;
+        else if (rank == leftCount + 1)
+            return current->value;
+        else {
+            rank -= leftCount + 1;
+            current = current->right;
+        }
+    }
+    return T();
+}
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+template <typename Key>
+T ConcurrentTreap<T, Compare, Allocator, Priority>::Snapshot::floorKey(const Key& key) const {
+    const Node* current = root;
+    const Node* result = nullptr;
+    while (current) {
+        if (tree->compare(key, current->value))
+            current = current->left;
+        else {
+            result = current;
+            current = current->right;
+        }
+    }
+    return result ? result->value : T();
+}
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+template <typename Key>
+T ConcurrentTreap<T, Compare, Allocator, Priority>::Snapshot::ceilKey(const Key& key) const {
+    const Node* current = root;
+    const Node* result = nullptr;
+    while (current) {
+        if (tree->compare(current->value, key))
+            current = current->right;
+        else {
+            result = current;
+            current = current->left;
+        }
+    }
+    return result ? result->value : T();
+}
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+size_t ConcurrentTreap<T, Compare, Allocator, Priority>::Snapshot::count_range(const T& lo, const T& hi) const {
+    if (tree->compare(hi, lo))
+        return 0;
+    return countBefore(hi, true, false) - countBefore(lo, false, false);
+}
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+size_t ConcurrentTreap<T, Compare, Allocator, Priority>::Snapshot::size_range(const T& lo, const T& hi) const {
+    if (tree->compare(hi, lo))
+        return 0;
+    return countBefore(hi, true, true) - countBefore(lo, false, true);
+}
+
+// Nodes have no parent links, so the scan recurses, skipping the subtrees that
+// lie entirely outside [lo, hi].
+template <typename T, typename Compare, typename Allocator, typename Priority>
+template <typename Visitor>
+void ConcurrentTreap<T, Compare, Allocator, Priority>::Snapshot::visit(const Node* node, const T& lo, const T& hi, Visitor& visitor) const {
+    while (node) {
+        bool aboveLo = !tree->compare(node->value, lo);
+        bool belowHi = !tree->compare(hi, node->value);
+        if (aboveLo)
+            visit(node->left, lo, hi, visitor);
+        if (aboveLo && belowHi)
+            visitor(node->value, node->repeat);
+        if (!belowHi)
+            return;
+        node = node->right;
+    }
+}
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+template <typename Visitor>
+void ConcurrentTreap<T, Compare, Allocator, Priority>::Snapshot::visit_range(const T& lo, const T& hi, Visitor&& visitor) const {
+    if (!tree->compare(hi, lo))
+        visit(root, lo, hi, visitor);
+}
+
+#endif  // CONCURRENT_TREAP_HPP
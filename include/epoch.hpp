@@ -0,0 +1,84 @@
+#ifndef EPOCH_HPP
+#define EPOCH_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+// Epoch-based reclamation for structures with one writer at a time and any
+// number of readers. A reader owns a slot and, for the duration of a read,
+// announces the global epoch it started in; that is one load and two stores, so
+// reads are wait-free and never write to shared nodes. The writer tags whatever
+// it unlinked with the epoch current at that point and moves the epoch on.
+// Everything tagged before the oldest announced epoch can no longer be reached
+// by any reader and may be freed. Reads on one slot may nest: the slot keeps
+// the epoch of the outermost one until the last of them has left.
+class EpochDomain {
+   public:
+    static constexpr size_t maxReaders = 128;
+    static constexpr std::uint64_t idle = std::numeric_limits<std::uint64_t>::max();
+
+    EpochDomain() = default;
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+    size_t acquire();
+    void release(size_t slot) noexcept {
+        assert(slots[slot].depth == 0);
+        slots[slot].used.store(false, std::memory_order_release);
+    }
+
+    // The announcement is sequentially consistent with the writer's swap of the
+    // root and its scan of the slots: a reader the scan missed is ordered after
+    // it, and therefore only sees what was published before. A nested read
+    // keeps the older announcement, which covers everything it can reach.
+    void enter(size_t slot) noexcept {
+        if (slots[slot].depth++ == 0)
+            slots[slot].epoch.store(epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+    }
+    void leave(size_t slot) noexcept {
+        assert(slots[slot].depth > 0);
+        if (--slots[slot].depth == 0)
+            slots[slot].epoch.store(idle, std::memory_order_release);
+    }
+
+    std::uint64_t current() const noexcept { return epoch.load(std::memory_order_seq_cst); }
+    // Called by the writer once it published a new version. Returns the epoch
+    // to tag the unlinked nodes with.
+    std::uint64_t advance() noexcept { return epoch.fetch_add(1, std::memory_order_seq_cst); }
+    // Oldest epoch a reader may still be in, or idle when there is no reader.
+    std::uint64_t oldest() const noexcept;
+
+   private:
+    struct alignas(64) Slot {
+        std::atomic<std::uint64_t> epoch{idle};
+        std::atomic<bool> used{false};
+        // Reads in progress on the slot, only ever touched by its owner.
+        size_t depth = 0;
+    };
+
+    std::atomic<std::uint64_t> epoch{1};
+    Slot slots[maxReaders];
+};
+
+inline size_t EpochDomain::acquire() {
+    for (size_t slot = 0; slot < maxReaders; ++slot) {
+        bool expected = false;
+        if (!slots[slot].used.load(std::memory_order_relaxed) &&
+            slots[slot].used.compare_exchange_strong(expected, true, std::memory_order_acquire))
+            return slot;
+    }
+    throw std::length_error("EpochDomain: too many readers");
+}
+
+inline std::uint64_t EpochDomain::oldest() const noexcept {
+    std::uint64_t result = idle;
+    for (const Slot& slot : slots)
+        result = std::min(result, slot.epoch.load(std::memory_order_seq_cst));
+    return result;
+}
+
+#endif  // EPOCH_HPP
@@ -0,0 +1,159 @@
+#ifndef EYTZINGER_INDEX_HPP
+#define EYTZINGER_INDEX_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <new>
+#include <vector>
+
+// std::allocator only honours the alignment of the type, which for the index
+// would leave its cache lines straddling two hardware lines.
+template <typename T, size_t Alignment = 64>
+struct CacheAlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = CacheAlignedAllocator<U, Alignment>;
+    };
+
+    CacheAlignedAllocator() = default;
+    template <typename U>
+    CacheAlignedAllocator(const CacheAlignedAllocator<U, Alignment>&) noexcept {}
+
+    T* allocate(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment))); }
+    void deallocate(T* pointer, size_t) noexcept { ::operator delete(pointer, std::align_val_t(Alignment)); }
+
+    template <typename U>
+    bool operator==(const CacheAlignedAllocator<U, Alignment>&) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const CacheAlignedAllocator<U, Alignment>&) const noexcept { return false; }
+};
+
+// Static index over a sorted set of distinct keys, stored in Eytzinger (BFS)
+// order: the root sits at 1 and the children of k at 2k and 2k + 1. A descent
+// compares once per level and turns that comparison into the next index, so it
+// never branches on the keys. The descendants of k a few levels down share one
+// cache line (sixteen of them, four levels down, for int keys), which is
+// prefetched while the current level resolves. The path taken is encoded in the
+// bits of the final index, which gives the answer back with a single shift.
+// ranks[k] is the in-order position of key k, counted from 1 like
+// BinarySearchTree::rank.
+template <typename T, typename Compare = std::less<T>>
+class EytzingerIndex {
+    using Index = std::uint32_t;
+
+    static constexpr size_t prefetchStride = sizeof(T) < 64 ? 64 / sizeof(T) : 1;
+
+    std::vector<T, CacheAlignedAllocator<T>> keys;
+    std::vector<Index> ranks;
+    Compare compare;
+
+    void place(std::vector<T>& sorted, size_t k, size_t& position);
+    template <typename Key>
+    size_t lowerBoundIndex(const Key& value) const noexcept;
+    template <typename Key>
+    size_t floorIndex(const Key& value) const noexcept;
+    template <typename Key>
+    bool containsKey(const Key& value) const noexcept;
+
+    void prefetch(size_t k) const noexcept {
+#if defined(__GNUC__)
+        __builtin_prefetch(keys.data() + std::min(k * prefetchStride, keys.size() - 1));
+#endif
+    }
+
+   public:
+    EytzingerIndex() : keys(1), ranks(1) {}
+    // Builds the index from keys in sorted order, equal keys are kept once.
+    template <typename InputIt>
+    EytzingerIndex(InputIt first, InputIt last, const Compare& compare = Compare());
+
+    size_t size() const noexcept { return keys.size() - 1; }
+    bool empty() const noexcept { return keys.size() == 1; }
+
+    bool contains(const T& value) const noexcept { return containsKey(value); }
+    size_t rank(const T& value) const noexcept { return ranks[floorIndex(value)]; }
+    T floor(const T& value) const { return keys[floorIndex(value)]; }
+    T ceil(const T& value) const { return keys[lowerBoundIndex(value)]; }
+
+    // Lookups with any key a transparent comparator orders against T.
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    bool contains(const Key& key) const noexcept { return containsKey(key); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    size_t rank(const Key& key) const noexcept { return ranks[floorIndex(key)]; }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    T floor(const Key& key) const { return keys[floorIndex(key)]; }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    T ceil(const Key& key) const { return keys[lowerBoundIndex(key)]; }
+};
+
+template <typename T, typename Compare>
+template <typename InputIt>
+EytzingerIndex<T, Compare>::EytzingerIndex(InputIt first, InputIt last, const Compare& compare) : compare(compare) {
+    std::vector<T> sorted;
+    for (; first != last; ++first) {
+        if (!sorted.empty() && !compare(sorted.back(), *first)) {
+            assert(!compare(*first, sorted.back()));
+            continue;
+        }
+        sorted.push_back(*first);
+    }
+    assert(sorted.size() < std::numeric_limits<Index>::max());
+    // Slot 0 is the answer of a search that falls off the tree: T() and rank 0.
+    keys.resize(sorted.size() + 1);
+    ranks.resize(sorted.size() + 1);
+    size_t position = 0;
+    place(sorted, 1, position);
+}
+
+// Fills the subtree rooted at k with the next keys of the in-order sequence.
+template <typename T, typename Compare>
+void EytzingerIndex<T, Compare>::place(std::vector<T>& sorted, size_t k, size_t& position) {
+    if (k >= keys.size())
+        return;
+    place(sorted, 2 * k, position);
+    keys[k] = std::move(sorted[position]);
+    ranks[k] = ++position;
+    place(sorted, 2 * k + 1, position);
+}
+
+// Index of the first key not ordered before value, 0 if there is none. The
+// descent goes right past every smaller key; the answer is the node of the
+// last left turn, found by dropping the trailing right turns and that one.
+template <typename T, typename Compare>
+template <typename Key>
+size_t EytzingerIndex<T, Compare>::lowerBoundIndex(const Key& value) const noexcept {
+    size_t k = 1, n = size();
+    while (k <= n) {
+        prefetch(k);
+        k = 2 * k + compare(keys[k], value);
+    }
+    return k >> __builtin_ffsll(~k);
+}
+
+// Index of the last key not ordered after value, 0 if there is none: the node
+// of the last right turn.
+template <typename T, typename Compare>
+template <typename Key>
+size_t EytzingerIndex<T, Compare>::floorIndex(const Key& value) const noexcept {
+    size_t k = 1, n = size();
+    while (k <= n) {
+        prefetch(k);
+        k = 2 * k + !compare(value, keys[k]);
+    }
+    return k >> (__builtin_ctzll(k) + 1);
+}
+
+template <typename T, typename Compare>
+template <typename Key>
+bool EytzingerIndex<T, Compare>::containsKey(const Key& value) const noexcept {
+    size_t k = floorIndex(value);
+    return k != 0 && !compare(keys[k], value);
+}
+
+#endif  // EYTZINGER_INDEX_HPP
@@ -0,0 +1,43 @@
+#ifndef FORK_JOIN_HPP
+#define FORK_JOIN_HPP
+
+#include <cstddef>
+#include <future>
+#include <system_error>
+#include <thread>
+
+// Number of nested levels at which divide-and-conquer algorithms may still fork,
+// enough for every hardware thread to get a couple of tasks.
+inline size_t forkDepth() noexcept {
+    static const size_t depth = [] {
+        size_t depth = 1;
+        for (size_t threads = std::thread::hardware_concurrency(); threads > 1; threads >>= 1)
+            ++depth;
+        return depth;
+    }();
+    return depth;
+}
+
+// Runs two independent tasks and returns once both are done. With `fork` set the
+// first one gets a thread of its own while the calling thread runs the second;
+// if no thread can be started, both simply run in turn.
+template <typename First, typename Second>
+void forkJoin(bool fork, First&& first, Second&& second) {
+    if (fork) {
+        std::future<void> future;
+        try {
+            future = std::async(std::launch::async, [&first] { first(); });
+        } catch (const std::system_error&) {
+            fork = false;
+        }
+        if (fork) {
+            second();
+            future.get();
+            return;
+        }
+    }
+    first();
+    second();
+}
+
+#endif  // FORK_JOIN_HPP
@@ -0,0 +1,351 @@
+#ifndef FROZEN_TREE_HPP
+#define FROZEN_TREE_HPP
+
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+template <typename Iterator, typename = void>
+struct HasRepeat : std::false_type {};
+
+template <typename Iterator>
+struct HasRepeat<Iterator, std::void_t<decltype(std::declval<const Iterator&>().repeat())>> : std::true_type {};
+
+// Immutable snapshot of a sorted multiset, laid out as a balanced search tree in
+// van Emde Boas order: the top half of the levels comes first, followed by each
+// of the subtrees hanging below it, recursively. Any root-to-leaf path then
+// touches O(log_B n) blocks for every block size B, without tuning for a given
+// cache. The shape is implicit, with the root of the keys [lo, hi) in order at
+// lo + (hi - lo - 1) / 2, so descents know the in-order position of every node
+// and only the child links are stored. Queries follow the semantics of
+// BinarySearchTree: ranks count distinct keys and start at 1, select, floor and
+// ceil return T() when there is no answer.
+template <typename T, typename Compare = std::less<T>>
+class FrozenTree {
+    using Index = std::uint32_t;
+
+    struct Slot {
+        T value;
+        Index children[2];
+    };
+
+    std::vector<Slot> slots;
+    std::vector<Index> order;
+    std::vector<size_t> prefix = {0};
+    Compare compare;
+
+    template <typename Visitor>
+    static void visitAtDepth(size_t lo, size_t hi, size_t depth, Visitor&& visitor);
+    void layout(std::vector<T>& values, size_t lo, size_t hi, size_t levels);
+    void link(size_t lo, size_t hi);
+    template <typename Key>
+    size_t lowerBoundIndex(const Key& value) const;
+    template <typename Key>
+    size_t upperBoundIndex(const Key& value) const;
+    template <typename Key>
+    bool containsKey(const Key& value) const;
+    template <typename Key>
+    T floorKey(const Key& value) const;
+    template <typename Key>
+    T ceilKey(const Key& value) const;
+    const T& key(size_t index) const noexcept { return slots[order[index]].value; }
+
+   public:
+    class iterator {
+        friend class FrozenTree;
+
+        const FrozenTree* tree = nullptr;
+        size_t index = 0;
+
+        iterator(const FrozenTree* tree, size_t index) noexcept : tree(tree), index(index) {}
+
+       public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        iterator() = default;
+
+        reference operator*() const noexcept { return tree->key(index); }
+        pointer operator->() const noexcept { return &tree->key(index); }
+        size_t repeat() const noexcept { return tree->prefix[index + 1] - tree->prefix[index]; }
+
+        iterator& operator++() noexcept {
+            ++index;
+            return *this;
+        }
+        iterator operator++(int) noexcept {
+            iterator result = *this;
+            ++index;
+            return result;
+        }
+        iterator& operator--() noexcept {
+            --index;
+            return *this;
+        }
+        iterator operator--(int) noexcept {
+            iterator result = *this;
+            --index;
+            return result;
+        }
+
+        bool operator==(const iterator& other) const noexcept { return index == other.index; }
+        bool operator!=(const iterator& other) const noexcept { return index != other.index; }
+    };
+    using const_iterator = iterator;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = reverse_iterator;
+
+    FrozenTree() = default;
+    // Builds the snapshot from keys in sorted order. Equal keys are folded into
+    // one, each occurrence weighted by the repeat() of the iterator if it has one.
+    template <typename InputIt>
+    FrozenTree(InputIt first, InputIt last, const Compare& compare = Compare());
+
+    size_t size() const noexcept { return order.size(); }
+    bool empty() const noexcept { return order.empty(); }
+
+    bool contains(const T& value) const { return containsKey(value); }
+    size_t rank(const T& value) const { return upperBoundIndex(value); }
+    T select(size_t rank) const { return rank >= 1 && rank <= size() ? key(rank - 1) : T(); }
+    T min() const { return key(0); }
+    T max() const { return key(size() - 1); }
+    T floor(const T& value) const { return floorKey(value); }
+    T ceil(const T& value) const { return ceilKey(value); }
+    std::vector<T> nsmallest(size_t n) const;
+    std::vector<T> nlargest(size_t n) const;
+
+    // Lookups with any key a transparent comparator orders against T.
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    bool contains(const Key& value) const { return containsKey(value); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    size_t rank(const Key& value) const { return upperBoundIndex(value); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    T floor(const Key& value) const { return floorKey(value); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    T ceil(const Key& value) const { return ceilKey(value); }
+
+    iterator begin() const noexcept { return iterator(this, 0); }
+    iterator end() const noexcept { return iterator(this, size()); }
+    reverse_iterator rbegin() const noexcept { return reverse_iterator(end()); }
+    reverse_iterator rend() const noexcept { return reverse_iterator(begin()); }
+
+    iterator find(const T& value) const;
+    iterator lower_bound(const T& value) const { return iterator(this, lowerBoundIndex(value)); }
+    iterator upper_bound(const T& value) const { return iterator(this, upperBoundIndex(value)); }
+    std::pair<iterator, iterator> equal_range(const T& value) const { return {lower_bound(value), upper_bound(value)}; }
+
+    size_t count_range(const T& lo, const T& hi) const;
+    size_t size_range(const T& lo, const T& hi) const;
+    T select_in_range(const T& lo, const T& hi, size_t rank) const;
+    template <typename Visitor>
+    void visit_range(const T& lo, const T& hi, Visitor&& visitor) const;
+};
+
+template <typename T, typename Compare>
+template <typename InputIt>
+FrozenTree<T, Compare>::FrozenTree(InputIt first, InputIt last, const Compare& compare) : compare(compare) {
+    std::vector<T> values;
+    for (; first != last; ++first) {
+        size_t repeat = 1;
+        if constexpr (HasRepeat<InputIt>::value)
+            repeat = first.repeat();
+        if (!values.empty() && !compare(values.back(), *first)) {
+            assert(!compare(*first, values.back()));
+            prefix.back() += repeat;
+            continue;
+        }
+        values.push_back(*first);
+        prefix.push_back(prefix.back() + repeat);
+    }
+    assert(values.size() < std::numeric_limits<Index>::max());
+    size_t levels = 0;
+    for (size_t n = values.size(); n; n /= 2)
+        ++levels;
+    order.resize(values.size());
+    slots.reserve(values.size());
+    layout(values, 0, values.size(), levels);
+    link(0, values.size());
+}
+
+// Calls visitor(lo, hi) for the key ranges of the subtrees at the given depth
+// below the balanced tree over [lo, hi), from left to right.
+template <typename T, typename Compare>
+template <typename Visitor>
+void FrozenTree<T, Compare>::visitAtDepth(size_t lo, size_t hi, size_t depth, Visitor&& visitor) {
+    if (lo >= hi)
+        return;
+    if (depth == 0) {
+        visitor(lo, hi);
+        return;
+    }
+    size_t middle = lo + (hi - lo - 1) / 2;
+    visitAtDepth(lo, middle, depth - 1, visitor);
+    visitAtDepth(middle + 1, hi, depth - 1, visitor);
+}
+
+// Appends the top levels of the balanced tree over [lo, hi) in van Emde Boas
+// order: the upper half of those levels, then every subtree below it in turn.
+template <typename T, typename Compare>
+void FrozenTree<T, Compare>::layout(std::vector<T>& values, size_t lo, size_t hi, size_t levels) {
+    if (lo >= hi || levels == 0)
+        return;
+    if (levels == 1) {
+        size_t middle = lo + (hi - lo - 1) / 2;
+        order[middle] = slots.size();
+        slots.push_back(Slot{std::move(values[middle]), {0, 0}});
+        return;
+    }
+    size_t top = levels / 2;
+    layout(values, lo, hi, top);
+    visitAtDepth(lo, hi, top, [&](size_t first, size_t last) { layout(values, first, last, levels - top); });
+}
+
+template <typename T, typename Compare>
+void FrozenTree<T, Compare>::link(size_t lo, size_t hi) {
+    if (lo >= hi)
+        return;
+    size_t middle = lo + (hi - lo - 1) / 2;
+    Slot& slot = slots[order[middle]];
+    if (lo < middle)
+        slot.children[0] = order[lo + (middle - lo - 1) / 2];
+    if (middle + 1 < hi)
+        slot.children[1] = order[middle + 1 + (hi - middle - 2) / 2];
+    link(lo, middle);
+    link(middle + 1, hi);
+}
+
+// In-order position of the first key not ordered before value.
+template <typename T, typename Compare>
+template <typename Key>
+size_t FrozenTree<T, Compare>::lowerBoundIndex(const Key& value) const {
+    size_t lo = 0, hi = size();
+    Index current = 0;
+    while (lo < hi) {
+        size_t middle = lo + (hi - lo - 1) / 2;
+        const Slot& slot = slots[current];
+        bool right = compare(slot.value, value);
+        current = slot.children[right];
+        if (right)
+            lo = middle + 1;
+        else
+            hi = middle;
+    }
+    return lo;
+}
+
+// In-order position of the first key ordered after value.
+template <typename T, typename Compare>
+template <typename Key>
+size_t FrozenTree<T, Compare>::upperBoundIndex(const Key& value) const {
+    size_t lo = 0, hi = size();
+    Index current = 0;
+    while (lo < hi) {
+        size_t middle = lo + (hi - lo - 1) / 2;
+        const Slot& slot = slots[current];
+        bool right = !compare(value, slot.value);
+        current = slot.children[right];
+        if (right)
+            lo = middle + 1;
+        else
+            hi = middle;
+    }
+    return lo;
+}
+
+template <typename T, typename Compare>
+template <typename Key>
+bool FrozenTree<T, Compare>::containsKey(const Key& value) const {
+    size_t lo = 0, hi = size();
+    Index current = 0;
+    while (lo < hi) {
+        size_t middle = lo + (hi - lo - 1) / 2;
+        const Slot& slot = slots[current];
+        if (compare(value, slot.value)) {
+            hi = middle;
+            current = slot.children[0];
+        } else if (compare(slot.value, value)) {
+            lo = middle + 1;
+            current = slot.children[1];
+        } else
+            return true;
+    }
+    return false;
+}
+
+template <typename T, typename Compare>
+template <typename Key>
+T FrozenTree<T, Compare>::floorKey(const Key& value) const {
+    size_t index = upperBoundIndex(value);
+    return index ? key(index - 1) : T();
+}
+
+template <typename T, typename Compare>
+template <typename Key>
+T FrozenTree<T, Compare>::ceilKey(const Key& value) const {
+    size_t index = lowerBoundIndex(value);
+    return index < size() ? key(index) : T();
+}
+
+template <typename T, typename Compare>
+std::vector<T> FrozenTree<T, Compare>::nsmallest(size_t n) const {
+    std::vector<T> result;
+    for (auto it = begin(); it != end() && result.size() < n; ++it)
+        result.push_back(*it);
+    return result;
+}
+
+template <typename T, typename Compare>
+std::vector<T> FrozenTree<T, Compare>::nlargest(size_t n) const {
+    std::vector<T> result;
+    for (auto it = rbegin(); it != rend() && result.size() < n; ++it)
+        result.push_back(*it);
+    return result;
+}
+
+template <typename T, typename Compare>
+typename FrozenTree<T, Compare>::iterator FrozenTree<T, Compare>::find(const T& value) const {
+    size_t index = lowerBoundIndex(value);
+    if (index < size() && !compare(value, key(index)))
+        return iterator(this, index);
+    return end();
+}
+
+template <typename T, typename Compare>
+size_t FrozenTree<T, Compare>::count_range(const T& lo, const T& hi) const {
+    if (compare(hi, lo))
+        return 0;
+    return upperBoundIndex(hi) - lowerBoundIndex(lo);
+}
+
+template <typename T, typename Compare>
+size_t FrozenTree<T, Compare>::size_range(const T& lo, const T& hi) const {
+    if (compare(hi, lo))
+        return 0;
+    return prefix[upperBoundIndex(hi)] - prefix[lowerBoundIndex(lo)];
+}
+
+template <typename T, typename Compare>
+T FrozenTree<T, Compare>::select_in_range(const T& lo, const T& hi, size_t rank) const {
+    if (rank == 0 || rank > count_range(lo, hi))
+        return T();
+    return key(lowerBoundIndex(lo) + rank - 1);
+}
+
+template <typename T, typename Compare>
+template <typename Visitor>
+void FrozenTree<T, Compare>::visit_range(const T& lo, const T& hi, Visitor&& visitor) const {
+    if (compare(hi, lo))
+        return;
+    for (auto it = lower_bound(lo), last = upper_bound(hi); it != last; ++it)
+        visitor(*it, it.repeat());
+}
+
+#endif  // FROZEN_TREE_HPP
@@ -3,7 +3,9 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <memory>
+#include <type_traits>
 
 enum Direction {
     LEFT = 0,
@@ -11,51 +13,88 @@ enum Direction {
     ROOT = 2
 };
 
+enum Color : std::uint8_t {
+    RED = 0,
+    BLACK = 1
+};
+
+// Nodes link to each other through std::shared_ptr unless they declare their own
+// `pointer` type, in which case the tree owns them and frees them explicitly.
+template <typename Node, typename = void>
+struct NodeTraits {
+    using pointer = std::shared_ptr<Node>;
+};
+
 template <typename Node>
-bool isRoot(const std::shared_ptr<Node>& node) noexcept {
+struct NodeTraits<Node, std::void_t<typename Node::pointer>> {
+    using pointer = typename Node::pointer;
+};
+
+template <typename Node>
+using NodePtr = typename NodeTraits<Node>::pointer;
+
+template <typename Node, typename = void>
+struct HasChildArray : std::false_type {};
+
+template <typename Node>
+struct HasChildArray<Node, std::void_t<decltype(std::declval<Node&>().children)>> : std::true_type {};
+
+// The link to the child of node on side direction. Nodes keeping their links in
+// a children[] array are indexed; compact nodes, whose links are the plain
+// members left and right, pick one of the two.
+template <typename Pointer>
+decltype(auto) childOf(const Pointer& node, size_t direction) noexcept {
+    if constexpr (HasChildArray<std::remove_reference_t<decltype(*node)>>::value)
+        return (node->children[direction]);
+    else
+        return (direction ? node->right : node->left);
+}
+
+template <typename Pointer>
+bool isRoot(const Pointer& node) noexcept {
     return node->parent.expired();
 }
 
-template <typename Node>
-bool isLeftChild(const std::shared_ptr<Node>& node) noexcept {
+template <typename Pointer>
+bool isLeftChild(const Pointer& node) noexcept {
     return !isRoot(node) && (node->parent.lock()->left == node);
 }
 
-template <typename Node>
-bool isRightChild(const std::shared_ptr<Node>& node) noexcept {
+template <typename Pointer>
+bool isRightChild(const Pointer& node) noexcept {
     return !isRoot(node) && (node->parent.lock()->right == node);
 }
 
-template <typename Node>
-bool isLeaf(const std::shared_ptr<Node>& node) noexcept {
+template <typename Pointer>
+bool isLeaf(const Pointer& node) noexcept {
     return (node->left == nullptr) && (node->right == nullptr);
 }
 
-template <typename Node>
-bool hasGrandparent(const std::shared_ptr<Node>& node) noexcept {
+template <typename Pointer>
+bool hasGrandparent(const Pointer& node) noexcept {
     return !isRoot(node) && (node->parent.lock()->parent.lock() != nullptr);
 }
 
-template <typename Node>
-bool hasSibling(const std::shared_ptr<Node>& node) noexcept {
+template <typename Pointer>
+bool hasSibling(const Pointer& node) noexcept {
     if (isRoot(node))
         return false;
-    return node->parent.lock()->children[getDirection(node) ^ 1] != nullptr;
+    return childOf(node->parent.lock(), getDirection(node) ^ 1) != nullptr;
 }
 
-template <typename Node>
-bool hasUncle(const std::shared_ptr<Node>& node) noexcept {
+template <typename Pointer>
+bool hasUncle(const Pointer& node) noexcept {
     return hasGrandparent(node) && hasSibling(node->parent.lock());
 }
 
-template <typename Node>
-std::shared_ptr<Node> getGrandparent(const std::shared_ptr<Node>& node) noexcept {
+template <typename Pointer>
+Pointer getGrandparent(const Pointer& node) noexcept {
     assert(hasGrandparent(node));
     return node->parent.lock()->parent.lock();
 }
 
-template <typename Node>
-std::shared_ptr<Node> getSibling(const std::shared_ptr<Node>& node) noexcept {
+template <typename Pointer>
+Pointer getSibling(const Pointer& node) noexcept {
     if (isRoot(node))
         return nullptr;
     if (isLeftChild(node))
@@ -63,17 +102,17 @@ std::shared_ptr<Node> getSibling(const std::shared_ptr<Node>& node) noexcept {
     return node->parent.lock()->left;
 }
 
-template <typename Node>
-std::shared_ptr<Node> getUncle(const std::shared_ptr<Node>& node) noexcept {
+template <typename Pointer>
+Pointer getUncle(const Pointer& node) noexcept {
     if (!hasGrandparent(node))
         return nullptr;
     return getSibling(node->parent.lock());
 }
 
-template <typename Node>
-size_t getDepth(const std::shared_ptr<Node>& node) noexcept {
+template <typename Pointer>
+size_t getDepth(const Pointer& node) noexcept {
     size_t depth = 0;
-    std::shared_ptr<Node> current = node;
+    Pointer current = node;
     while (!isRoot(current)) {
         current = current->parent.lock();
         ++depth;
@@ -81,65 +120,55 @@ size_t getDepth(const std::shared_ptr<Node>& node) noexcept {
     return depth;
 }
 
-template <typename Node>
-size_t getHeight(const std::shared_ptr<Node>& node) noexcept {
+template <typename Pointer>
+size_t getHeight(const Pointer& node) noexcept {
     if (node == nullptr)
         return 0;
     return 1 + std::max(getHeight(node->left), getHeight(node->right));
 }
 
-template <typename Node>
-Direction getDirection(const std::shared_ptr<Node>& node) noexcept {
+template <typename Pointer>
+Direction getDirection(const Pointer& node) noexcept {
     if (isRoot(node))
         return Direction::ROOT;
     return isLeftChild(node) ? Direction::LEFT : Direction::RIGHT;
 }
 
-template <typename Node>
-std::shared_ptr<Node> getPredecessor(const std::shared_ptr<Node>& node) noexcept {
+template <typename Pointer>
+Pointer getPredecessor(const Pointer& node) noexcept {
     if (node->left != nullptr) {
-        std::shared_ptr<Node> current = node->left;
+        Pointer current = node->left;
         while (current->right)
             current = current->right;
         return current;
     }
-    if (node->parent.expired())
-        return nullptr;
-    std::shared_ptr<Node> current = node->parent.lock();
-    while (isLeftChild<Node>(current)) {
-        if (current->parent.expired())
-            return nullptr;
+    Pointer current = node;
+    while (isLeftChild(current))
         current = current->parent.lock();
-    }
-    return isRightChild(current) ? current->parent.lock() : nullptr;
+    return current->parent.lock();
 }
 
-template <typename Node>
-std::shared_ptr<Node> getSuccessor(const std::shared_ptr<Node>& node) noexcept {
+template <typename Pointer>
+Pointer getSuccessor(const Pointer& node) noexcept {
     if (node->right != nullptr) {
-        std::shared_ptr<Node> current = node->right;
+        Pointer current = node->right;
         while (current->left)
             current = current->left;
         return current;
     }
-    if (node->parent.expired())
-        return nullptr;
-    std::shared_ptr<Node> current = node->parent.lock();
-    while (isRightChild<Node>(current)) {
-        if (current->parent.expired())
-            return nullptr;
+    Pointer current = node;
+    while (isRightChild(current))
         current = current->parent.lock();
-    }
-    return isLeftChild(current) ? current->parent.lock() : nullptr;
+    return current->parent.lock();
 }
 
-template <typename Node>
-void preorderTraversal(const std::shared_ptr<Node>& root, std::function<void(const std::shared_ptr<Node>&)> callback) {
+template <typename Pointer>
+void preorderTraversal(const Pointer& root, std::function<void(const Pointer&)> callback) {
     if (root == nullptr)
         return;
 
-    std::shared_ptr<Node> current = root;
-    std::stack<std::shared_ptr<Node>> stack;
+    Pointer current = root;
+    std::stack<Pointer> stack;
     stack.push(current);
 
     while (!stack.empty()) {
@@ -153,13 +182,13 @@ void preorderTraversal(const std::shared_ptr<Node>& root, std::function<void(con
     }
 }
 
-template <typename Node>
-void inorderTraversal(const std::shared_ptr<Node>& root, std::function<void(const std::shared_ptr<Node>&)> callback) {
+template <typename Pointer>
+void inorderTraversal(const Pointer& root, std::function<void(const Pointer&)> callback) {
     if (root == nullptr)
         return;
 
-    std::shared_ptr<Node> current = root;
-    std::stack<std::shared_ptr<Node>> stack;
+    Pointer current = root;
+    std::stack<Pointer> stack;
 
     while (current || !stack.empty()) {
         for (; current; current = current->left)
@@ -171,14 +200,14 @@ void inorderTraversal(const std::shared_ptr<Node>& root, std::function<void(cons
     }
 }
 
-template <typename Node>
-void postorderTraversal(const std::shared_ptr<Node>& root, std::function<void(const std::shared_ptr<Node>&)> callback) {
+template <typename Pointer>
+void postorderTraversal(const Pointer& root, std::function<void(const Pointer&)> callback) {
     if (root == nullptr)
         return;
 
-    std::shared_ptr<Node> current = root;
-    std::stack<std::shared_ptr<Node>> stack;
-    std::shared_ptr<Node> lastVisited = nullptr;
+    Pointer current = root;
+    std::stack<Pointer> stack;
+    Pointer lastVisited = nullptr;
 
     while (current || !stack.empty()) {
         for (; current; current = current->left)
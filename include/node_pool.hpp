@@ -0,0 +1,216 @@
+#ifndef NODE_POOL_HPP
+#define NODE_POOL_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Slab resource for tree nodes. Blocks are carved out of geometrically growing
+// chunks, freed blocks are recycled through per-size free lists, and release()
+// hands every chunk back to the upstream resource at once. Blocks too large or
+// too strictly aligned for a chunk come from upstream one by one, but are
+// linked into a list of their own so that release() frees them as well.
+class NodePool : public std::pmr::memory_resource {
+   public:
+    explicit NodePool(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource()) noexcept
+        : upstream(upstream) {}
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+    ~NodePool() override { release(); }
+
+    void release() noexcept;
+    size_t chunkCount() const noexcept { return chunks; }
+    size_t blockCount() const noexcept { return blocks; }
+
+   protected:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* pointer, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+   private:
+    static constexpr size_t granularity = alignof(std::max_align_t);
+    static constexpr size_t maxBlockSize = 256;
+    static constexpr size_t minChunkSize = 4096;
+    static constexpr size_t maxChunkSize = 1 << 20;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+    struct Chunk {
+        Chunk* next;
+        size_t size;
+    };
+    static constexpr size_t headerSize = (sizeof(Chunk) + granularity - 1) / granularity * granularity;
+    // Header in front of a block taken from upstream directly.
+    struct LargeBlock {
+        LargeBlock* prev;
+        LargeBlock* next;
+        size_t size, alignment;
+    };
+
+    std::pmr::memory_resource* upstream;
+    FreeBlock* freeLists[maxBlockSize / granularity] = {};
+    Chunk* head = nullptr;
+    LargeBlock* large = nullptr;
+    char* cursor = nullptr;
+    char* limit = nullptr;
+    size_t nextChunkSize = minChunkSize;
+    size_t chunks = 0, blocks = 0;
+
+    static size_t roundUp(size_t bytes) noexcept { return (bytes + granularity - 1) / granularity * granularity; }
+    // Offset of a large block from its header, which keeps the block aligned.
+    static size_t largeOffset(size_t alignment) noexcept {
+        alignment = std::max(alignment, granularity);
+        return (sizeof(LargeBlock) + alignment - 1) / alignment * alignment;
+    }
+    void* allocateLarge(size_t bytes, size_t alignment);
+    void deallocateLarge(LargeBlock* block) noexcept;
+};
+
+inline void NodePool::release() noexcept {
+    while (large)
+        deallocateLarge(large);
+    while (head) {
+        Chunk* next = head->next;
+        upstream->deallocate(head, head->size, granularity);
+        head = next;
+    }
+    std::fill(std::begin(freeLists), std::end(freeLists), nullptr);
+    cursor = limit = nullptr;
+    nextChunkSize = minChunkSize;
+    chunks = blocks = 0;
+}
+
+inline void* NodePool::allocateLarge(size_t bytes, size_t alignment) {
+    size_t offset = largeOffset(alignment);
+    alignment = std::max(alignment, granularity);
+    LargeBlock* block = ::new (upstream->allocate(offset + bytes, alignment)) LargeBlock{nullptr, large, offset + bytes, alignment};
+    if (large)
+        large->prev = block;
+    large = block;
+    return reinterpret_cast<char*>(block) + offset;
+}
+
+inline void NodePool::deallocateLarge(LargeBlock* block) noexcept {
+    (block->prev ? block->prev->next : large) = block->next;
+    if (block->next)
+        block->next->prev = block->prev;
+    upstream->deallocate(block, block->size, block->alignment);
+}
+
+inline void* NodePool::do_allocate(size_t bytes, size_t alignment) {
+    if (bytes > maxBlockSize || alignment > granularity)
+        return allocateLarge(bytes, alignment);
+    bytes = roundUp(bytes ? bytes : 1);
+    FreeBlock*& freeList = freeLists[bytes / granularity - 1];
+    ++blocks;
+    if (freeList) {
+        FreeBlock* block = freeList;
+        freeList = block->next;
+        return block;
+    }
+    if (static_cast<size_t>(limit - cursor) < bytes) {
+        size_t size = nextChunkSize;
+        Chunk* chunk = static_cast<Chunk*>(upstream->allocate(size, granularity));
+        chunk->next = head;
+        chunk->size = size;
+        head = chunk;
+        cursor = reinterpret_cast<char*>(chunk) + headerSize;
+        limit = reinterpret_cast<char*>(chunk) + size;
+        nextChunkSize = std::min(nextChunkSize * 2, maxChunkSize);
+        ++chunks;
+    }
+    void* block = cursor;
+    cursor += bytes;
+    return block;
+}
+
+inline void NodePool::do_deallocate(void* pointer, size_t bytes, size_t alignment) {
+    if (bytes > maxBlockSize || alignment > granularity) {
+        deallocateLarge(reinterpret_cast<LargeBlock*>(static_cast<char*>(pointer) - largeOffset(alignment)));
+        return;
+    }
+    bytes = roundUp(bytes ? bytes : 1);
+    FreeBlock*& freeList = freeLists[bytes / granularity - 1];
+    freeList = ::new (pointer) FreeBlock{freeList};
+    --blocks;
+}
+
+struct SharedNodePool {
+    NodePool pool;
+    size_t owners = 1;
+
+    // Gives up one owner's reference and destroys the pool with the last one.
+    // Out of line, so that GCC does not follow the copies of an allocator that
+    // get destroyed one after another into each other's delete and warn about a
+    // use after free that the count rules out.
+    [[gnu::noinline]] static void drop(SharedNodePool* shared) noexcept {
+        if (--shared->owners == 0)
+            delete shared;
+    }
+};
+
+// Allocator handing out blocks from a NodePool. A default-constructed allocator
+// creates its own pool; copies and rebinds share it, and the pool is destroyed
+// together with its last allocator. The reference count is not atomic, just
+// like the trees themselves are not thread-safe.
+template <typename T>
+class PoolAllocator {
+    template <typename U>
+    friend class PoolAllocator;
+
+    SharedNodePool* shared;
+
+   public:
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    PoolAllocator() : shared(new SharedNodePool) {}
+    PoolAllocator(const PoolAllocator& other) noexcept : shared(other.shared) { ++shared->owners; }
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other) noexcept : shared(other.shared) { ++shared->owners; }
+    PoolAllocator& operator=(PoolAllocator other) noexcept {
+        std::swap(shared, other.shared);
+        return *this;
+    }
+    ~PoolAllocator() { SharedNodePool::drop(shared); }
+
+    T* allocate(size_t n) { return static_cast<T*>(shared->pool.allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T* pointer, size_t n) noexcept { shared->pool.deallocate(pointer, n * sizeof(T), alignof(T)); }
+
+    NodePool& pool() const noexcept { return shared->pool; }
+
+    // Drops every chunk of the pool at once, but only when this allocator is the
+    // last one referring to it, i.e. no other tree or node shares the pool.
+    bool release() noexcept {
+        if (shared->owners != 1)
+            return false;
+        shared->pool.release();
+        return true;
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& other) const noexcept { return &pool() == &other.pool(); }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& other) const noexcept { return !(*this == other); }
+};
+
+template <typename Allocator, typename = void>
+struct HasRelease : std::false_type {};
+
+template <typename Allocator>
+struct HasRelease<Allocator, std::void_t<decltype(std::declval<Allocator&>().release())>> : std::true_type {};
+
+// Called by the trees once they dropped all of their nodes, so that arena-like
+// allocators can give back their memory in whole chunks.
+template <typename Allocator>
+void releaseAllocator(Allocator& allocator) noexcept {
+    if constexpr (HasRelease<Allocator>::value)
+        allocator.release();
+}
+
+#endif  // NODE_POOL_HPP
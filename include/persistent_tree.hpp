@@ -0,0 +1,668 @@
+#ifndef PERSISTENT_TREE_HPP
+#define PERSISTENT_TREE_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "priority.hpp"
+
+// Nodes of the persistent trees have no parent link and are never modified once
+// they are part of a version, so any number of versions can share them. Copies
+// of a tree share the root; an update copies the nodes on its path only.
+template <typename T>
+struct PersistentTreapNode {
+    using link = std::shared_ptr<const PersistentTreapNode>;
+
+    T value;
+    link left, right;
+    size_t size, count, repeat;
+    std::uint32_t priority;
+
+    PersistentTreapNode(T value, size_t repeat = 1)
+        : value(std::move(value)), size(repeat), count(1), repeat(repeat), priority(0) {}
+
+    inline void update() {
+        count = 1 + (left ? left->count : 0) + (right ? right->count : 0);
+        size = repeat + (left ? left->size : 0) + (right ? right->size : 0);
+    }
+};
+
+template <typename T>
+struct PersistentAVLTreeNode {
+    using link = std::shared_ptr<const PersistentAVLTreeNode>;
+
+    T value;
+    link left, right;
+    size_t size, count, repeat, height;
+
+    PersistentAVLTreeNode(T value, size_t repeat = 1)
+        : value(std::move(value)), size(repeat), count(1), repeat(repeat), height(1) {}
+
+    inline void update() {
+        count = 1 + (left ? left->count : 0) + (right ? right->count : 0);
+        size = repeat + (left ? left->size : 0) + (right ? right->size : 0);
+        height = 1 + std::max(left ? left->height : 0, right ? right->height : 0);
+    }
+};
+
+// Queries shared by the persistent trees. Copying a tree is O(1) and gives an
+// independent version: updates to either one never show in the other.
+template <typename T, typename Compare, typename Node, typename Allocator>
+class PersistentTree {
+   protected:
+    using Link = typename Node::link;
+
+    Link root = nullptr;
+    Compare compare = Compare();
+    Allocator allocator = Allocator();
+
+    template <typename Value>
+    std::shared_ptr<Node> createNode(Value&& value, size_t repeat = 1) const;
+    Link relink(const Node& node, Link left, Link right, size_t repeat) const;
+    Link relink(const Node& node, Link left, Link right) const { return relink(node, std::move(left), std::move(right), node.repeat); }
+    // Key is T unless the comparator is transparent.
+    template <typename Key>
+    const Node* find(const Key& key) const;
+    template <typename Key>
+    const Node* floorNode(const Key& key) const;
+    template <typename Key>
+    const Node* ceilNode(const Key& key) const;
+    template <typename Key>
+    Link adjust(const Link& node, const Key& key, bool increment) const;
+    template <typename Key>
+    size_t countBefore(const Key& key, bool inclusive, bool repeats) const;
+    template <typename Visitor>
+    void visit(const Link& node, const T& lo, const T& hi, Visitor& visitor) const;
+    void collect(const Link& node, size_t n, bool reverse, std::vector<T>& result) const;
+    size_t check(const Link& node) const;
+
+    template <typename InputIt>
+    std::vector<std::shared_ptr<Node>> foldSorted(InputIt first, InputIt last) const;
+
+   public:
+    PersistentTree() = default;
+    explicit PersistentTree(const Allocator& allocator) : allocator(allocator) {}
+
+    size_t size() const noexcept { return root ? root->count : 0; }
+    bool empty() const noexcept { return root == nullptr; }
+    void clear() noexcept { root = nullptr; }
+    size_t height() const noexcept;
+    void print() const;
+    void check() const { check(root); }
+
+    bool contains(const T& value) const { return find(value) != nullptr; }
+    size_t rank(const T& value) const { return countBefore(value, true, false); }
+    T select(size_t rank) const;
+    T min() const;
+    T max() const;
+    T floor(const T& value) const;
+    T ceil(const T& value) const;
+    std::vector<T> nsmallest(size_t n) const;
+    std::vector<T> nlargest(size_t n) const;
+
+    // Lookups with any key a transparent comparator orders against T.
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    bool contains(const Key& key) const { return find(key) != nullptr; }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    size_t rank(const Key& key) const { return countBefore(key, true, false); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    T floor(const Key& key) const;
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    T ceil(const Key& key) const;
+
+    size_t count_range(const T& lo, const T& hi) const;
+    size_t size_range(const T& lo, const T& hi) const;
+    template <typename Visitor>
+    void visit_range(const T& lo, const T& hi, Visitor&& visitor) const;
+
+    Allocator get_allocator() const noexcept { return allocator; }
+};
+
+template <typename T, typename Compare, typename Node, typename Allocator>
+template <typename Value>
+std::shared_ptr<Node> PersistentTree<T, Compare, Node, Allocator>::createNode(Value&& value, size_t repeat) const {
+    return std::allocate_shared<Node>(allocator, std::forward<Value>(value), repeat);
+}
+
+// Copy of the node with other children and repeat count. The copy keeps the
+// balancing metadata of the original, which the caller rebalances if needed.
+template <typename T, typename Compare, typename Node, typename Allocator>
+typename PersistentTree<T, Compare, Node, Allocator>::Link
+PersistentTree<T, Compare, Node, Allocator>::relink(const Node& node, Link left, Link right, size_t repeat) const {
+    std::shared_ptr<Node> copy = std::allocate_shared<Node>(allocator, node);
+    copy->left = std::move(left);
+    copy->right = std::move(right);
+    copy->repeat = repeat;
+    copy->update();
+    return copy;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator>
+template <typename Key>
+const Node* PersistentTree<T, Compare, Node, Allocator>::find(const Key& key) const {
+    const Node* current = root.get();
+    while (current) {
+        if (compare(key, current->value))
+            current = current->left.get();
+        else if (compare(current->value, key))
+            current = current->right.get();
+        else
+            break;
+    }
+    return current;
+}
+
+// Copies the path to the node holding value, which must exist, with its repeat
+// count one higher or lower. The shape does not change.
+template <typename T, typename Compare, typename Node, typename Allocator>
+template <typename Key>
+typename PersistentTree<T, Compare, Node, Allocator>::Link
+PersistentTree<T, Compare, Node, Allocator>::adjust(const Link& node, const Key& key, bool increment) const {
+    if (compare(key, node->value))
+        return relink(*node, adjust(node->left, key, increment), node->right);
+    if (compare(node->value, key))
+        return relink(*node, node->left, adjust(node->right, key, increment));
+    return relink(*node, node->left, node->right, increment ? node->repeat + 1 : node->repeat - 1);
+}
+
+// Chains the sorted range into fresh nodes, folding equal keys into one.
+template <typename T, typename Compare, typename Node, typename Allocator>
+template <typename InputIt>
+std::vector<std::shared_ptr<Node>> PersistentTree<T, Compare, Node, Allocator>::foldSorted(InputIt first, InputIt last) const {
+    std::vector<std::shared_ptr<Node>> nodes;
+    for (; first != last; ++first) {
+        if (!nodes.empty() && !compare(nodes.back()->value, *first)) {
+            assert(!compare(*first, nodes.back()->value));
+            ++nodes.back()->repeat;
+            continue;
+        }
+        nodes.push_back(createNode(*first));
+    }
+    return nodes;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator>
+size_t PersistentTree<T, Compare, Node, Allocator>::height() const noexcept {
+    std::function<size_t(const Link&)> height = [&](const Link& node) -> size_t {
+        return node ? 1 + std::max(height(node->left), height(node->right)) : 0;
+    };
+    return height(root);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator>
+void PersistentTree<T, Compare, Node, Allocator>::print() const {
+    for (const T& value : nsmallest(size()))
+        std::cout << value << " ";
+    std::cout << std::endl;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator>
+size_t PersistentTree<T, Compare, Node, Allocator>::check(const Link& node) const {
+    if (node == nullptr)
+        return 0;
+    if (node->left)
+        assert(compare(node->left->value, node->value));
+    if (node->right)
+        assert(compare(node->value, node->right->value));
+    size_t count = 1 + check(node->left) + check(node->right);
+    assert(count == node->count);
+    assert(node->size == node->repeat + (node->left ? node->left->size : 0) + (node->right ? node->right->size : 0));
+    return count;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator>
+template <typename Key>
+size_t PersistentTree<T, Compare, Node, Allocator>::countBefore(const Key& key, bool inclusive, bool repeats) const {
+    size_t result = 0;
+    const Node* current = root.get();
+    while (current) {
+        if (inclusive ? !compare(key, current->value) : compare(current->value, key)) {
+            if (current->left)
+                result += repeats ? current->left->size : current->left->count;
+            result += repeats ? current->repeat : 1;
+            current = current->right.get();
+        } else
+            current = current->left.get();
+    }
+    return result;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator>
+T PersistentTree<T, Compare, Node, Allocator>::select(size_t rank) const {
+    const Node* current = root.get();
+    while (current) {
+        size_t leftCount = current->left ? current->left->count : 0;
+        if (rank <= leftCount)
+            current = current->left.get();
+        else if (rank == leftCount + 1)
+            return current->value;
+        else {
+            rank -= leftCount + 1;
+            current = current->right.get();
+        }
+    }
+    return T();
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator>
+T PersistentTree<T, Compare, Node, Allocator>::min() const {
+    const Node* current = root.get();
+    while (current->left)
+        current = current->left.get();
+    return current->value;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator>
+T PersistentTree<T, Compare, Node, Allocator>::max() const {
+    const Node* current = root.get();
+    while (current->right)
+        current = current->right.get();
+    return current->value;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator>
+template <typename Key>
+const Node* PersistentTree<T, Compare, Node, Allocator>::floorNode(const Key& key) const {
+    const Node* current = root.get();
+    const Node* result = nullptr;
+    while (current) {
+        if (compare(key, current->value))
+            current = current->left.get();
+        else {
+            result = current;
+            current = current->right.get();
+        }
+    }
+    return result;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator>
+template <typename Key>
+const Node* PersistentTree<T, Compare, Node, Allocator>::ceilNode(const Key& key) const {
+    const Node* current = root.get();
+    const Node* result = nullptr;
+    while (current) {
+        if (compare(current->value, key))
+            current = current->right.get();
+        else {
+            result = current;
+            current = current->left.get();
+        }
+    }
+    return result;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator>
+T PersistentTree<T, Compare, Node, Allocator>::floor(const T& value) const {
+    const Node* result = floorNode(value);
+    return result ? result->value : T();
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator>
+T PersistentTree<T, Compare, Node, Allocator>::ceil(const T& value) const {
+    const Node* result = ceilNode(value);
+    return result ? result->value : T();
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator>
+template <typename Key, typename C, typename>
+T PersistentTree<T, Compare, Node, Allocator>::floor(const Key& key) const {
+    const Node* result = floorNode(key);
+    return result ? result->value : T();
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator>
+template <typename Key, typename C, typename>
+T PersistentTree<T, Compare, Node, Allocator>::ceil(const Key& key) const {
+    const Node* result = ceilNode(key);
+    return result ? result->value : T();
+}
+
+// Appends keys of the subtree in order, or in reverse order, until result holds n.
+template <typename T, typename Compare, typename Node, typename Allocator>
+void PersistentTree<T, Compare, Node, Allocator>::collect(const Link& node, size_t n, bool reverse, std::vector<T>& result) const {
+    if (node == nullptr || result.size() >= n)
+        return;
+    collect(reverse ? node->right : node->left, n, reverse, result);
+    if (result.size() < n)
+        result.push_back(node->value);
+    collect(reverse ? node->left : node->right, n, reverse, result);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator>
+std::vector<T> PersistentTree<T, Compare, Node, Allocator>::nsmallest(size_t n) const {
+    std::vector<T> result;
+    collect(root, n, false, result);
+    return result;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator>
+std::vector<T> PersistentTree<T, Compare, Node, Allocator>::nlargest(size_t n) const {
+    std::vector<T> result;
+    collect(root, n, true, result);
+    return result;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator>
+size_t PersistentTree<T, Compare, Node, Allocator>::count_range(const T& lo, const T& hi) const {
+    if (compare(hi, lo))
+        return 0;
+    return countBefore(hi, true, false) - countBefore(lo, false, false);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator>
+size_t PersistentTree<T, Compare, Node, Allocator>::size_range(const T& lo, const T& hi) const {
+    if (compare(hi, lo))
+        return 0;
+    return countBefore(hi, true, true) - countBefore(lo, false, true);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator>
+template <typename Visitor>
+void PersistentTree<T, Compare, Node, Allocator>::visit(const Link& node, const T& lo, const T& hi, Visitor& visitor) const {
+    if (node == nullptr)
+        return;
+    bool aboveLo = !compare(node->value, lo);
+    bool belowHi = !compare(hi, node->value);
+    if (aboveLo)
+        visit(node->left, lo, hi, visitor);
+    if (aboveLo && belowHi)
+        visitor(node->value, node->repeat);
+    if (belowHi)
+        visit(node->right, lo, hi, visitor);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator>
+template <typename Visitor>
+void PersistentTree<T, Compare, Node, Allocator>::visit_range(const T& lo, const T& hi, Visitor&& visitor) const {
+    if (!compare(hi, lo))
+        visit(root, lo, hi, visitor);
+}
+
+// Persistent counterpart of NonRotatingTreap. A new key is placed by splitting
+// the subtree it outranks, an erased one is replaced by the merge of its
+// children; both copy just the nodes on the way, O(log n) expected. Priorities
+// come from Priority as in Treap; snapshots carry a copy of its state.
+template <typename T, typename Compare = std::less<T>, typename Allocator = std::allocator<PersistentTreapNode<T>>, typename Priority = RandomPriority>
+class PersistentTreap : public PersistentTree<T, Compare, PersistentTreapNode<T>, Allocator> {
+    using Node = PersistentTreapNode<T>;
+    using Link = typename Node::link;
+    using PersistentTree<T, Compare, Node, Allocator>::root;
+    using PersistentTree<T, Compare, Node, Allocator>::compare;
+    using PersistentTree<T, Compare, Node, Allocator>::relink;
+
+   protected:
+    Priority priorities;
+
+    template <typename Key>
+    std::pair<Link, Link> split(const Link& node, const Key& key) const;
+    Link merge(const Link& left, const Link& right) const;
+    Link insert(const Link& node, const std::shared_ptr<Node>& fresh) const;
+    template <typename Key>
+    Link erase(const Link& node, const Key& key) const;
+    template <typename Value>
+    void insertValue(Value&& value);
+    template <typename Key>
+    void removeKey(const Key& key);
+
+   public:
+    PersistentTreap() = default;
+    explicit PersistentTreap(const Allocator& allocator) : PersistentTree<T, Compare, Node, Allocator>(allocator) {}
+    explicit PersistentTreap(const Priority& priorities, const Allocator& allocator = Allocator())
+        : PersistentTree<T, Compare, Node, Allocator>(allocator), priorities(priorities) {}
+    template <typename InputIt>
+    PersistentTreap(InputIt first, InputIt last) { assign_sorted(first, last); }
+
+    // The current version, which later updates of this tree leave untouched.
+    PersistentTreap snapshot() const { return *this; }
+
+    void insert(const T& value) { insertValue(value); }
+    void insert(T&& value) { insertValue(std::move(value)); }
+    void remove(const T& value) { removeKey(value); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    void remove(const Key& key) { removeKey(key); }
+    template <typename... Args>
+    void emplace(Args&&... args) { insert(T(std::forward<Args>(args)...)); }
+    template <typename InputIt>
+    void assign_sorted(InputIt first, InputIt last);
+};
+
+// Splits a subtree not holding key into the keys before and after it.
+template <typename T, typename Compare, typename Allocator, typename Priority>
+template <typename Key>
+std::pair<typename PersistentTreap<T, Compare, Allocator, Priority>::Link, typename PersistentTreap<T, Compare, Allocator, Priority>::Link>
+PersistentTreap<T, Compare, Allocator, Priority>::split(const Link& node, const Key& key) const {
+    if (node == nullptr)
+        return {nullptr, nullptr};
+    if (compare(node->value, key)) {
+        auto [left, right] = split(node->right, key);
+        return {relink(*node, node->left, std::move(left)), std::move(right)};
+    }
+    auto [left, right] = split(node->left, key);
+    return {std::move(left), relink(*node, std::move(right), node->right)};
+}
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+typename PersistentTreap<T, Compare, Allocator, Priority>::Link
+PersistentTreap<T, Compare, Allocator, Priority>::merge(const Link& left, const Link& right) const {
+    if (left == nullptr || right == nullptr)
+        return left ? left : right;
+    if (left->priority < right->priority)
+        return relink(*left, left->left, merge(left->right, right));
+    return relink(*right, merge(left, right->left), right->right);
+}
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+typename PersistentTreap<T, Compare, Allocator, Priority>::Link
+PersistentTreap<T, Compare, Allocator, Priority>::insert(const Link& node, const std::shared_ptr<Node>& fresh) const {
+    if (node == nullptr || fresh->priority < node->priority) {
+        std::tie(fresh->left, fresh->right) = split(node, fresh->value);
+        fresh->update();
+        return fresh;
+    }
+    if (compare(fresh->value, node->value))
+        return relink(*node, insert(node->left, fresh), node->right);
+    return relink(*node, node->left, insert(node->right, fresh));
+}
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+template <typename Key>
+typename PersistentTreap<T, Compare, Allocator, Priority>::Link
+PersistentTreap<T, Compare, Allocator, Priority>::erase(const Link& node, const Key& key) const {
+    if (compare(key, node->value))
+        return relink(*node, erase(node->left, key), node->right);
+    if (compare(node->value, key))
+        return relink(*node, node->left, erase(node->right, key));
+    return merge(node->left, node->right);
+}
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+template <typename Value>
+void PersistentTreap<T, Compare, Allocator, Priority>::insertValue(Value&& value) {
+    if (this->contains(value))
+        root = this->adjust(root, value, true);
+    else {
+        std::shared_ptr<Node> fresh = this->createNode(std::forward<Value>(value));
+        fresh->priority = priorities(fresh->value);
+        root = insert(root, fresh);
+    }
+}
+
+template <typename T, typename Compare, typename Allocator, typename Priority>
+template <typename Key>
+void PersistentTreap<T, Compare, Allocator, Priority>::removeKey(const Key& key) {
+    const Node* node = this->find(key);
+    if (node == nullptr)
+        return;
+    root = node->repeat > 1 ? this->adjust(root, key, false) : erase(root, key);
+}
+
+// Builds the Cartesian tree of the sorted range in O(n), keeping the right spine
+// on a stack.
+template <typename T, typename Compare, typename Allocator, typename Priority>
+template <typename InputIt>
+void PersistentTreap<T, Compare, Allocator, Priority>::assign_sorted(InputIt first, InputIt last) {
+    std::vector<std::shared_ptr<Node>> spine;
+    for (std::shared_ptr<Node>& node : this->foldSorted(first, last)) {
+        node->priority = priorities(node->value);
+        std::shared_ptr<Node> child = nullptr;
+        while (!spine.empty() && node->priority < spine.back()->priority) {
+            child = std::move(spine.back());
+            spine.pop_back();
+            child->update();
+        }
+        node->left = std::move(child);
+        if (!spine.empty())
+            spine.back()->right = node;
+        spine.push_back(std::move(node));
+    }
+    for (auto it = spine.rbegin(); it != spine.rend(); ++it)
+        (*it)->update();
+    root = spine.empty() ? nullptr : spine.front();
+}
+
+// Persistent counterpart of AVLTree. Rotations build new nodes instead of
+// relinking old ones, so rebalancing stays on the copied path as well.
+template <typename T, typename Compare = std::less<T>, typename Allocator = std::allocator<PersistentAVLTreeNode<T>>>
+class PersistentAVLTree : public PersistentTree<T, Compare, PersistentAVLTreeNode<T>, Allocator> {
+    using Node = PersistentAVLTreeNode<T>;
+    using Link = typename Node::link;
+    using PersistentTree<T, Compare, Node, Allocator>::root;
+    using PersistentTree<T, Compare, Node, Allocator>::compare;
+    using PersistentTree<T, Compare, Node, Allocator>::relink;
+
+    static size_t heightOf(const Link& node) noexcept { return node ? node->height : 0; }
+
+   protected:
+    Link balance(const Node& node, Link left, Link right, size_t repeat) const;
+    Link balance(const Node& node, Link left, Link right) const { return balance(node, std::move(left), std::move(right), node.repeat); }
+    template <typename Value>
+    Link insert(const Link& node, Value&& value) const;
+    template <typename Key>
+    Link erase(const Link& node, const Key& key) const;
+    template <typename Value>
+    void insertValue(Value&& value);
+    template <typename Key>
+    void removeKey(const Key& key);
+    std::pair<Link, Link> eraseMin(const Link& node) const;
+    Link build(std::vector<std::shared_ptr<Node>>& nodes, size_t lo, size_t hi) const;
+
+   public:
+    PersistentAVLTree() = default;
+    explicit PersistentAVLTree(const Allocator& allocator) : PersistentTree<T, Compare, Node, Allocator>(allocator) {}
+    template <typename InputIt>
+    PersistentAVLTree(InputIt first, InputIt last) { assign_sorted(first, last); }
+
+    // The current version, which later updates of this tree leave untouched.
+    PersistentAVLTree snapshot() const { return *this; }
+
+    void insert(const T& value) { insertValue(value); }
+    void insert(T&& value) { insertValue(std::move(value)); }
+    void remove(const T& value) { removeKey(value); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    void remove(const Key& key) { removeKey(key); }
+    template <typename... Args>
+    void emplace(Args&&... args) { insert(T(std::forward<Args>(args)...)); }
+    template <typename InputIt>
+    void assign_sorted(InputIt first, InputIt last);
+};
+
+// Copy of the node with the given subtrees, whose heights differ by at most two,
+// rotated back into AVL shape.
+template <typename T, typename Compare, typename Allocator>
+typename PersistentAVLTree<T, Compare, Allocator>::Link
+PersistentAVLTree<T, Compare, Allocator>::balance(const Node& node, Link left, Link right, size_t repeat) const {
+    if (heightOf(left) > heightOf(right) + 1) {
+        if (heightOf(left->left) >= heightOf(left->right))
+            return relink(*left, left->left, relink(node, left->right, std::move(right), repeat));
+        const Link& middle = left->right;
+        return relink(*middle, relink(*left, left->left, middle->left), relink(node, middle->right, std::move(right), repeat));
+    }
+    if (heightOf(right) > heightOf(left) + 1) {
+        if (heightOf(right->right) >= heightOf(right->left))
+            return relink(*right, relink(node, std::move(left), right->left, repeat), right->right);
+        const Link& middle = right->left;
+        return relink(*middle, relink(node, std::move(left), middle->left, repeat), relink(*right, middle->right, right->right));
+    }
+    return relink(node, std::move(left), std::move(right), repeat);
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename Value>
+typename PersistentAVLTree<T, Compare, Allocator>::Link
+PersistentAVLTree<T, Compare, Allocator>::insert(const Link& node, Value&& value) const {
+    if (node == nullptr)
+        return this->createNode(std::forward<Value>(value));
+    if (compare(value, node->value))
+        return balance(*node, insert(node->left, std::forward<Value>(value)), node->right);
+    return balance(*node, node->left, insert(node->right, std::forward<Value>(value)));
+}
+
+// Splits the minimum off a non-empty subtree: returns the rest and that node.
+template <typename T, typename Compare, typename Allocator>
+std::pair<typename PersistentAVLTree<T, Compare, Allocator>::Link, typename PersistentAVLTree<T, Compare, Allocator>::Link>
+PersistentAVLTree<T, Compare, Allocator>::eraseMin(const Link& node) const {
+    if (node->left == nullptr)
+        return {node->right, node};
+    auto [rest, minimum] = eraseMin(node->left);
+    return {balance(*node, std::move(rest), node->right), std::move(minimum)};
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename Key>
+typename PersistentAVLTree<T, Compare, Allocator>::Link
+PersistentAVLTree<T, Compare, Allocator>::erase(const Link& node, const Key& key) const {
+    if (compare(key, node->value))
+        return balance(*node, erase(node->left, key), node->right);
+    if (compare(node->value, key))
+        return balance(*node, node->left, erase(node->right, key));
+    if (node->left == nullptr || node->right == nullptr)
+        return node->left ? node->left : node->right;
+    auto [rest, successor] = eraseMin(node->right);
+    return balance(*successor, node->left, std::move(rest));
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename Value>
+void PersistentAVLTree<T, Compare, Allocator>::insertValue(Value&& value) {
+    root = this->contains(value) ? this->adjust(root, value, true) : insert(root, std::forward<Value>(value));
+}
+
+template <typename T, typename Compare, typename Allocator>
+template <typename Key>
+void PersistentAVLTree<T, Compare, Allocator>::removeKey(const Key& key) {
+    const Node* node = this->find(key);
+    if (node == nullptr)
+        return;
+    root = node->repeat > 1 ? this->adjust(root, key, false) : erase(root, key);
+}
+
+template <typename T, typename Compare, typename Allocator>
+typename PersistentAVLTree<T, Compare, Allocator>::Link
+PersistentAVLTree<T, Compare, Allocator>::build(std::vector<std::shared_ptr<Node>>& nodes, size_t lo, size_t hi) const {
+    if (lo >= hi)
+        return nullptr;
+    size_t middle = lo + (hi - lo - 1) / 2;
+    std::shared_ptr<Node>& node = nodes[middle];
+    node->left = build(nodes, lo, middle);
+    node->right = build(nodes, middle + 1, hi);
+    node->update();
+    return node;
+}
+
+// A perfectly balanced tree is an AVL tree, so the sorted range is simply split
+// in halves, in O(n).
+template <typename T, typename Compare, typename Allocator>
+template <typename InputIt>
+void PersistentAVLTree<T, Compare, Allocator>::assign_sorted(InputIt first, InputIt last) {
+    std::vector<std::shared_ptr<Node>> nodes = this->foldSorted(first, last);
+    root = build(nodes, 0, nodes.size());
+}
+
+#endif  // PERSISTENT_TREE_HPP
@@ -0,0 +1,56 @@
+#ifndef PRIORITY_HPP
+#define PRIORITY_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+// The splitmix64 finalizer: every bit of x affects every bit of the result.
+inline std::uint64_t mixHash(std::uint64_t x) noexcept {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Priority sources of the treaps, Treap and NonRotatingTreap as well as
+// PersistentTreap and ConcurrentTreap. A treap holds one and asks it for the
+// priority of every node it creates; lower priorities sit closer to the root,
+// and in Treap and NonRotatingTreap ties go to the lower key.
+//
+// RandomPriority draws them from a splitmix64 generator of the tree's own.
+// Trees built without a seed get streams of their own as well, so no global
+// state is touched after construction.
+class RandomPriority {
+    std::uint64_t state;
+
+    static std::uint64_t nextStream() noexcept {
+        static std::atomic<std::uint64_t> streams{0};
+        return mixHash(streams.fetch_add(1, std::memory_order_relaxed));
+    }
+
+   public:
+    static constexpr bool canonical = false;
+
+    RandomPriority() noexcept : state(nextStream()) {}
+    explicit RandomPriority(std::uint64_t seed) noexcept : state(seed) {}
+
+    template <typename Key>
+    std::uint32_t operator()(const Key&) noexcept {
+        return mixHash(state += 0x9e3779b97f4a7c15ULL) >> 32;
+    }
+};
+
+// HashPriority derives the priority from the key alone. A treap's shape is
+// then a function of its set of keys, whatever order they came in, which is
+// what lets digests of two treaps be compared. Keys an adversary can choose
+// may then make the treap deep, as with any fixed hash.
+template <typename Key, typename Hash = std::hash<Key>>
+struct HashPriority {
+    static constexpr bool canonical = true;
+
+    Hash hash = Hash();
+
+    std::uint32_t operator()(const Key& key) const { return mixHash(hash(key)) >> 32; }
+};
+
+#endif  // PRIORITY_HPP
@@ -7,11 +7,6 @@
 
 #include "binary_search_tree.hpp"
 
-enum Color {
-    RED = 0,
-    BLACK = 1
-};
-
 template <typename T>
 struct RBTreeNode {
    public:
@@ -24,8 +19,8 @@ struct RBTreeNode {
     Color color = Color::RED;
 
     RBTreeNode() = default;
-    RBTreeNode(const T& value, size_t repeat = 1)
-        : value(std::move(value)), count(repeat), repeat(repeat) {}
+    RBTreeNode(T value, size_t repeat = 1)
+        : value(std::move(value)), size(repeat), count(repeat), repeat(repeat) {}
 
     ~RBTreeNode() = default;
 
@@ -35,37 +30,104 @@ struct RBTreeNode {
     }
 };
 
-template <typename T, typename Compare = std::less<T>, typename Node = RBTreeNode<T>>
-class RBTree : public BinarySearchTree<T, Compare, Node> {
-    using BinarySearchTree<T, Compare, Node>::root;
-    using BinarySearchTree<T, Compare, Node>::compare;
-    using BinarySearchTree<T, Compare, Node>::rotateLeft;
-    using BinarySearchTree<T, Compare, Node>::rotateRight;
-    using BinarySearchTree<T, Compare, Node>::rotate;
+template <typename T, typename SizeType = std::uint32_t>
+struct CompactRBTreeNode : CompactNodeBase<CompactRBTreeNode<T, SizeType>, T, SizeType> {
+   public:
+    Color color = Color::RED;
+
+    using CompactNodeBase<CompactRBTreeNode<T, SizeType>, T, SizeType>::CompactNodeBase;
+};
+
+// Derived is the tree deriving from this one, if any, so that the shared
+// algorithms reach its hooks (see BinarySearchTree).
+template <typename T, typename Compare = std::less<T>, typename Node = RBTreeNode<T>, typename Allocator = std::allocator<Node>, typename Stats = NoTreeStats, typename Derived = void>
+class RBTree : public BinarySearchTree<T, Compare, Node, Allocator, Stats, std::conditional_t<std::is_void_v<Derived>, RBTree<T, Compare, Node, Allocator, Stats>, Derived>> {
+    using Base = BinarySearchTree<T, Compare, Node, Allocator, Stats, std::conditional_t<std::is_void_v<Derived>, RBTree, Derived>>;
+    friend Base;
+   protected:
+    using Base::root;
+    using Base::compare;
+    using Base::createNode;
+    using Base::rotateLeft;
+    using Base::rotateRight;
+    using Base::rotate;
+    using Base::stats;
+    using Base::transplant;
+
+    static bool isRed(const NodePtr<Node>& node) noexcept { return node && node->color == Color::RED; }
+
+    NodePtr<Node> buildSorted(NodePtr<Node> head, size_t n);
+    void paint(const NodePtr<Node>& node, size_t depth, size_t redDepth);
+    void removeFixup(NodePtr<Node> node, NodePtr<Node> parent);
+    size_t blackHeight(const NodePtr<Node>& node) const;
+    template <typename Value>
+    NodePtr<Node> insertValue(Value&& value) { return insertValue(std::forward<Value>(value), root); }
+    template <typename Value>
+    NodePtr<Node> insertValue(Value&& value, NodePtr<Node> from);
+    template <typename Key>
+    void removeKey(const Key& key);
 
    public:
+    using typename Base::iterator;
+
     RBTree() = default;
+    explicit RBTree(const Allocator& allocator) : Base(allocator) {}
+    template <typename InputIt>
+    RBTree(InputIt first, InputIt last) { this->assign_sorted(first, last); }
     RBTree(const RBTree&) = delete;
     RBTree(RBTree&&) = default;
     RBTree& operator=(const RBTree&) = delete;
     RBTree& operator=(RBTree&&) = default;
     ~RBTree() = default;
 
-    void insert(const T& value) override;
-    void remove(const T& value) override;
+    void check();
+    void insert(const T& value) { insertValue(value); }
+    void insert(T&& value) { insertValue(std::move(value)); }
+    iterator insert(iterator hint, const T& value) { return this->iteratorAt(insertValue(value, this->fingerNode(hint, value))); }
+    iterator insert(iterator hint, T&& value) {
+        NodePtr<Node> from = this->fingerNode(hint, value);
+        return this->iteratorAt(insertValue(std::move(value), from));
+    }
+    void remove(const T& value) { removeKey(value); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    void remove(const Key& key) { removeKey(key); }
 };
 
-template <typename T, typename Compare, typename Node>
-void RBTree<T, Compare, Node>::insert(const T& value) {
+// The balanced tree has all of its empty subtrees on its last two levels, so
+// painting only the deepest level red leaves every path with the same number
+// of black nodes.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+NodePtr<Node> RBTree<T, Compare, Node, Allocator, Stats, Derived>::buildSorted(NodePtr<Node> head, size_t n) {
+    NodePtr<Node> node = this->buildBalanced(head, n);
+    size_t height = 0;
+    for (NodePtr<Node> current = node; current && current->right; current = current->right)
+        ++height;
+    paint(node, 0, height ? height : 1);
+    return node;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+void RBTree<T, Compare, Node, Allocator, Stats, Derived>::paint(const NodePtr<Node>& node, size_t depth, size_t redDepth) {
+    if (node == nullptr)
+        return;
+    node->color = depth == redDepth ? Color::RED : Color::BLACK;
+    paint(node->left, depth + 1, redDepth);
+    paint(node->right, depth + 1, redDepth);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+template <typename Value>
+NodePtr<Node> RBTree<T, Compare, Node, Allocator, Stats, Derived>::insertValue(Value&& value, NodePtr<Node> from) {
     if (root == nullptr) {
-        root = std::make_shared<Node>(value);
+        root = createNode(std::forward<Value>(value));
         root->color = Color::BLACK;
-        return;
+        return root;
     }
 
-    std::shared_ptr<Node> node = root;
-    std::shared_ptr<Node> parent = nullptr;
+    NodePtr<Node> node = std::move(from);
+    NodePtr<Node> parent = nullptr;
     while (node != nullptr) {
+        stats.visit();
         parent = node;
         if (compare(value, node->value)) {
             node = node->left;
@@ -81,20 +143,22 @@ void RBTree<T, Compare, Node>::insert(const T& value) {
     if (node != nullptr) {
         for (; parent != nullptr; parent = parent->parent.lock())
             parent->update();
-        return;
+        return node;
     }
 
-    node = std::make_shared<Node>(value);
-    parent->children[compare(parent->value, value)] = node;
+    size_t direction = compare(parent->value, value);
+    node = createNode(std::forward<Value>(value));
+    childOf(parent, direction) = node;
     node->parent = parent;
+    NodePtr<Node> holder = node;
 
     if (parent == root) {
         root->color = Color::BLACK;
         root->update();
-        return;
+        return holder;
     }
 
-    std::shared_ptr<Node> grandparent, uncle;
+    NodePtr<Node> grandparent, uncle;
 
     while (parent->color == Color::RED) {
         grandparent = getGrandparent(node);
@@ -108,11 +172,11 @@ void RBTree<T, Compare, Node>::insert(const T& value) {
             parent = node->parent.lock();
             if (parent == nullptr) {
                 node->color = Color::BLACK;
-                return;
+                return holder;
             }
         } else {
-            if (compare(parent->value, grandparent->value) != compare(value, parent->value)) {
-                rotate(parent, compare(value, parent->value));
+            if (compare(parent->value, grandparent->value) != compare(node->value, parent->value)) {
+                rotate(parent, compare(node->value, parent->value));
                 rotate(grandparent, compare(parent->value, grandparent->value));
                 std::swap(node->color, grandparent->color);
             } else {
@@ -121,18 +185,23 @@ void RBTree<T, Compare, Node>::insert(const T& value) {
             }
             for (; parent != nullptr; parent = parent->parent.lock())
                 parent->update();
-            return;
+            return holder;
         }
     }
+    for (; parent != nullptr; parent = parent->parent.lock())
+        parent->update();
+    return holder;
 }
 
-template <typename T, typename Compare, typename Node>
-void RBTree<T, Compare, Node>::remove(const T& value) {
-    std::shared_ptr<Node> node = root;
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+template <typename Key>
+void RBTree<T, Compare, Node, Allocator, Stats, Derived>::removeKey(const Key& key) {
+    NodePtr<Node> node = root;
     while (node != nullptr) {
-        if (compare(value, node->value))
+        stats.visit();
+        if (compare(key, node->value))
             node = node->left;
-        else if (compare(node->value, value))
+        else if (compare(node->value, key))
             node = node->right;
         else
             break;
@@ -148,6 +217,345 @@ void RBTree<T, Compare, Node>::remove(const T& value) {
         return;
     }
 
-    throw std::runtime_error("Not implemented");
+    // The node leaving its place is the removed one when it has at most one
+    // child, and its successor otherwise; `child` takes that place below `parent`.
+    NodePtr<Node> child, parent;
+    Color removedColor;
+    if (node->left && node->right) {
+        NodePtr<Node> successor = node->right;
+        while (successor->left)
+            successor = successor->left;
+        removedColor = successor->color;
+        child = successor->right;
+        if (successor == node->right)
+            parent = successor;
+        else {
+            parent = successor->parent.lock();
+            transplant(successor, child);
+            successor->right = node->right;
+            successor->right->parent = successor;
+        }
+        transplant(node, successor);
+        successor->left = node->left;
+        successor->left->parent = successor;
+        successor->color = node->color;
+    } else {
+        removedColor = node->color;
+        child = node->left ? node->left : node->right;
+        parent = node->parent.lock();
+        transplant(node, child);
+    }
+
+    // Rotations keep the counts of the nodes they move, so they are brought up to
+    // date before the colors are repaired.
+    for (NodePtr<Node> current = parent; current != nullptr; current = current->parent.lock())
+        current->update();
+    if (removedColor == Color::BLACK)
+        removeFixup(child, parent);
+    this->destroyNode(node);
+}
+
+// node, possibly empty, is short of one black node on all of its paths. The
+// deficit moves up while the sibling can give up a red node, and is settled by
+// at most three rotations otherwise.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+void RBTree<T, Compare, Node, Allocator, Stats, Derived>::removeFixup(NodePtr<Node> node, NodePtr<Node> parent) {
+    while (parent != nullptr && !isRed(node)) {
+        size_t direction = parent->right == node;
+        NodePtr<Node> sibling = childOf(parent, !direction);
+        if (isRed(sibling)) {
+            sibling->color = Color::BLACK;
+            parent->color = Color::RED;
+            rotate(parent, direction);
+            sibling = childOf(parent, !direction);
+        }
+        if (!isRed(sibling->left) && !isRed(sibling->right)) {
+            sibling->color = Color::RED;
+            node = parent;
+            parent = node->parent.lock();
+            continue;
+        }
+        if (!isRed(childOf(sibling, !direction))) {
+            childOf(sibling, direction)->color = Color::BLACK;
+            sibling->color = Color::RED;
+            rotate(sibling, !direction);
+            sibling = childOf(parent, !direction);
+        }
+        sibling->color = parent->color;
+        parent->color = Color::BLACK;
+        childOf(sibling, !direction)->color = Color::BLACK;
+        rotate(parent, direction);
+        node = root;
+        break;
+    }
+    if (node)
+        node->color = Color::BLACK;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+size_t RBTree<T, Compare, Node, Allocator, Stats, Derived>::blackHeight(const NodePtr<Node>& node) const {
+    if (node == nullptr)
+        return 1;
+    if (isRed(node))
+        assert(!isRed(node->left) && !isRed(node->right));
+    size_t height = blackHeight(node->left);
+    assert(height == blackHeight(node->right));
+    return height + !isRed(node);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Derived>
+void RBTree<T, Compare, Node, Allocator, Stats, Derived>::check() {
+    Base::check();
+    assert(!isRed(root));
+    blackHeight(root);
+}
+
+// Red-black tree that rebalances on the way down (Guibas and Sedgewick): insert
+// splits every node with two red children before stepping below it, remove
+// pushes a red node ahead of the search, so either finishes at the bottom of a
+// single descent with nothing left to repair above. Subtree counts are adjusted
+// in the same descent, for a key that is new to insert and held once to remove.
+// Only when the descent ends up finding otherwise does it take the difference
+// back up the parent links; otherwise they are written, for the iterators, but
+// never read, which saves RBTree's lock() round trips on every step.
+template <typename T, typename Compare = std::less<T>, typename Node = RBTreeNode<T>, typename Allocator = std::allocator<Node>, typename Stats = NoTreeStats>
+class TopDownRBTree : public RBTree<T, Compare, Node, Allocator, Stats, TopDownRBTree<T, Compare, Node, Allocator, Stats>> {
+    using Base = BinarySearchTree<T, Compare, Node, Allocator, Stats, TopDownRBTree>;
+    using Base::root;
+    using Base::compare;
+    using Base::createNode;
+    using Base::stats;
+    using RBTree<T, Compare, Node, Allocator, Stats, TopDownRBTree>::isRed;
+
+   protected:
+    void link(const NodePtr<Node>& parent, const NodePtr<Node>& node, const NodePtr<Node>& replacement);
+    NodePtr<Node> rotateBelow(const NodePtr<Node>& parent, const NodePtr<Node>& node, size_t direction);
+    // From the root only: the recoloring is done on the way down.
+    template <typename Value>
+    NodePtr<Node> insertValue(Value&& value);
+    template <typename Key>
+    void removeKey(const Key& key);
+
+   public:
+    using typename Base::iterator;
+
+    TopDownRBTree() = default;
+    explicit TopDownRBTree(const Allocator& allocator) : RBTree<T, Compare, Node, Allocator, Stats, TopDownRBTree>(allocator) {}
+    template <typename InputIt>
+    TopDownRBTree(InputIt first, InputIt last) { this->assign_sorted(first, last); }
+
+    void insert(const T& value) { insertValue(value); }
+    void insert(T&& value) { insertValue(std::move(value)); }
+    // The hint is not used: the recoloring is done on the way down from the root.
+    iterator insert(iterator, const T& value) { return this->iteratorAt(insertValue(value)); }
+    iterator insert(iterator, T&& value) { return this->iteratorAt(insertValue(std::move(value))); }
+    void remove(const T& value) { removeKey(value); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    void remove(const Key& key) { removeKey(key); }
+};
+
+// Hangs replacement, which may be empty, from parent in place of node, or makes
+// it the root when parent is empty.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+void TopDownRBTree<T, Compare, Node, Allocator, Stats>::link(const NodePtr<Node>& parent, const NodePtr<Node>& node,
+                                                      const NodePtr<Node>& replacement) {
+    if (parent == nullptr)
+        root = replacement;
+    else
+        childOf(parent, parent->right == node) = replacement;
+    if (replacement)
+        replacement->parent = parent;
+}
+
+// Rotates node, a child of parent, down in the given direction and returns the
+// child that took its place. Unlike rotate(), the parent is passed in.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+NodePtr<Node> TopDownRBTree<T, Compare, Node, Allocator, Stats>::rotateBelow(const NodePtr<Node>& parent, const NodePtr<Node>& node,
+                                                                      size_t direction) {
+    stats.rotation();
+    NodePtr<Node> child = childOf(node, !direction);
+    childOf(node, !direction) = childOf(child, direction);
+    if (childOf(child, direction))
+        childOf(child, direction)->parent = node;
+    link(parent, node, child);
+    childOf(child, direction) = node;
+    node->parent = child;
+    node->update();
+    child->update();
+    return child;
+}
+
+// Every node is counted for the new key as the descent reaches it. A rotation
+// recounts the nodes it moves from their children; only the double one lifts
+// the current node above a child the descent has yet to pass, and so needs
+// the key added back. Should the key turn out to be there already, its node
+// and those above keep the extra occurrence in their sizes but give the extra
+// node back from their counts.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+template <typename Value>
+NodePtr<Node> TopDownRBTree<T, Compare, Node, Allocator, Stats>::insertValue(Value&& value) {
+    if (root == nullptr) {
+        root = createNode(std::forward<Value>(value));
+        root->color = Color::BLACK;
+        return root;
+    }
+
+    NodePtr<Node> great = nullptr, grandparent = nullptr, parent = nullptr, node = root, holder;
+    size_t direction = 0, last = 0;
+    bool created = false;
+    while (true) {
+        stats.visit();
+        if (node == nullptr) {
+            holder = node = createNode(std::forward<Value>(value));
+            childOf(parent, direction) = node;
+            node->parent = parent;
+            created = true;
+        } else {
+            ++(node->size);
+            ++(node->count);
+            if (isRed(node->left) && isRed(node->right)) {
+                node->color = Color::RED;
+                node->left->color = node->right->color = Color::BLACK;
+            }
+        }
+        // After a rotation great is stale for two steps, in which no red node
+        // can meet a red parent.
+        if (isRed(node) && isRed(parent)) {
+            NodePtr<Node> top;
+            if (node == childOf(parent, last))
+                top = rotateBelow(great, grandparent, !last);
+            else {
+                rotateBelow(grandparent, parent, last);
+                top = rotateBelow(great, grandparent, !last);
+                if (!created) {
+                    ++(top->size);
+                    ++(top->count);
+                }
+            }
+            top->color = Color::BLACK;
+            grandparent->color = Color::RED;
+        }
+        if (created)
+            break;
+        last = direction;
+        direction = compare(node->value, value);
+        if (!direction && !compare(value, node->value)) {
+            ++(node->repeat);
+            for (NodePtr<Node> above = node; above != nullptr; above = above->parent.lock())
+                --(above->count);
+            holder = node;
+            break;
+        }
+        great = grandparent;
+        grandparent = parent;
+        parent = node;
+        node = childOf(node, direction);
+    }
+    root->color = Color::BLACK;
+    return holder;
+}
+
+// The search runs past the key to its predecessor, the last node on its path,
+// which then takes the place of the removed node. Nodes are counted out as the
+// descent reaches them, one node and one occurrence each, which is right above
+// the removed node and, below it, as long as the predecessor is held once. A
+// rotation at the current node lifts its red child over it and recounts both
+// with the key still in; the others recount nodes from children the descent
+// has already passed. The descent cannot tell a key that is held more than
+// once, a missing one or a predecessor held more than once before it gets to
+// the bottom, and then corrects the nodes above through their parent links.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+template <typename Key>
+void TopDownRBTree<T, Compare, Node, Allocator, Stats>::removeKey(const Key& key) {
+    NodePtr<Node> grandparent = nullptr, parent = nullptr, node = nullptr, next = root;
+    NodePtr<Node> target = nullptr, targetParent = nullptr;
+    size_t direction = 1;
+    while (next) {
+        stats.visit();
+        size_t last = direction;
+        grandparent = parent;
+        parent = node;
+        node = next;
+        direction = compare(node->value, key);
+        --(node->size);
+        --(node->count);
+        if (target == nullptr && !direction && !compare(key, node->value)) {
+            if (node->repeat > 1) {
+                --(node->repeat);
+                for (NodePtr<Node> above = node; above != nullptr; above = above->parent.lock())
+                    ++(above->count);
+                root->color = Color::BLACK;
+                return;
+            }
+            target = node;
+            targetParent = parent;
+        }
+
+        if (!isRed(node) && !isRed(childOf(node, direction))) {
+            if (isRed(childOf(node, !direction))) {
+                NodePtr<Node> top = rotateBelow(parent, node, direction);
+                top->color = Color::BLACK;
+                node->color = Color::RED;
+                --(node->size);
+                --(node->count);
+                --(top->size);
+                --(top->count);
+                if (node == target)
+                    targetParent = top;
+                parent = top;
+            } else if (parent) {
+                NodePtr<Node> sibling = childOf(parent, !last);
+                if (sibling && !isRed(sibling->left) && !isRed(sibling->right)) {
+                    parent->color = Color::BLACK;
+                    sibling->color = node->color = Color::RED;
+                } else if (sibling) {
+                    if (isRed(childOf(sibling, last)))
+                        rotateBelow(parent, sibling, !last);
+                    NodePtr<Node> top = rotateBelow(grandparent, parent, last);
+                    node->color = top->color = Color::RED;
+                    top->left->color = top->right->color = Color::BLACK;
+                    if (parent == target)
+                        targetParent = top;
+                }
+            }
+        }
+        next = childOf(node, direction);
+    }
+
+    if (target == nullptr) {
+        for (NodePtr<Node> above = node; above != nullptr; above = above->parent.lock()) {
+            ++(above->size);
+            ++(above->count);
+        }
+        if (root)
+            root->color = Color::BLACK;
+        return;
+    }
+    // node has no right child: it is the target itself when the target has no
+    // left subtree, and the predecessor otherwise. The target, which stood for
+    // the predecessor below it, counted it once; the nodes in between lose all
+    // of its occurrences.
+    if (node == target)
+        link(parent, node, node->left ? node->left : node->right);
+    else {
+        if (node->repeat > 1)
+            for (NodePtr<Node> above = parent; above != target; above = above->parent.lock())
+                above->size -= node->repeat - 1;
+        link(parent, node, node->left);
+        node->left = target->left;
+        node->right = target->right;
+        if (node->left)
+            node->left->parent = node;
+        if (node->right)
+            node->right->parent = node;
+        node->color = target->color;
+        node->size = target->size;
+        node->count = target->count;
+        link(targetParent, target, node);
+    }
+    this->destroyNode(target);
+    if (root)
+        root->color = Color::BLACK;
 }
-#endif  // RBTREE_HPP
\ No newline at end of file
+
+#endif  // RBTREE_HPP
@@ -1,109 +1,212 @@
 #ifndef SCAPEGOAT_TREE_HPP
 #define SCAPEGOAT_TREE_HPP
 
+#include <cassert>
+#include <cmath>
+
 #include "binary_search_tree.hpp"
 
-template <typename T, typename Compare = std::less<T>, typename Node = BinaryNode<T>>
-class ScapegoatTree : public BinarySearchTree<T, Compare, Node> {
-    using BinarySearchTree<T, Compare, Node>::root;
-    using BinarySearchTree<T, Compare, Node>::compare;
+// A scapegoat tree keeps every node within log_{1/alpha}(n) of the root with no
+// balance data in the nodes. An insertion that lands deeper than that rebuilds
+// the lowest ancestor whose larger subtree holds more than alpha of its nodes,
+// and once deletions have shrunk the tree below alpha times the largest node
+// count it had since the last full rebuild, the whole tree is rebuilt. Lower
+// alphas keep the tree shallower at the cost of more frequent rebuilds.
+template <typename T, typename Compare = std::less<T>, typename Node = BinaryNode<T>, typename Allocator = std::allocator<Node>, typename Stats = NoTreeStats>
+class ScapegoatTree : public BinarySearchTree<T, Compare, Node, Allocator, Stats, ScapegoatTree<T, Compare, Node, Allocator, Stats>> {
+    using Base = BinarySearchTree<T, Compare, Node, Allocator, Stats, ScapegoatTree>;
+    using Base::root;
+    using Base::compare;
+    using Base::createNode;
+    using Base::stats;
 
    protected:
     double alpha = 0.75;
-    bool isUnbalanced(std::shared_ptr<Node>& node);
-    std::shared_ptr<Node> rebuild(std::shared_ptr<Node>& node);
-    void maintain(const T& value);
+    // -log(alpha), the divisor that turns log(n) into the depth bound.
+    double logInverseAlpha = -std::log(0.75);
+    // Largest number of nodes since the tree was last rebuilt as a whole.
+    size_t maxCount = 0;
+
+    bool isUnbalanced(const NodePtr<Node>& node) const;
+    bool tooDeep(size_t depth, size_t count) const { return depth > std::log(static_cast<double>(count)) / logInverseAlpha; }
+    // Rebuilds the subtree of node into a perfectly balanced one in its place.
+    void rebuild(NodePtr<Node> node);
+    template <typename Value>
+    NodePtr<Node> insertValue(Value&& value) { return insertValue(std::forward<Value>(value), root); }
+    template <typename Value>
+    NodePtr<Node> insertValue(Value&& value, NodePtr<Node> from);
+    template <typename Key>
+    void removeKey(const Key& key);
+    // Bulk loads start the count over from the nodes they leave.
+    template <typename InputIt>
+    void assignSorted(InputIt first, InputIt last, bool distinct) {
+        Base::assignSorted(first, last, distinct);
+        maxCount = this->size();
+    }
 
    public:
+    using typename Base::iterator;
+
     ScapegoatTree() = default;
+    explicit ScapegoatTree(const Allocator& allocator) : Base(allocator) {}
+    explicit ScapegoatTree(double alpha, const Allocator& allocator = Allocator()) : Base(allocator) { set_alpha(alpha); }
+    template <typename InputIt>
+    ScapegoatTree(InputIt first, InputIt last) { this->assign_sorted(first, last); }
     ScapegoatTree(const ScapegoatTree&) = delete;
-    ScapegoatTree(ScapegoatTree&&) = default;
+    ScapegoatTree(ScapegoatTree&& other) noexcept;
     ScapegoatTree& operator=(const ScapegoatTree&) = delete;
-    ScapegoatTree& operator=(ScapegoatTree&&) = default;
+    ScapegoatTree& operator=(ScapegoatTree&& other) noexcept;
     ~ScapegoatTree() = default;
 
-    void insert(const T& value) override;
+    void clear() noexcept {
+        Base::clear();
+        maxCount = 0;
+    }
+    template <typename InputIt>
+    void assign_sorted(InputIt first, InputIt last) { assignSorted(first, last, false); }
+
+    double get_alpha() const noexcept { return alpha; }
+    // Takes effect from the next update on; alpha must lie in [0.5, 1).
+    void set_alpha(double alpha) {
+        assert(alpha >= 0.5 && alpha < 1);
+        this->alpha = alpha;
+        logInverseAlpha = -std::log(alpha);
+    }
+
+    void insert(const T& value) { insertValue(value); }
+    void insert(T&& value) { insertValue(std::move(value)); }
+    iterator insert(iterator hint, const T& value) { return this->iteratorAt(insertValue(value, this->fingerNode(hint, value))); }
+    iterator insert(iterator hint, T&& value) {
+        NodePtr<Node> from = this->fingerNode(hint, value);
+        return this->iteratorAt(insertValue(std::move(value), from));
+    }
+    void remove(const T& value) { removeKey(value); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    void remove(const Key& key) { removeKey(key); }
 };
 
-template <typename T, typename Compare, typename Node>
-bool ScapegoatTree<T, Compare, Node>::isUnbalanced(std::shared_ptr<Node>& node) {
-    if (node == nullptr)
-        return true;
-    size_t size = node->count;
+// The tree taken over counts as just rebuilt, and the one left empty starts over.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+ScapegoatTree<T, Compare, Node, Allocator, Stats>::ScapegoatTree(ScapegoatTree&& other) noexcept
+    : Base(std::move(other)), alpha(other.alpha), logInverseAlpha(other.logInverseAlpha), maxCount(this->size()) {
+    other.maxCount = 0;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+ScapegoatTree<T, Compare, Node, Allocator, Stats>& ScapegoatTree<T, Compare, Node, Allocator, Stats>::operator=(ScapegoatTree&& other) noexcept {
+    if (this != &other) {
+        Base::operator=(std::move(other));
+        alpha = other.alpha;
+        logInverseAlpha = other.logInverseAlpha;
+        maxCount = this->size();
+        other.maxCount = 0;
+    }
+    return *this;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+bool ScapegoatTree<T, Compare, Node, Allocator, Stats>::isUnbalanced(const NodePtr<Node>& node) const {
     size_t leftSize = node->left ? node->left->count : 0;
     size_t rightSize = node->right ? node->right->count : 0;
-    // std::cout << "Left size: " << leftSize << std::endl;
-    // std::cout << "Right size: " << rightSize << std::endl;
-    // std::cout << "Alpha * size: " << alpha * size << std::endl;
-    return std::max(leftSize, rightSize) > alpha * size;
+    return std::max(leftSize, rightSize) > alpha * node->count;
 }
 
-template <typename T, typename Compare, typename Node>
-std::shared_ptr<Node> ScapegoatTree<T, Compare, Node>::rebuild(std::shared_ptr<Node>& node) {
-    // std::cout << "Rebuilding..." << std::endl;
-    // std::cout << "Node: " << node->value << std::endl;
-    std::vector<std::shared_ptr<Node>> nodes;
-    std::function<void(const std::shared_ptr<Node>&)> collect = [&](const std::shared_ptr<Node>& node) -> void { nodes.push_back(node); };
-    inorderTraversal(node, collect);
-    std::function<std::shared_ptr<Node>(int, int)> build = [&](int left, int right) {
-        if (left > right)
-            return std::shared_ptr<Node>(nullptr);
-        int mid = (left + right) >> 1;
-        nodes[mid]->left = build(left, mid - 1);
-        nodes[mid]->right = build(mid + 1, right);
-        if (nodes[mid]->left)
-            nodes[mid]->left->parent = nodes[mid];
-        if (nodes[mid]->right)
-            nodes[mid]->right->parent = nodes[mid];
-        nodes[mid]->update();
-        return nodes[mid];
-    };
-    return build(0, nodes.size() - 1);
-}
+// The subtree is first flattened into a vine through the right links by
+// rotating every left child up, as in the Day-Stout-Warren algorithm, and then
+// relinked by buildBalanced. Only links change: no node is allocated or
+// copied, and no buffer is needed.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+void ScapegoatTree<T, Compare, Node, Allocator, Stats>::rebuild(NodePtr<Node> node) {
+    NodePtr<Node> parent = node->parent.lock();
+    size_t direction = parent && parent->right == node;
+    size_t n = node->count;
+    stats.rebuild(n);
 
-template <typename T, typename Compare, typename Node>
-void ScapegoatTree<T, Compare, Node>::maintain(const T& value) {
-    std::shared_ptr<Node> current = root;
-    while (current) {
-        if (isUnbalanced(current)) {
-            std::shared_ptr<Node> parent = current->parent.lock();
-            current = rebuild(current);
-            current->parent = parent;
-            if (parent == nullptr)
-                root = current;
+    NodePtr<Node> head = nullptr, tail = nullptr;
+    for (NodePtr<Node> current = std::move(node); current;) {
+        if (current->left) {
+            NodePtr<Node> left = current->left;
+            current->left = left->right;
+            left->right = current;
+            current = left;
+        } else {
+            if (tail)
+                tail->right = current;
             else
-                parent->children[compare(parent->value, current->value)] = current;
-            break;
+                head = current;
+            tail = current;
+            current = current->right;
         }
-        current = current->children[compare(current->value, value)];
     }
+
+    NodePtr<Node> rebuilt = this->buildBalanced(head, n);
+    rebuilt->parent = parent;
+    if (parent == nullptr)
+        root = rebuilt;
+    else
+        childOf(parent, direction) = rebuilt;
 }
 
-template <typename T, typename Compare, typename Node>
-void ScapegoatTree<T, Compare, Node>::insert(const T& value) {
+// The depth of a new node is known at the end of a descent from the root, and
+// only when it exceeds the bound are the ancestors tested for balance, while
+// their counts are updated on the way back up. A descent from a finger starts
+// at an unknown depth, so then every ancestor is tested and the depth is only
+// known once the root is reached.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+template <typename Value>
+NodePtr<Node> ScapegoatTree<T, Compare, Node, Allocator, Stats>::insertValue(Value&& value, NodePtr<Node> from) {
     if (root == nullptr) {
-        root = std::make_shared<Node>(value);
-        return;
+        maxCount = std::max<size_t>(maxCount, 1);
+        return root = createNode(std::forward<Value>(value));
     }
-    std::shared_ptr<Node> current = root;
+    bool fromRoot = from == root;
+    // The key is looked up through the node that holds it once the descent is
+    // over, since value may have been moved into a new one.
+    NodePtr<Node> current = std::move(from), holder;
+    size_t depth = 0;
     while (true) {
+        stats.visit();
         if (!compare(value, current->value) && !compare(current->value, value)) {
             ++(current->repeat);
+            holder = current;
             break;
         }
+        ++depth;
         size_t dir = compare(current->value, value);
-        if (current->children[dir] == nullptr) {
-            current->children[dir] = std::make_shared<Node>(value);
-            current->children[dir]->parent = current;
+        if (childOf(current, dir) == nullptr) {
+            childOf(current, dir) = holder = createNode(std::forward<Value>(value));
+            holder->parent = current;
             break;
         }
-        current = current->children[dir];
+        current = childOf(current, dir);
     }
-    while (current) {
+
+    bool added = holder != current;
+    size_t count = root->count + added;
+    maxCount = std::max(maxCount, count);
+    bool check = added && (!fromRoot || tooDeep(depth, count));
+    NodePtr<Node> scapegoat = nullptr;
+    for (depth = 0; current; current = current->parent.lock(), ++depth) {
         current->update();
-        current = current->parent.lock();
+        if (check && scapegoat == nullptr && isUnbalanced(current))
+            scapegoat = current;
+    }
+    // depth is now that of the new node, whichever way it was reached.
+    if (scapegoat && tooDeep(depth, count))
+        rebuild(scapegoat);
+    return holder;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+template <typename Key>
+void ScapegoatTree<T, Compare, Node, Allocator, Stats>::removeKey(const Key& key) {
+    Base::removeKey(key);
+    if (root == nullptr)
+        maxCount = 0;
+    else if (root->count < alpha * maxCount) {
+        rebuild(root);
+        maxCount = root->count;
     }
-    maintain(value);
 }
 
-#endif  // SCAPEGOAT_TREE_HPP
\ No newline at end of file
+#endif  // SCAPEGOAT_TREE_HPP
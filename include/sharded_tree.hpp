@@ -0,0 +1,373 @@
+#ifndef SHARDED_TREE_HPP
+#define SHARDED_TREE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+
+// Ordered multiset for concurrent writers that splits the key space into
+// contiguous ranges, each held by its own Tree (AVLTree, Treap, AATree, ...)
+// behind its own mutex, so writers to different ranges never contend. Shard i
+// holds the keys in [bounds[i - 1], bounds[i]).
+//
+// Every shard publishes its number of distinct keys, which is all rank, select
+// and size need to cross shards. These global queries lock one shard at a time:
+// they are exact when no writer runs, and otherwise reflect each shard at the
+// moment it was visited.
+//
+// A shard that grows past `skew` times its fair share of the keys is split in
+// two, after which the two adjacent shards with the fewest keys between them
+// are merged, keeping the number of shards at `shards`. Both rebuild from the
+// sorted keys in O(n) through assign_sorted, under an exclusive lock on the
+// layout; every other operation holds it shared. Compare has to order the keys
+// as the shards do, so it defaults to their key_compare.
+template <typename Tree, typename Compare = typename Tree::key_compare>
+class ShardedTree {
+   public:
+    using value_type = typename Tree::iterator::value_type;
+
+   private:
+    using T = value_type;
+
+    struct Shard {
+        std::mutex lock;
+        Tree tree;
+        std::atomic<size_t> count{0};
+    };
+
+    // Shards smaller than this are never split, whatever the skew.
+    static constexpr size_t minSplit = 4096;
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::vector<T> bounds;
+    mutable std::shared_mutex layout;
+    std::atomic<size_t> count{0};
+    size_t targetShards;
+    size_t skew;
+    Compare compare = Compare();
+
+    template <typename Key>
+    size_t shardOf(const Key& key) const;
+    size_t splitLimit() const noexcept;
+    template <typename Key, typename Operation>
+    void write(const Key& key, Operation&& operation);
+    template <typename Value>
+    void insertValue(Value&& value);
+    template <typename Key>
+    void removeKey(const Key& key);
+    template <typename Key>
+    bool containsKey(const Key& key) const;
+    template <typename Key>
+    size_t rankKey(const Key& key) const;
+    static void append(Shard& shard, std::vector<T>& keys);
+    void rebuild(Shard& shard, typename std::vector<T>::const_iterator first, typename std::vector<T>::const_iterator last);
+    bool split(size_t index);
+    void mergeSmallest();
+
+   public:
+    explicit ShardedTree(size_t shards = 16, size_t skew = 2);
+    // Starts with the shards delimited by the given sorted, distinct bounds,
+    // for a key space known in advance.
+    explicit ShardedTree(std::vector<T> bounds, size_t skew = 2);
+    // Spreads the sorted range evenly over the shards.
+    template <typename InputIt>
+    ShardedTree(InputIt first, InputIt last, size_t shards = 16, size_t skew = 2);
+
+    size_t size() const noexcept { return count.load(std::memory_order_relaxed); }
+    bool empty() const noexcept { return size() == 0; }
+    size_t shard_count() const;
+    void clear();
+    void check() const;
+
+    bool contains(const T& value) const { return containsKey(value); }
+    void insert(const T& value) { insertValue(value); }
+    void insert(T&& value) { insertValue(std::move(value)); }
+    void remove(const T& value) { removeKey(value); }
+    size_t rank(const T& value) const { return rankKey(value); }
+    T select(size_t rank) const;
+    T min() const;
+    T max() const;
+    std::vector<T> nsmallest(size_t n) const;
+
+    template <typename... Args>
+    void emplace(Args&&... args) { insert(T(std::forward<Args>(args)...)); }
+
+    // With a transparent comparator, here and in Tree, these take any key it
+    // orders against T.
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    bool contains(const Key& key) const { return containsKey(key); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    void remove(const Key& key) { removeKey(key); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    size_t rank(const Key& key) const { return rankKey(key); }
+
+    // Splits shards over the limit and merges back down to the target count.
+    // Writers call it when they push a shard over the limit.
+    void rebalance();
+};
+
+template <typename Tree, typename Compare>
+ShardedTree<Tree, Compare>::ShardedTree(size_t shards, size_t skew) : targetShards(std::max<size_t>(shards, 1)), skew(std::max<size_t>(skew, 2)) {
+    this->shards.push_back(std::make_unique<Shard>());
+}
+
+template <typename Tree, typename Compare>
+ShardedTree<Tree, Compare>::ShardedTree(std::vector<T> bounds, size_t skew)
+    : bounds(std::move(bounds)), targetShards(this->bounds.size() + 1), skew(std::max<size_t>(skew, 2)) {
+    assert(std::adjacent_find(this->bounds.begin(), this->bounds.end(), [&](const T& a, const T& b) { return !compare(a, b); }) == this->bounds.end());
+    for (size_t i = 0; i < targetShards; ++i)
+        shards.push_back(std::make_unique<Shard>());
+}
+
+template <typename Tree, typename Compare>
+template <typename InputIt>
+ShardedTree<Tree, Compare>::ShardedTree(InputIt first, InputIt last, size_t shards, size_t skew)
+    : ShardedTree(shards, skew) {
+    std::vector<T> keys(first, last);
+    size_t distinct = 0;
+    for (size_t i = 0; i < keys.size(); ++i)
+        distinct += i == 0 || compare(keys[i - 1], keys[i]);
+    // Cut before the first repeat of every targetShards-th part of the keys.
+    std::vector<size_t> cuts = {0};
+    size_t seen = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (i > 0 && !compare(keys[i - 1], keys[i]))
+            continue;
+        if (seen > 0 && seen * targetShards >= distinct * cuts.size() && cuts.size() < targetShards)
+            cuts.push_back(i);
+        ++seen;
+    }
+    cuts.push_back(keys.size());
+    this->shards.clear();
+    for (size_t i = 0; i + 1 < cuts.size(); ++i) {
+        this->shards.push_back(std::make_unique<Shard>());
+        rebuild(*this->shards.back(), keys.begin() + cuts[i], keys.begin() + cuts[i + 1]);
+        if (i > 0)
+            bounds.push_back(keys[cuts[i]]);
+    }
+    if (this->shards.empty())
+        this->shards.push_back(std::make_unique<Shard>());
+    count.store(distinct, std::memory_order_relaxed);
+}
+
+template <typename Tree, typename Compare>
+template <typename Key>
+size_t ShardedTree<Tree, Compare>::shardOf(const Key& key) const {
+    return std::upper_bound(bounds.begin(), bounds.end(), key, compare) - bounds.begin();
+}
+
+template <typename Tree, typename Compare>
+size_t ShardedTree<Tree, Compare>::splitLimit() const noexcept {
+    return std::max(minSplit, skew * size() / targetShards);
+}
+
+template <typename Tree, typename Compare>
+size_t ShardedTree<Tree, Compare>::shard_count() const {
+    std::shared_lock<std::shared_mutex> guard(layout);
+    return shards.size();
+}
+
+// Applies the operation to the tree of the shard owning key and publishes the
+// change in its number of keys.
+template <typename Tree, typename Compare>
+template <typename Key, typename Operation>
+void ShardedTree<Tree, Compare>::write(const Key& key, Operation&& operation) {
+    bool overflow;
+    {
+        std::shared_lock<std::shared_mutex> guard(layout);
+        Shard& shard = *shards[shardOf(key)];
+        std::lock_guard<std::mutex> lock(shard.lock);
+        size_t before = shard.tree.size();
+        operation(shard.tree);
+        size_t after = shard.tree.size();
+        shard.count.store(after, std::memory_order_relaxed);
+        if (after > before)
+            count.fetch_add(after - before, std::memory_order_relaxed);
+        else
+            count.fetch_sub(before - after, std::memory_order_relaxed);
+        overflow = after > splitLimit();
+    }
+    if (overflow)
+        rebalance();
+}
+
+template <typename Tree, typename Compare>
+template <typename Value>
+void ShardedTree<Tree, Compare>::insertValue(Value&& value) {
+    write(value, [&](Tree& tree) { tree.insert(std::forward<Value>(value)); });
+}
+
+template <typename Tree, typename Compare>
+template <typename Key>
+void ShardedTree<Tree, Compare>::removeKey(const Key& key) {
+    write(key, [&](Tree& tree) { tree.remove(key); });
+}
+
+template <typename Tree, typename Compare>
+template <typename Key>
+bool ShardedTree<Tree, Compare>::containsKey(const Key& key) const {
+    std::shared_lock<std::shared_mutex> guard(layout);
+    Shard& shard = *shards[shardOf(key)];
+    std::lock_guard<std::mutex> lock(shard.lock);
+    return shard.tree.contains(key);
+}
+
+template <typename Tree, typename Compare>
+template <typename Key>
+size_t ShardedTree<Tree, Compare>::rankKey(const Key& key) const {
+    std::shared_lock<std::shared_mutex> guard(layout);
+    size_t index = shardOf(key), result = 0;
+    for (size_t i = 0; i < index; ++i)
+        result += shards[i]->count.load(std::memory_order_relaxed);
+    Shard& shard = *shards[index];
+    std::lock_guard<std::mutex> lock(shard.lock);
+    return result + shard.tree.rank(key);
+}
+
+template <typename Tree, typename Compare>
+typename ShardedTree<Tree, Compare>::value_type ShardedTree<Tree, Compare>::select(size_t rank) const {
+    std::shared_lock<std::shared_mutex> guard(layout);
+    if (rank == 0)
+        return T();
+    for (const std::unique_ptr<Shard>& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->lock);
+        size_t size = shard->tree.size();
+        if (rank <= size)
+            return shard->tree.select(rank);
+        rank -= size;
+    }
+    return T();
+}
+
+template <typename Tree, typename Compare>
+typename ShardedTree<Tree, Compare>::value_type ShardedTree<Tree, Compare>::min() const {
+    std::shared_lock<std::shared_mutex> guard(layout);
+    for (const std::unique_ptr<Shard>& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->lock);
+        if (!shard->tree.empty())
+            return shard->tree.min();
+    }
+    return T();
+}
+
+template <typename Tree, typename Compare>
+typename ShardedTree<Tree, Compare>::value_type ShardedTree<Tree, Compare>::max() const {
+    std::shared_lock<std::shared_mutex> guard(layout);
+    for (auto it = shards.rbegin(); it != shards.rend(); ++it) {
+        std::lock_guard<std::mutex> lock((*it)->lock);
+        if (!(*it)->tree.empty())
+            return (*it)->tree.max();
+    }
+    return T();
+}
+
+template <typename Tree, typename Compare>
+std::vector<typename ShardedTree<Tree, Compare>::value_type> ShardedTree<Tree, Compare>::nsmallest(size_t n) const {
+    std::shared_lock<std::shared_mutex> guard(layout);
+    std::vector<T> result;
+    for (const std::unique_ptr<Shard>& shard : shards) {
+        if (result.size() >= n)
+            break;
+        std::lock_guard<std::mutex> lock(shard->lock);
+        std::vector<T> part = shard->tree.nsmallest(n - result.size());
+        std::move(part.begin(), part.end(), std::back_inserter(result));
+    }
+    return result;
+}
+
+template <typename Tree, typename Compare>
+void ShardedTree<Tree, Compare>::clear() {
+    std::unique_lock<std::shared_mutex> guard(layout);
+    for (std::unique_ptr<Shard>& shard : shards) {
+        shard->tree.clear();
+        shard->count.store(0, std::memory_order_relaxed);
+    }
+    count.store(0, std::memory_order_relaxed);
+}
+
+template <typename Tree, typename Compare>
+void ShardedTree<Tree, Compare>::check() const {
+    std::unique_lock<std::shared_mutex> guard(layout);
+    assert(bounds.size() + 1 == shards.size());
+    size_t total = 0;
+    for (size_t i = 0; i < shards.size(); ++i) {
+        Tree& tree = shards[i]->tree;
+        tree.check();
+        assert(tree.size() == shards[i]->count.load(std::memory_order_relaxed));
+        if (!tree.empty() && i > 0)
+            assert(!compare(tree.min(), bounds[i - 1]));
+        if (!tree.empty() && i < bounds.size())
+            assert(compare(tree.max(), bounds[i]));
+        total += tree.size();
+    }
+    assert(total == size());
+}
+
+// Appends the keys of the shard in order, each as often as it was inserted.
+template <typename Tree, typename Compare>
+void ShardedTree<Tree, Compare>::append(Shard& shard, std::vector<T>& keys) {
+    for (auto it = shard.tree.begin(); it != shard.tree.end(); ++it)
+        keys.insert(keys.end(), it.repeat(), *it);
+}
+
+template <typename Tree, typename Compare>
+void ShardedTree<Tree, Compare>::rebuild(Shard& shard, typename std::vector<T>::const_iterator first,
+                                         typename std::vector<T>::const_iterator last) {
+    shard.tree.assign_sorted(first, last);
+    shard.count.store(shard.tree.size(), std::memory_order_relaxed);
+}
+
+// Cuts the shard at its median distinct key. Returns false, leaving the shard
+// as it was, if either half would have been empty, which only a Compare at odds
+// with the tree's order can cause.
+template <typename Tree, typename Compare>
+bool ShardedTree<Tree, Compare>::split(size_t index) {
+    Shard& shard = *shards[index];
+    std::vector<T> keys;
+    append(shard, keys);
+    T median = shard.tree.select(shard.tree.size() / 2 + 1);
+    auto cut = std::lower_bound(keys.begin(), keys.end(), median, compare);
+    if (cut == keys.begin() || cut == keys.end())
+        return false;
+    auto right = std::make_unique<Shard>();
+    rebuild(*right, cut, keys.cend());
+    rebuild(shard, keys.cbegin(), cut);
+    shards.insert(shards.begin() + index + 1, std::move(right));
+    bounds.insert(bounds.begin() + index, median);
+    return true;
+}
+
+template <typename Tree, typename Compare>
+void ShardedTree<Tree, Compare>::mergeSmallest() {
+    size_t best = 0;
+    for (size_t i = 1; i + 1 < shards.size(); ++i)
+        if (shards[i]->count + shards[i + 1]->count < shards[best]->count + shards[best + 1]->count)
+            best = i;
+    std::vector<T> keys;
+    append(*shards[best], keys);
+    append(*shards[best + 1], keys);
+    rebuild(*shards[best], keys.cbegin(), keys.cend());
+    shards.erase(shards.begin() + best + 1);
+    bounds.erase(bounds.begin() + best);
+}
+
+template <typename Tree, typename Compare>
+void ShardedTree<Tree, Compare>::rebalance() {
+    std::unique_lock<std::shared_mutex> guard(layout);
+    size_t limit = splitLimit();
+    for (size_t i = 0; i < shards.size(); ++i)
+        // Each half may still be over the limit after a burst of skewed writes.
+        if (shards[i]->count.load(std::memory_order_relaxed) > limit && split(i))
+            --i;
+    while (shards.size() > targetShards)
+        mergeSmallest();
+}
+
+#endif  // SHARDED_TREE_HPP
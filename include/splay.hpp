@@ -3,142 +3,425 @@
 
 #include "binary_search_tree.hpp"
 
-template <typename T, typename Compare = std::less<T>, typename Node = BinaryNode<T>>
-class Splay : public BinarySearchTree<T, Compare, Node> {
-    using BinarySearchTree<T, Compare, Node>::root;
-    using BinarySearchTree<T, Compare, Node>::compare;
-    using BinarySearchTree<T, Compare, Node>::rotate;
+// Splaying policies: when a lookup (contains, rank, select) restructures the
+// tree. insert and remove always splay the key to the root, which is how they
+// find their place and join the two sides.
+//
+// FullSplay splays every lookup. SemiSplay only halves the search path: each
+// pair of consecutive steps in the same direction is rotated once, which moves
+// the hot nodes up over the accesses at a fraction of the rotations, but leaves
+// the node where it ends up instead of at the root. PeriodicSplay splays every
+// K-th lookup and leaves the others as plain descents. DeepSplay descends
+// without restructuring and then splays only the nodes it found deeper than
+// Slack times log2 of the size, so that a balanced enough tree is left alone
+// while long paths are still paid off.
+struct FullSplay {
+    static constexpr bool semi = false;
 
-   private:
-    void splay(const std::shared_ptr<Node>& node);
+    bool splayFirst() noexcept { return true; }
+    bool splayFound(size_t, size_t) noexcept { return false; }
+};
+
+struct SemiSplay {
+    static constexpr bool semi = true;
+
+    bool splayFirst() noexcept { return false; }
+    bool splayFound(size_t, size_t) noexcept { return false; }
+};
+
+template <size_t K>
+struct PeriodicSplay {
+    static_assert(K > 0, "PeriodicSplay needs a positive period");
+    static constexpr bool semi = false;
+
+    size_t lookups = 0;
+
+    bool splayFirst() noexcept {
+        if (++lookups < K)
+            return false;
+        lookups = 0;
+        return true;
+    }
+    bool splayFound(size_t, size_t) noexcept { return false; }
+};
+
+template <size_t Slack = 2>
+struct DeepSplay {
+    static constexpr bool semi = false;
+
+    bool splayFirst() noexcept { return false; }
+    bool splayFound(size_t depth, size_t nodes) noexcept {
+        size_t bits = 0;
+        for (; nodes != 0; nodes >>= 1)
+            ++bits;
+        return depth > Slack * bits;
+    }
+};
+
+// Splaying is top-down: the search path is split into the trees left and right
+// of the key as it is walked and reassembled under the node it ends at, in one
+// pass that never reads the parent links (it still sets them for iterators).
+template <typename T, typename Compare = std::less<T>, typename Node = BinaryNode<T>, typename Allocator = std::allocator<Node>, typename Stats = NoTreeStats, typename Policy = FullSplay>
+class Splay : public BinarySearchTree<T, Compare, Node, Allocator, Stats, Splay<T, Compare, Node, Allocator, Stats, Policy>> {
+    using Base = BinarySearchTree<T, Compare, Node, Allocator, Stats, Splay>;
+    using Base::root;
+    using Base::compare;
+    using Base::createNode;
+    using Base::destroyNode;
+    using Base::stats;
+
+    Policy policy = Policy();
+
+   protected:
+    // Locators steer a descent: given the next node on it, they return 0 if it
+    // is the one sought, and otherwise -1 or 1 for the side to go on. Every node
+    // on the path is shown to them once, in order, whatever rotations happen.
+    template <typename Key>
+    struct KeyLocator {
+        const Key& key;
+        const StatsCompare<Compare, Stats>& compare;
+        // Distinct keys up to key among the nodes passed, which is its rank
+        // once the descent is over.
+        size_t rank = 0;
+
+        int operator()(const NodePtr<Node>& node) {
+            if (compare(key, node->value))
+                return -1;
+            rank += (node->left ? node->left->count : 0) + 1;
+            return compare(node->value, key) ? 1 : 0;
+        }
+    };
+
+    struct PositionLocator {
+        size_t rank;
+
+        int operator()(const NodePtr<Node>& node) {
+            size_t left = node->left ? node->left->count : 0;
+            if (rank <= left)
+                return -1;
+            if (rank == left + 1)
+                return 0;
+            rank -= left + 1;
+            return 1;
+        }
+    };
+
+    struct MaximumLocator {
+        int operator()(const NodePtr<Node>&) { return 1; }
+    };
+
+    // Splays the node locate leads to, or the last one on the way, to the top
+    // of the non-empty subtree, and returns whether locate found it.
+    template <typename Locate>
+    bool splay(NodePtr<Node>& subtree, Locate&& locate);
+    template <typename Locate>
+    NodePtr<Node> semiSplay(Locate& locate);
+    // Finds the node locate leads to, restructuring as the policy says.
+    template <typename Locate>
+    NodePtr<Node> access(Locate& locate);
+    template <typename Key>
+    bool containsKey(const Key& key);
+    // From the root only; the key ends up at the root.
+    template <typename Value>
+    NodePtr<Node> insertValue(Value&& value);
+    template <typename Key>
+    void removeKey(const Key& key);
+    template <typename Key>
+    size_t rankKey(const Key& key);
 
    public:
+    using typename Base::iterator;
+
     Splay() = default;
+    explicit Splay(const Allocator& allocator) : Base(allocator) {}
+    template <typename InputIt>
+    Splay(InputIt first, InputIt last) { this->assign_sorted(first, last); }
     Splay(const Splay&) = delete;
     Splay(Splay&&) = default;
     Splay& operator=(const Splay&) = delete;
     Splay& operator=(Splay&&) = default;
     ~Splay() = default;
 
-    bool contains(const T& value) override;
-    void insert(const T& value) override;
-    void remove(const T& value) override;
-    size_t rank(const T& value) override;
-    T select(size_t rank) override;
+    bool contains(const T& value) { return containsKey(value); }
+    void insert(const T& value) { insertValue(value); }
+    void insert(T&& value) { insertValue(std::move(value)); }
+    // The hint is not used: splaying already makes accesses near the last one cheap.
+    iterator insert(iterator, const T& value) { return this->iteratorAt(insertValue(value)); }
+    iterator insert(iterator, T&& value) { return this->iteratorAt(insertValue(std::move(value))); }
+    void remove(const T& value) { removeKey(value); }
+    size_t rank(const T& value) { return rankKey(value); }
+    T select(size_t rank);
+
+    // Lookups splay here as well, so they replace the base class's const ones.
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    bool contains(const Key& key) { return containsKey(key); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    void remove(const Key& key) { removeKey(key); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    size_t rank(const Key& key) { return rankKey(key); }
 };
 
-template <typename T, typename Compare, typename Node>
-void Splay<T, Compare, Node>::splay(const std::shared_ptr<Node>& node) {
-    std::shared_ptr<Node> current;
-    for (current = node; current->parent.lock() != nullptr; rotate(current->parent.lock(), getDirection(current) ^ 1))
-        if (current->parent.lock()->parent.lock())
-            rotate(getDirection(current) == getDirection(current->parent.lock()) ? current->parent.lock()->parent.lock() : current->parent.lock(), getDirection(current) ^ 1);
-    root = current;
-}
+// Nodes passed on the way go to the left tree if the key is to their right and
+// to the right tree otherwise, each hung below the last one there, with a
+// rotation first when two steps go the same way. The subtree sizes along the
+// inner spines of the two trees only settle once the path is over; they are
+// set from the running totals on the way back down the spines.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Policy>
+template <typename Locate>
+bool Splay<T, Compare, Node, Allocator, Stats, Policy>::splay(NodePtr<Node>& subtree, Locate&& locate) {
+    NodePtr<Node> node = subtree;
+    // sides[0] collects the nodes left of the key, sides[1] those right of it;
+    // heads are their roots and tails the nodes last hung into them.
+    NodePtr<Node> heads[2] = {nullptr, nullptr}, tails[2] = {nullptr, nullptr};
+    size_t counts[2] = {0, 0}, sizes[2] = {0, 0};
+    size_t depth = 0;
+
+    // Hangs node into the tree on the given side, along with its subtree on
+    // the far side of the path.
+    auto link = [&](int side) {
+        int inner = side ^ 1;
+        if (tails[side]) {
+            childOf(tails[side], inner) = node;
+            node->parent = tails[side];
+        } else {
+            heads[side] = node;
+        }
+        tails[side] = node;
+        const NodePtr<Node>& outer = childOf(node, side);
+        counts[side] += 1 + (outer ? outer->count : 0);
+        sizes[side] += node->repeat + (outer ? outer->size : 0);
+    };
+
+    stats.visit();
+    int direction = locate(node);
+    while (direction != 0) {
+        int way = direction > 0;
+        NodePtr<Node> child = childOf(node, way);
+        if (!child)
+            break;
+        stats.visit();
+        int next = locate(child);
+        ++depth;
+        if (next != 0 && (next > 0) == way) {
+            childOf(node, way) = childOf(child, way ^ 1);
+            if (childOf(node, way))
+                childOf(node, way)->parent = node;
+            childOf(child, way ^ 1) = node;
+            node->parent = child;
+            node->update();
+            stats.rotation();
+            node = child;
+            child = childOf(node, way);
+            if (!child)
+                break;
+            link(way ^ 1);
+            node = child;
+            ++depth;
+            stats.visit();
+            direction = locate(node);
+        } else {
+            link(way ^ 1);
+            node = child;
+            direction = next;
+        }
+    }
 
-template <typename T, typename Compare, typename Node>
-bool Splay<T, Compare, Node>::contains(const T& value) {
-    std::shared_ptr<Node> node = root;
-    while (node) {
-        if (!compare(value, node->value) && !compare(node->value, value)) {
-            splay(node);
-            return true;
+    for (int side = 0; side < 2; ++side) {
+        int inner = side ^ 1;
+        NodePtr<Node>& rest = childOf(node, side);
+        if (!heads[side])
+            continue;
+        size_t count = counts[side] + (rest ? rest->count : 0);
+        size_t size = sizes[side] + (rest ? rest->size : 0);
+        childOf(tails[side], inner) = rest;
+        if (rest)
+            rest->parent = tails[side];
+        for (NodePtr<Node> spine = heads[side];; spine = childOf(spine, inner)) {
+            const NodePtr<Node>& outer = childOf(spine, side);
+            spine->count = count;
+            spine->size = size;
+            if (spine == tails[side])
+                break;
+            count -= 1 + (outer ? outer->count : 0);
+            size -= spine->repeat + (outer ? outer->size : 0);
         }
-        node = node->children[compare(node->value, value)];
+        rest = heads[side];
+        rest->parent = node;
     }
-    return false;
+    node->update();
+    stats.splay(depth);
+    subtree = node;
+    return direction == 0;
 }
 
-template <typename T, typename Compare, typename Node>
-void Splay<T, Compare, Node>::insert(const T& value) {
-    if (root == nullptr) {
-        root = std::make_shared<Node>(value);
-        return;
+// Walks the path two nodes at a time and rotates the lower one over the upper
+// one when both steps go the same way, which halves the depth of the rest of
+// the path. Rotations inside a subtree leave its size alone, so only the two
+// nodes involved need updating.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Policy>
+template <typename Locate>
+NodePtr<Node> Splay<T, Compare, Node, Allocator, Stats, Policy>::semiSplay(Locate& locate) {
+    NodePtr<Node>* slot = &root;
+    size_t depth = 0;
+    NodePtr<Node> found = nullptr;
+    while (*slot) {
+        NodePtr<Node> node = *slot;
+        stats.visit();
+        int direction = locate(node);
+        if (direction == 0) {
+            found = node;
+            break;
+        }
+        int way = direction > 0;
+        NodePtr<Node> child = childOf(node, way);
+        if (!child)
+            break;
+        stats.visit();
+        int next = locate(child);
+        ++depth;
+        if (next == 0) {
+            found = child;
+            break;
+        }
+        if ((next > 0) != way) {
+            slot = &childOf(child, next > 0);
+            ++depth;
+            continue;
+        }
+        childOf(node, way) = childOf(child, way ^ 1);
+        if (childOf(node, way))
+            childOf(node, way)->parent = node;
+        childOf(child, way ^ 1) = node;
+        child->parent = node->parent;
+        node->parent = child;
+        *slot = child;
+        node->update();
+        child->update();
+        stats.rotation();
+        slot = &childOf(child, way);
     }
-    std::shared_ptr<Node> node = root;
-    while (true) {
-        if (!compare(value, node->value) && !compare(node->value, value)) {
-            node->repeat++;
-            node->update();
-            splay(node);
-            return;
+    stats.splay(depth);
+    return found;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Policy>
+template <typename Locate>
+NodePtr<Node> Splay<T, Compare, Node, Allocator, Stats, Policy>::access(Locate& locate) {
+    if (root == nullptr)
+        return nullptr;
+    if constexpr (Policy::semi) {
+        return semiSplay(locate);
+    } else {
+        if (policy.splayFirst()) {
+            bool found = splay(root, locate);
+            root->parent.reset();
+            return found ? root : nullptr;
         }
-        int direction = compare(node->value, value);
-        if (!node->children[direction]) {
-            node->children[direction] = std::make_shared<Node>(value);
-            node->children[direction]->parent = node;
-            node->update();
-            splay(node->children[direction]);
-            return;
+        // A second walk down the same path, if the policy asks for one, has
+        // to start from the locator as it was.
+        Locate replay = locate;
+        NodePtr<Node> node = root;
+        size_t depth = 0;
+        while (node) {
+            stats.visit();
+            int direction = locate(node);
+            if (direction == 0)
+                break;
+            node = childOf(node, direction > 0);
+            ++depth;
         }
-        node = node->children[direction];
+        if (node && policy.splayFound(depth, this->size())) {
+            splay(root, replay);
+            root->parent.reset();
+        }
+        return node;
     }
 }
 
-template <typename T, typename Compare, typename Node>
-void Splay<T, Compare, Node>::remove(const T& value) {
-    rank(value);
-    if (root->value != value)
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Policy>
+template <typename Key>
+bool Splay<T, Compare, Node, Allocator, Stats, Policy>::containsKey(const Key& key) {
+    KeyLocator<Key> locate{key, compare};
+    return access(locate) != nullptr;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Policy>
+template <typename Value>
+NodePtr<Node> Splay<T, Compare, Node, Allocator, Stats, Policy>::insertValue(Value&& value) {
+    if (root == nullptr)
+        return root = createNode(std::forward<Value>(value));
+    bool found = splay(root, KeyLocator<T>{value, compare});
+    root->parent.reset();
+    if (found) {
+        root->repeat++;
+        root->update();
+        return root;
+    }
+    // The new node goes on top, with the old root on the side it falls on and
+    // the old root's subtree on the other side moved over to it.
+    NodePtr<Node> node = createNode(std::forward<Value>(value));
+    int way = compare(node->value, root->value);
+    childOf(node, way) = root;
+    childOf(node, way ^ 1) = childOf(root, way ^ 1);
+    if (childOf(node, way ^ 1))
+        childOf(node, way ^ 1)->parent = node;
+    childOf(root, way ^ 1) = nullptr;
+    root->parent = node;
+    root->update();
+    node->update();
+    return root = node;
+}
+
+// The key is splayed to the root and its node replaced by the join of its two
+// subtrees: the largest key on the left, splayed to the top there, takes the
+// right subtree as its right child.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Policy>
+template <typename Key>
+void Splay<T, Compare, Node, Allocator, Stats, Policy>::removeKey(const Key& key) {
+    if (!root)
+        return;
+    bool found = splay(root, KeyLocator<Key>{key, compare});
+    root->parent.reset();
+    if (!found)
         return;
     if (root->repeat > 1) {
         root->repeat--;
         root->update();
         return;
     }
-    if (!root->left && !root->right) {
-        root = nullptr;
-        return;
+    NodePtr<Node> current = root;
+    if (!current->left) {
+        root = current->right;
+    } else {
+        root = current->left;
+        splay(root, MaximumLocator());
+        root->right = current->right;
+        if (root->right)
+            root->right->parent = root;
+        root->update();
     }
-    if (!root->left || !root->right) {
-        root = root->children[root->left == nullptr];
+    if (root)
         root->parent.reset();
-        return;
-    }
-    std::shared_ptr<Node> current = root;
-    std::shared_ptr<Node> node = root->left;
-    while (node->right)
-        node = node->right;
-    splay(node);
-    current->right->parent = node;
-    node->right = current->right;
-    node->update();
+    current->left = current->right = nullptr;
+    destroyNode(current);
 }
 
-template <typename T, typename Compare, typename Node>
-size_t Splay<T, Compare, Node>::rank(const T& value) {
-    std::shared_ptr<Node> node = root;
-    size_t rank = 0;
-    while (node) {
-        if (!compare(value, node->value) && !compare(node->value, value)) {
-            splay(node);
-            return rank + (node->left ? node->left->count : 0) + 1;
-        }
-        if (compare(node->value, value)) {
-            rank += (node->left ? node->left->count : 0) + node->repeat;
-            node = node->right;
-        } else
-            node = node->left;
-    }
-    return rank;
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Policy>
+template <typename Key>
+size_t Splay<T, Compare, Node, Allocator, Stats, Policy>::rankKey(const Key& key) {
+    KeyLocator<Key> locate{key, compare};
+    access(locate);
+    return locate.rank;
 }
 
-template <typename T, typename Compare, typename Node>
-T Splay<T, Compare, Node>::select(size_t rank) {
-    assert(rank <= this->size());
-    std::shared_ptr<Node> node = root;
-    while (node) {
-        size_t left_count = node->left ? node->left->count : 0;
-        if (rank <= left_count)
-            node = node->left;
-        else if (rank <= left_count + node->repeat) {
-            splay(node);
-            return node->value;
-        } else {
-            rank -= left_count + node->repeat;
-            node = node->right;
-        }
-    }
-    return T();
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Policy>
+T Splay<T, Compare, Node, Allocator, Stats, Policy>::select(size_t rank) {
+    // Out of range, like the base class, and without splaying anything.
+    if (rank == 0 || rank > this->size())
+        return T();
+    PositionLocator locate{rank};
+    NodePtr<Node> node = access(locate);
+    return node ? node->value : T();
 }
 
 #endif  // SPLAY_HPP
\ No newline at end of file
@@ -1,10 +1,18 @@
 #ifndef TREAP_HPP
 #define TREAP_HPP
 
+#include <algorithm>
 #include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iterator>
 #include <tuple>
+#include <type_traits>
+#include <vector>
 
 #include "binary_search_tree.hpp"
+#include "fork_join.hpp"
+#include "priority.hpp"
 
 template <typename T>
 struct TreapNode {
@@ -18,8 +26,8 @@ struct TreapNode {
     std::uint32_t priority;
 
     TreapNode() = default;
-    TreapNode(const T& value, size_t repeat = 1)
-        : value(std::move(value)), count(repeat), repeat(repeat), priority(rand()) {}
+    TreapNode(T value, size_t repeat = 1)
+        : value(std::move(value)), size(repeat), count(repeat), repeat(repeat), priority(0) {}
 
     ~TreapNode() = default;
 
@@ -29,52 +37,254 @@ struct TreapNode {
     }
 };
 
-template <typename T, typename Compare = std::less<T>, typename Node = TreapNode<T>>
-class Treap : public BinarySearchTree<T, Compare, Node> {
-    using BinarySearchTree<T, Compare, Node>::root;
-    using BinarySearchTree<T, Compare, Node>::compare;
-    using BinarySearchTree<T, Compare, Node>::rotate;
+// A treap node that also keeps a Merkle digest of its subtree: a hash of its
+// key and repeat count chained with the digests of its children. Under
+// HashPriority equal multisets of keys make equal trees, hence equal digests,
+// and two treaps can be compared through their roots alone.
+template <typename T, typename Hash = std::hash<T>>
+struct MerkleTreapNode {
+   public:
+    T value;
+    std::weak_ptr<MerkleTreapNode<T, Hash>> parent;
+    std::shared_ptr<MerkleTreapNode<T, Hash>> children[2];
+    std::shared_ptr<MerkleTreapNode<T, Hash>>& left = children[0];
+    std::shared_ptr<MerkleTreapNode<T, Hash>>& right = children[1];
+    size_t size, count, repeat;
+    std::uint32_t priority;
+    std::uint64_t keyHash, digest;
+
+    MerkleTreapNode() = default;
+    MerkleTreapNode(T value, size_t repeat = 1)
+        : value(std::move(value)), repeat(repeat), priority(0), keyHash(mixHash(Hash()(this->value))) { update(); }
+
+    ~MerkleTreapNode() = default;
+
+    inline void update() {
+        count = 1 + (left ? left->count : 0) + (right ? right->count : 0);
+        size = repeat + (left ? left->size : 0) + (right ? right->size : 0);
+        // An empty subtree digests to 0; left and right enter at different
+        // rounds so that mirrored trees do not collide.
+        digest = mixHash(mixHash(keyHash + repeat) ^ (left ? left->digest : 0));
+        digest = mixHash(digest + (right ? right->digest : 0));
+    }
+};
 
+template <typename T, typename SizeType = std::uint32_t>
+struct CompactTreapNode : CompactNodeBase<CompactTreapNode<T, SizeType>, T, SizeType> {
    public:
+    std::uint32_t priority;
+
+    CompactTreapNode() = default;
+    CompactTreapNode(T value, SizeType repeat = 1)
+        : CompactNodeBase<CompactTreapNode<T, SizeType>, T, SizeType>(std::move(value), repeat), priority(0) {}
+};
+
+// Turns a vine of nodes chained through `right`, already in key order, into a
+// treap in O(n): the right spine is kept as a stack through the parent links,
+// and every node adopts as its left subtree the part of the spine it outranks.
+template <typename Pointer>
+Pointer buildCartesian(Pointer head) {
+    Pointer top = nullptr, last = nullptr;
+    while (head) {
+        Pointer node = head;
+        head = node->right;
+        node->right = nullptr;
+        Pointer child = nullptr;
+        while (last && node->priority < last->priority) {
+            last->update();
+            child = last;
+            last = last->parent.lock();
+        }
+        node->left = child;
+        if (child)
+            child->parent = node;
+        node->parent = last;
+        if (last)
+            last->right = node;
+        else
+            top = node;
+        last = node;
+    }
+    for (; last; last = last->parent.lock())
+        last->update();
+    return top;
+}
+
+// Appends the nodes of the subtree to out in key order.
+template <typename Pointer, typename Out>
+void flattenTreap(const Pointer& node, std::vector<Out>& out) {
+    if (node == nullptr)
+        return;
+    flattenTreap(node->left, out);
+    out.push_back(&*node);
+    flattenTreap(node->right, out);
+}
+
+// Reports visitor(key, here, there), in key order, for every key whose repeat
+// counts under the two subtrees differ, 0 standing for absent. The subtrees
+// must be at the same place in two canonical treaps of Merkle nodes, so that
+// they span the same range of keys. Subtrees with equal digests are skipped,
+// and so are nodes with the same key on both sides, the node of highest
+// priority in that range; otherwise one of the two roots is missing on the
+// other side and both subtrees are merged in order. A key missing from one
+// side has a subtree of O(log n) expected size there, so d differences cost
+// O(d log n) expected time.
+template <typename Pointer, typename Compare, typename Visitor>
+void diffTreaps(const Pointer& here, const Pointer& there, const Compare& compare, Visitor& visitor) {
+    if (here == nullptr && there == nullptr)
+        return;
+    if (here && there && here->digest == there->digest)
+        return;
+    if (here && there && !compare(here->value, there->value) && !compare(there->value, here->value)) {
+        diffTreaps(here->left, there->left, compare, visitor);
+        if (here->repeat != there->repeat)
+            visitor(here->value, static_cast<size_t>(here->repeat), static_cast<size_t>(there->repeat));
+        diffTreaps(here->right, there->right, compare, visitor);
+        return;
+    }
+    using Raw = decltype(&*here);
+    std::vector<Raw> mine, theirs;
+    flattenTreap(here, mine);
+    flattenTreap(there, theirs);
+    auto first = mine.begin(), second = theirs.begin();
+    while (first != mine.end() || second != theirs.end()) {
+        if (second == theirs.end() || (first != mine.end() && compare((*first)->value, (*second)->value))) {
+            visitor((*first)->value, static_cast<size_t>((*first)->repeat), size_t(0));
+            ++first;
+        } else if (first == mine.end() || compare((*second)->value, (*first)->value)) {
+            visitor((*second)->value, size_t(0), static_cast<size_t>((*second)->repeat));
+            ++second;
+        } else {
+            if ((*first)->repeat != (*second)->repeat)
+                visitor((*first)->value, static_cast<size_t>((*first)->repeat), static_cast<size_t>((*second)->repeat));
+            ++first;
+            ++second;
+        }
+    }
+}
+
+template <typename T, typename Compare = std::less<T>, typename Node = TreapNode<T>, typename Allocator = std::allocator<Node>, typename Stats = NoTreeStats, typename Priority = RandomPriority>
+class Treap : public BinarySearchTree<T, Compare, Node, Allocator, Stats, Treap<T, Compare, Node, Allocator, Stats, Priority>> {
+    using Base = BinarySearchTree<T, Compare, Node, Allocator, Stats, Treap>;
+    friend Base;
+    using Base::root;
+    using Base::compare;
+    using Base::stats;
+    using Base::destroyNode;
+    using Base::rotate;
+
+   protected:
+    Priority priorities;
+
+    template <typename... Args>
+    NodePtr<Node> createNode(Args&&... args);
+    // Whether a belongs above b.
+    bool outranks(const NodePtr<Node>& a, const NodePtr<Node>& b) const {
+        return a->priority < b->priority || (a->priority == b->priority && compare(a->value, b->value));
+    }
+    NodePtr<Node> buildSorted(NodePtr<Node> head, size_t);
+    template <typename Value>
+    NodePtr<Node> insertValue(Value&& value) { return insertValue(std::forward<Value>(value), root); }
+    template <typename Value>
+    NodePtr<Node> insertValue(Value&& value, NodePtr<Node> from);
+    template <typename Key>
+    void removeKey(const Key& key);
+
    public:
+    using typename Base::iterator;
+
     Treap() = default;
+    explicit Treap(const Allocator& allocator) : Base(allocator) {}
+    explicit Treap(const Priority& priorities, const Allocator& allocator = Allocator())
+        : Base(allocator), priorities(priorities) {}
+    template <typename InputIt>
+    Treap(InputIt first, InputIt last) { this->assign_sorted(first, last); }
     Treap(const Treap&) = delete;
     Treap(Treap&&) = default;
     Treap& operator=(const Treap&) = delete;
     Treap& operator=(Treap&&) = default;
     ~Treap() = default;
 
-    void insert(const T& value) override;
-    void remove(const T& value) override;
+    void insert(const T& value) { insertValue(value); }
+    void insert(T&& value) { insertValue(std::move(value)); }
+    iterator insert(iterator hint, const T& value) { return this->iteratorAt(insertValue(value, this->fingerNode(hint, value))); }
+    iterator insert(iterator hint, T&& value) {
+        NodePtr<Node> from = this->fingerNode(hint, value);
+        return this->iteratorAt(insertValue(std::move(value), from));
+    }
+    void remove(const T& value) { removeKey(value); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    void remove(const Key& key) { removeKey(key); }
+
+    // Digest of the whole treap, 0 when it is empty. These need Merkle nodes,
+    // and mean something across treaps only with a canonical priority source.
+    std::uint64_t digest() const noexcept { return root ? root->digest : 0; }
+    // Whether both treaps hold the same keys, each as often, in O(1); equal
+    // digests of different contents are as unlikely as a 64-bit collision.
+    bool same_contents(const Treap& other) const;
+    // Calls visitor(key, here, there) in key order for every key whose repeat
+    // count differs in the other treap, 0 standing for absent, in O(d log n)
+    // expected time for d such keys.
+    template <typename Visitor>
+    void diff(const Treap& other, Visitor&& visitor) const;
 };
 
-template <typename T, typename Compare, typename Node>
-void Treap<T, Compare, Node>::insert(const T& value) {
-    if (root == nullptr) {
-        root = std::make_shared<Node>(value);
-        return;
-    }
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+template <typename... Args>
+NodePtr<Node> Treap<T, Compare, Node, Allocator, Stats, Priority>::createNode(Args&&... args) {
+    NodePtr<Node> node = Base::createNode(std::forward<Args>(args)...);
+    node->priority = priorities(node->value);
+    return node;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+NodePtr<Node> Treap<T, Compare, Node, Allocator, Stats, Priority>::buildSorted(NodePtr<Node> head, size_t) {
+    for (NodePtr<Node> node = head; node; node = node->right)
+        node->priority = priorities(node->value);
+    return buildCartesian(head);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+bool Treap<T, Compare, Node, Allocator, Stats, Priority>::same_contents(const Treap& other) const {
+    static_assert(Priority::canonical, "contents can only be compared through digests under a canonical priority source");
+    return this->size() == other.size() && digest() == other.digest();
+}
 
-    std::shared_ptr<Node> current = root;
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+template <typename Visitor>
+void Treap<T, Compare, Node, Allocator, Stats, Priority>::diff(const Treap& other, Visitor&& visitor) const {
+    static_assert(Priority::canonical, "treaps can only be diffed through digests under a canonical priority source");
+    diffTreaps(root, other.root, compare, visitor);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+template <typename Value>
+NodePtr<Node> Treap<T, Compare, Node, Allocator, Stats, Priority>::insertValue(Value&& value, NodePtr<Node> from) {
+    if (root == nullptr)
+        return root = createNode(std::forward<Value>(value));
+
+    NodePtr<Node> current = std::move(from);
     while (true) {
+        stats.visit();
         if (!compare(value, current->value) && !compare(current->value, value)) {
             current->repeat++;
             current->update();
             break;
         }
         int direction = compare(current->value, value);
-        if (!current->children[direction]) {
-            current->children[direction] = std::make_shared<Node>(value);
-            current->children[direction]->parent = current;
-            current = current->children[direction];
+        if (!childOf(current, direction)) {
+            childOf(current, direction) = createNode(std::forward<Value>(value));
+            childOf(current, direction)->parent = current;
+            current = childOf(current, direction);
             break;
         }
-        current = current->children[direction];
+        current = childOf(current, direction);
     }
+    NodePtr<Node> holder = current;
 
     while (!isRoot(current)) {
         int direction = getDirection(current);
-        if (current->priority < current->parent.lock()->priority) {
+        if (outranks(current, current->parent.lock())) {
             rotate(current->parent.lock(), direction ^ 1);
         } else {
             current->update();
@@ -82,28 +292,34 @@ void Treap<T, Compare, Node>::insert(const T& value) {
         }
     }
     current->update();
+    return holder;
 }
 
-template <typename T, typename Compare, typename Node>
-void Treap<T, Compare, Node>::remove(const T& value) {
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+template <typename Key>
+void Treap<T, Compare, Node, Allocator, Stats, Priority>::removeKey(const Key& key) {
     if (root == nullptr)
         return;
 
-    std::shared_ptr<Node> current = root;
+    NodePtr<Node> current = root;
+    NodePtr<Node> removed = nullptr;
     while (true) {
-        if (!compare(value, current->value) && !compare(current->value, value)) {
+        stats.visit();
+        if (!compare(key, current->value) && !compare(current->value, key)) {
             if (current->repeat > 1) {
                 current->repeat--;
                 break;
             }
 
+            if (!current->left || !current->right)
+                removed = current;
             if (!current->left && !current->right) {
                 if (isRoot(current)) {
                     root = nullptr;
                     current = nullptr;
                     break;
                 }
-                current->parent.lock()->children[getDirection(current)] = nullptr;
+                childOf(current->parent.lock(), getDirection(current)) = nullptr;
                 current = current->parent.lock();
                 break;
             }
@@ -116,65 +332,170 @@ void Treap<T, Compare, Node>::remove(const T& value) {
                     break;
                 }
                 int direction = getDirection(current);
-                current->parent.lock()->children[direction] =
+                childOf(current->parent.lock(), direction) =
                     current->left ? current->left : current->right;
-                current->parent.lock()->children[direction]->parent = current->parent;
+                childOf(current->parent.lock(), direction)->parent = current->parent;
                 current = current->parent.lock();
                 break;
             }
 
-            int direction = current->right->priority > current->left->priority;
+            int direction = outranks(current->left, current->right);
             rotate(current, direction);
             continue;
         }
-        int direction = compare(current->value, value);
-        if (!current->children[direction])
+        int direction = compare(current->value, key);
+        if (!childOf(current, direction))
             break;
-        current = current->children[direction];
+        current = childOf(current, direction);
     }
 
     while (current != nullptr) {
         current->update();
         current = current->parent.lock();
     }
+    if (removed)
+        destroyNode(removed);
 }
 
-template <typename T, typename Compare = std::less<T>, typename Node = TreapNode<T>>
-class NonRotatingTreap : public BinarySearchTree<T, Compare, Node> {
-    using BinarySearchTree<T, Compare, Node>::root;
-    using BinarySearchTree<T, Compare, Node>::compare;
+template <typename T, typename Compare = std::less<T>, typename Node = TreapNode<T>, typename Allocator = std::allocator<Node>, typename Stats = NoTreeStats, typename Priority = RandomPriority>
+class NonRotatingTreap : public BinarySearchTree<T, Compare, Node, Allocator, Stats, NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>> {
+    using Base = BinarySearchTree<T, Compare, Node, Allocator, Stats, NonRotatingTreap>;
+    friend Base;
+    using Base::root;
+    using Base::compare;
+    using Base::destroyNode;
+    using Base::stats;
 
    protected:
-    std::shared_ptr<Node> merge(const std::shared_ptr<Node>& left,
-                                const std::shared_ptr<Node>& right);
-    std::shared_ptr<Node> mergeTriple(const std::shared_ptr<Node>& left,
-                                      const std::shared_ptr<Node>& middle,
-                                      const std::shared_ptr<Node>& right);
-    std::tuple<std::shared_ptr<Node>, std::shared_ptr<Node>, std::shared_ptr<Node>>
-    splitByValue(const std::shared_ptr<Node>& current, const T& value);
-    std::tuple<std::shared_ptr<Node>, std::shared_ptr<Node>, std::shared_ptr<Node>>
-    splitByRank(const std::shared_ptr<Node>& current, size_t rank);
+    Priority priorities;
+
+    template <typename... Args>
+    NodePtr<Node> createNode(Args&&... args);
+    // Whether a belongs above b.
+    bool outranks(const NodePtr<Node>& a, const NodePtr<Node>& b) const {
+        return a->priority < b->priority || (a->priority == b->priority && compare(a->value, b->value));
+    }
+    NodePtr<Node> merge(const NodePtr<Node>& left,
+                                const NodePtr<Node>& right);
+    NodePtr<Node> mergeTriple(const NodePtr<Node>& left,
+                                      const NodePtr<Node>& middle,
+                                      const NodePtr<Node>& right);
+    template <typename Key>
+    std::tuple<NodePtr<Node>, NodePtr<Node>, NodePtr<Node>>
+    splitByValue(const NodePtr<Node>& current, const Key& key);
+    std::tuple<NodePtr<Node>, NodePtr<Node>, NodePtr<Node>>
+    splitByRank(const NodePtr<Node>& current, size_t rank);
+    std::tuple<NodePtr<Node>, NodePtr<Node>, NodePtr<Node>> detach(const NodePtr<Node>& node);
+
+    using Garbage = std::vector<NodePtr<Node>>;
+    using SetOperation = NodePtr<Node> (NonRotatingTreap::*)(NodePtr<Node>, NodePtr<Node>, Garbage&, size_t);
+    // Smallest number of nodes on each side for which the set operations fork.
+    static constexpr size_t forkGrain = 1 << 14;
+
+    NodePtr<Node> link(const NodePtr<Node>& node, const NodePtr<Node>& left, const NodePtr<Node>& right);
+    NodePtr<Node> unite(NodePtr<Node> left, NodePtr<Node> right, Garbage& garbage, size_t forks);
+    NodePtr<Node> intersect(NodePtr<Node> left, NodePtr<Node> right, Garbage& garbage, size_t forks);
+    NodePtr<Node> subtract(NodePtr<Node> left, NodePtr<Node> right, Garbage& garbage, size_t forks);
+    std::pair<NodePtr<Node>, NodePtr<Node>> combine(SetOperation operation,
+                                                    NodePtr<Node> left1, NodePtr<Node> right1,
+                                                    NodePtr<Node> left2, NodePtr<Node> right2,
+                                                    Garbage& garbage, size_t forks);
+    NodePtr<Node> adopt(NonRotatingTreap& other);
+    void collect(Garbage& garbage) noexcept;
+    template <typename RandomIt>
+    NodePtr<Node> eraseSorted(const NodePtr<Node>& node, RandomIt first, RandomIt last);
+    NodePtr<Node> buildSorted(NodePtr<Node> head, size_t);
+    // From the root only: the treap is split around the key and merged back.
+    template <typename Value>
+    NodePtr<Node> insertValue(Value&& value);
+    template <typename Key>
+    void removeKey(const Key& key);
 
    public:
+    using typename Base::iterator;
+
     NonRotatingTreap() = default;
+    explicit NonRotatingTreap(const Allocator& allocator) : Base(allocator) {}
+    explicit NonRotatingTreap(const Priority& priorities, const Allocator& allocator = Allocator())
+        : Base(allocator), priorities(priorities) {}
+    template <typename InputIt>
+    NonRotatingTreap(InputIt first, InputIt last) { this->assign_sorted(first, last); }
     NonRotatingTreap(const NonRotatingTreap&) = delete;
     NonRotatingTreap(NonRotatingTreap&&) = default;
     NonRotatingTreap& operator=(const NonRotatingTreap&) = delete;
     NonRotatingTreap& operator=(NonRotatingTreap&&) = default;
     ~NonRotatingTreap() = default;
 
-    void insert(const T& value) override;
-    void remove(const T& value) override;
+    void insert(const T& value) { insertValue(value); }
+    void insert(T&& value) { insertValue(std::move(value)); }
+    // The hint is not used: insertion splits the treap from the root.
+    iterator insert(iterator, const T& value) { return this->iteratorAt(insertValue(value)); }
+    iterator insert(iterator, T&& value) { return this->iteratorAt(insertValue(std::move(value))); }
+    void remove(const T& value) { removeKey(value); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    void remove(const Key& key) { removeKey(key); }
+
+    // Batch updates with a sorted range of m keys in O(m log(n / m + 1))
+    // expected time. Like insert() and remove(), every element of the range
+    // adds or takes away one occurrence of its key.
+    template <typename InputIt>
+    void insert_batch(InputIt first, InputIt last);
+    template <typename InputIt>
+    void erase_batch(InputIt first, InputIt last);
+
+    // Set algebra with another treap of the same type, which is left empty: its
+    // nodes are taken over when the allocators compare equal and copied
+    // otherwise. Repeat counts are added up, the smaller one is kept, or they
+    // are subtracted, respectively. Large disjoint subproblems run on threads
+    // of their own.
+    void union_with(NonRotatingTreap& other);
+    void intersect_with(NonRotatingTreap& other);
+    void difference_with(NonRotatingTreap& other);
+
+    // As for Treap: these need Merkle nodes and a canonical priority source.
+    std::uint64_t digest() const noexcept { return root ? root->digest : 0; }
+    bool same_contents(const NonRotatingTreap& other) const;
+    template <typename Visitor>
+    void diff(const NonRotatingTreap& other, Visitor&& visitor) const;
 };
 
-template <typename T, typename Compare, typename Node>
-std::shared_ptr<Node> NonRotatingTreap<T, Compare, Node>::merge(
-    const std::shared_ptr<Node>& left,
-    const std::shared_ptr<Node>& right) {
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+template <typename... Args>
+NodePtr<Node> NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::createNode(Args&&... args) {
+    NodePtr<Node> node = Base::createNode(std::forward<Args>(args)...);
+    node->priority = priorities(node->value);
+    return node;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+NodePtr<Node> NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::buildSorted(NodePtr<Node> head, size_t) {
+    for (NodePtr<Node> node = head; node; node = node->right)
+        node->priority = priorities(node->value);
+    return buildCartesian(head);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+bool NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::same_contents(const NonRotatingTreap& other) const {
+    static_assert(Priority::canonical, "contents can only be compared through digests under a canonical priority source");
+    return this->size() == other.size() && digest() == other.digest();
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+template <typename Visitor>
+void NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::diff(const NonRotatingTreap& other, Visitor&& visitor) const {
+    static_assert(Priority::canonical, "treaps can only be diffed through digests under a canonical priority source");
+    diffTreaps(root, other.root, compare, visitor);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+NodePtr<Node> NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::merge(
+    const NodePtr<Node>& left,
+    const NodePtr<Node>& right) {
     if (left == nullptr || right == nullptr)
         return left ? left : right;
+    stats.visit();
 
-    if (left->priority < right->priority) {
+    if (outranks(left, right)) {
         left->right = merge(left->right, right);
         left->right->parent = left;
         left->update();
@@ -187,45 +508,59 @@ std::shared_ptr<Node> NonRotatingTreap<T, Compare, Node>::merge(
     }
 }
 
-template <typename T, typename Compare, typename Node>
-std::shared_ptr<Node> NonRotatingTreap<T, Compare, Node>::mergeTriple(
-    const std::shared_ptr<Node>& left,
-    const std::shared_ptr<Node>& middle,
-    const std::shared_ptr<Node>& right) {
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+NodePtr<Node> NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::mergeTriple(
+    const NodePtr<Node>& left,
+    const NodePtr<Node>& middle,
+    const NodePtr<Node>& right) {
     return merge(merge(left, middle), right);
 }
 
-template <typename T, typename Compare, typename Node>
-std::tuple<std::shared_ptr<Node>, std::shared_ptr<Node>, std::shared_ptr<Node>>
-NonRotatingTreap<T, Compare, Node>::splitByValue(const std::shared_ptr<Node>& current,
-                                                 const T& value) {
+// Cuts the node off its subtrees, returning them on either side of it.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+std::tuple<NodePtr<Node>, NodePtr<Node>, NodePtr<Node>>
+NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::detach(const NodePtr<Node>& node) {
+    NodePtr<Node> left = node->left, right = node->right;
+    node->left = nullptr;
+    node->right = nullptr;
+    node->update();
+    return std::make_tuple(left, node, right);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+template <typename Key>
+std::tuple<NodePtr<Node>, NodePtr<Node>, NodePtr<Node>>
+NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::splitByValue(const NodePtr<Node>& current,
+                                                 const Key& key) {
     if (current == nullptr)
         return std::make_tuple(nullptr, nullptr, nullptr);
-    if (compare(current->value, value)) {
-        auto [left, middle, right] = splitByValue(current->right, value);
+    stats.visit();
+    if (compare(current->value, key)) {
+        auto [left, middle, right] = splitByValue(current->right, key);
         current->right = left;
         if (current->right)
             current->right->parent = current;
         current->update();
         return std::make_tuple(current, middle, right);
-    } else if (compare(value, current->value)) {
-        auto [left, middle, right] = splitByValue(current->left, value);
+    } else if (compare(key, current->value)) {
+        auto [left, middle, right] = splitByValue(current->left, key);
         current->left = right;
         if (current->left)
             current->left->parent = current;
         current->update();
         return std::make_tuple(left, middle, current);
     } else {
-        return std::make_tuple(current->left, current, current->right);
+        return detach(current);
     }
 }
 
-template <typename T, typename Compare, typename Node>
-std::tuple<std::shared_ptr<Node>, std::shared_ptr<Node>, std::shared_ptr<Node>>
-NonRotatingTreap<T, Compare, Node>::splitByRank(const std::shared_ptr<Node>& current,
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+std::tuple<NodePtr<Node>, NodePtr<Node>, NodePtr<Node>>
+NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::splitByRank(const NodePtr<Node>& current,
                                                 size_t rank) {
     if (current == nullptr)
         return std::make_tuple(nullptr, nullptr, nullptr);
+    stats.visit();
     size_t leftSize = current->left ? current->left->size : 0;
     if (leftSize >= rank) {
         auto [left, middle, right] = splitByRank(current->left, rank);
@@ -242,38 +577,265 @@ NonRotatingTreap<T, Compare, Node>::splitByRank(const std::shared_ptr<Node>& cur
         current->update();
         return std::make_tuple(current, middle, right);
     } else {
-        return std::make_tuple(current->left, current, current->right);
+        return detach(current);
     }
 }
 
-template <typename T, typename Compare, typename Node>
-void NonRotatingTreap<T, Compare, Node>::insert(const T& value) {
-    if (root == nullptr) {
-        root = std::make_shared<Node>(value);
-        return;
-    }
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+template <typename Value>
+NodePtr<Node> NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::insertValue(Value&& value) {
+    if (root == nullptr)
+        return root = createNode(std::forward<Value>(value));
     auto [left, middle, right] = splitByValue(root, value);
     if (middle == nullptr) {
-        middle = std::make_shared<Node>(value);
+        middle = createNode(std::forward<Value>(value));
     } else {
         middle->repeat++;
+        middle->update();
     }
     root = mergeTriple(left, middle, right);
     if (root)
         root->parent.reset();
+    return middle;
 }
 
-template <typename T, typename Compare, typename Node>
-void NonRotatingTreap<T, Compare, Node>::remove(const T& value) {
-    auto [left, middle, right] = splitByValue(root, value);
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+template <typename Key>
+void NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::removeKey(const Key& key) {
+    auto [left, middle, right] = splitByValue(root, key);
     if (middle == nullptr) {
         root = merge(left, right);
     } else if (middle->repeat > 1) {
         middle->repeat--;
+        middle->update();
         root = mergeTriple(left, middle, right);
-        return;
-    } else
+    } else {
         root = merge(left, right);
+        destroyNode(middle);
+    }
+    if (root)
+        root->parent.reset();
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+NodePtr<Node> NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::link(const NodePtr<Node>& node,
+                                                                  const NodePtr<Node>& left,
+                                                                  const NodePtr<Node>& right) {
+    node->left = left;
+    if (left)
+        left->parent = node;
+    node->right = right;
+    if (right)
+        right->parent = node;
+    node->update();
+    return node;
+}
+
+// The set operations below keep whichever root has the higher priority on top
+// and split the other treap around its key, so only the paths separating the
+// keys of the two treaps are ever walked: O(m log(n / m + 1)) expected work
+// for treaps of m <= n nodes. Nodes dropped on the way are only collected, to
+// be freed by the calling thread once all of the forked tasks are done.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+NodePtr<Node> NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::unite(NodePtr<Node> left, NodePtr<Node> right,
+                                                                   Garbage& garbage, size_t forks) {
+    if (left == nullptr || right == nullptr)
+        return left ? left : right;
+    if (outranks(right, left))
+        std::swap(left, right);
+    auto [lower, middle, upper] = splitByValue(right, left->value);
+    if (middle) {
+        left->repeat += middle->repeat;
+        garbage.push_back(middle);
+    }
+    auto [leftChild, rightChild] = combine(&NonRotatingTreap::unite, left->left, lower, left->right, upper, garbage, forks);
+    return link(left, leftChild, rightChild);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+NodePtr<Node> NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::intersect(NodePtr<Node> left, NodePtr<Node> right,
+                                                                       Garbage& garbage, size_t forks) {
+    if (left == nullptr || right == nullptr) {
+        garbage.push_back(left ? left : right);
+        return nullptr;
+    }
+    if (outranks(right, left))
+        std::swap(left, right);
+    auto [lower, middle, upper] = splitByValue(right, left->value);
+    auto [leftChild, rightChild] = combine(&NonRotatingTreap::intersect, left->left, lower, left->right, upper, garbage, forks);
+    if (middle) {
+        left->repeat = std::min(left->repeat, middle->repeat);
+        garbage.push_back(middle);
+        return link(left, leftChild, rightChild);
+    }
+    garbage.push_back(link(left, nullptr, nullptr));
+    return merge(leftChild, rightChild);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+NodePtr<Node> NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::subtract(NodePtr<Node> left, NodePtr<Node> right,
+                                                                      Garbage& garbage, size_t forks) {
+    if (left == nullptr || right == nullptr) {
+        if (right)
+            garbage.push_back(right);
+        return left;
+    }
+    if (outranks(left, right)) {
+        auto [lower, middle, upper] = splitByValue(right, left->value);
+        auto [leftChild, rightChild] = combine(&NonRotatingTreap::subtract, left->left, lower, left->right, upper, garbage, forks);
+        if (middle)
+            garbage.push_back(middle);
+        if (middle == nullptr || middle->repeat < left->repeat) {
+            if (middle)
+                left->repeat -= middle->repeat;
+            return link(left, leftChild, rightChild);
+        }
+        garbage.push_back(link(left, nullptr, nullptr));
+        return merge(leftChild, rightChild);
+    }
+    auto [lower, middle, upper] = splitByValue(left, right->value);
+    auto [leftChild, rightChild] = combine(&NonRotatingTreap::subtract, lower, right->left, upper, right->right, garbage, forks);
+    garbage.push_back(link(right, nullptr, nullptr));
+    if (middle && middle->repeat > right->repeat) {
+        middle->repeat -= right->repeat;
+        middle->update();
+        return mergeTriple(leftChild, middle, rightChild);
+    }
+    if (middle)
+        garbage.push_back(middle);
+    return merge(leftChild, rightChild);
+}
+
+// Applies the operation to two independent pairs of subtrees, on two threads
+// while the fork budget lasts and both pairs hold enough nodes to pay for it.
+// A tree keeping statistics never forks: its counters and its counting
+// comparator are plain fields that both halves would update.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+std::pair<NodePtr<Node>, NodePtr<Node>> NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::combine(
+    SetOperation operation,
+    NodePtr<Node> left1, NodePtr<Node> right1,
+    NodePtr<Node> left2, NodePtr<Node> right2,
+    Garbage& garbage, size_t forks) {
+    auto count = [](const NodePtr<Node>& node) -> size_t { return node ? node->count : 0; };
+    bool fork = !Stats::enabled && forks > 0 && count(left1) + count(right1) >= forkGrain && count(left2) + count(right2) >= forkGrain;
+    NodePtr<Node> first, second;
+    Garbage forked;
+    forkJoin(
+        fork,
+        [&] { first = (this->*operation)(std::move(left1), std::move(right1), fork ? forked : garbage, forks - fork); },
+        [&] { second = (this->*operation)(std::move(left2), std::move(right2), garbage, forks - fork); });
+    garbage.insert(garbage.end(), forked.begin(), forked.end());
+    return std::make_pair(first, second);
+}
+
+// Takes the nodes of the other treap, or copies of them if they were not
+// allocated by an equal allocator, as a treap detached from any tree.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+NodePtr<Node> NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::adopt(NonRotatingTreap& other) {
+    assert(&other != this);
+    if (this->allocator == other.allocator)
+        return std::exchange(other.root, nullptr);
+    NodePtr<Node> head = nullptr, tail = nullptr;
+    try {
+        for (auto it = other.begin(); it != other.end(); ++it) {
+            NodePtr<Node> node = createNode(*it, it.repeat());
+            if (tail)
+                tail->right = node;
+            else
+                head = node;
+            tail = node;
+        }
+    } catch (...) {
+        while (head) {
+            NodePtr<Node> next = head->right;
+            destroyNode(head);
+            head = next;
+        }
+        throw;
+    }
+    other.clear();
+    return buildCartesian(head);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+void NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::collect(Garbage& garbage) noexcept {
+    if (root)
+        root->parent.reset();
+    for (NodePtr<Node>& node : garbage)
+        this->destroySubtree(std::move(node));
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+void NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::union_with(NonRotatingTreap& other) {
+    NodePtr<Node> nodes = adopt(other);
+    Garbage garbage;
+    root = unite(root, nodes, garbage, forkDepth());
+    collect(garbage);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+void NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::intersect_with(NonRotatingTreap& other) {
+    NodePtr<Node> nodes = adopt(other);
+    Garbage garbage;
+    root = intersect(root, nodes, garbage, forkDepth());
+    collect(garbage);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+void NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::difference_with(NonRotatingTreap& other) {
+    NodePtr<Node> nodes = adopt(other);
+    Garbage garbage;
+    root = subtract(root, nodes, garbage, forkDepth());
+    collect(garbage);
+}
+
+// Takes the sorted keys in [first, last) away from the subtree. The range is
+// partitioned around every visited node, so no node is allocated for it and
+// subtrees without any key of the range are not entered.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+template <typename RandomIt>
+NodePtr<Node> NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::eraseSorted(const NodePtr<Node>& node,
+                                                                        RandomIt first, RandomIt last) {
+    if (node == nullptr || first == last)
+        return node;
+    RandomIt lower = std::lower_bound(first, last, node->value, compare);
+    RandomIt upper = std::upper_bound(lower, last, node->value, compare);
+    NodePtr<Node> left = eraseSorted(node->left, first, lower);
+    NodePtr<Node> right = eraseSorted(node->right, upper, last);
+    size_t removed = upper - lower;
+    if (removed >= node->repeat) {
+        destroyNode(node);
+        return merge(left, right);
+    }
+    node->repeat -= removed;
+    node->left = left;
+    if (left)
+        left->parent = node;
+    node->right = right;
+    if (right)
+        right->parent = node;
+    node->update();
+    return node;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+template <typename InputIt>
+void NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::insert_batch(InputIt first, InputIt last) {
+    Garbage garbage;
+    root = unite(root, this->buildFromSorted(first, last), garbage, 0);
+    collect(garbage);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats, typename Priority>
+template <typename InputIt>
+void NonRotatingTreap<T, Compare, Node, Allocator, Stats, Priority>::erase_batch(InputIt first, InputIt last) {
+    using Category = typename std::iterator_traits<InputIt>::iterator_category;
+    if constexpr (std::is_base_of_v<std::random_access_iterator_tag, Category>)
+        root = eraseSorted(root, first, last);
+    else {
+        std::vector<T> keys(first, last);
+        root = eraseSorted(root, keys.begin(), keys.end());
+    }
     if (root)
         root->parent.reset();
 }
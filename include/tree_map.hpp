@@ -0,0 +1,225 @@
+#ifndef TREE_MAP_HPP
+#define TREE_MAP_HPP
+
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <utility>
+
+#include "aatree.hpp"
+#include "avltree.hpp"
+#include "binary_search_tree.hpp"
+#include "rbtree.hpp"
+#include "scapegoat_tree.hpp"
+#include "splay.hpp"
+#include "treap.hpp"
+#include "wavl_tree.hpp"
+
+// Key and mapped value stored together in a node. Only first takes part in the
+// ordering, so second is mutable and can be updated in place through the
+// tree's const iterators without touching the structure.
+template <typename K, typename V>
+struct MapEntry {
+   public:
+    using key_type = K;
+    using mapped_type = V;
+
+    K first;
+    mutable V second;
+
+    MapEntry() = default;
+    explicit MapEntry(K first, V second = V()) : first(std::move(first)), second(std::move(second)) {}
+};
+
+// Used by print().
+template <typename K, typename V>
+std::ostream& operator<<(std::ostream& out, const MapEntry<K, V>& entry) {
+    return out << entry.first << ":" << entry.second;
+}
+
+// Orders entries by key, and lets a bare key (or anything Compare accepts
+// against one) be compared with an entry through the transparent overloads.
+template <typename K, typename V, typename Compare = std::less<K>>
+struct MapCompare {
+   public:
+    using is_transparent = void;
+
+    Compare compare = Compare();
+
+    template <typename A, typename B>
+    bool operator()(const A& a, const B& b) const {
+        return compare(keyOf(a), keyOf(b));
+    }
+
+   private:
+    static const K& keyOf(const MapEntry<K, V>& entry) noexcept { return entry.first; }
+    template <typename Key>
+    static const Key& keyOf(const Key& key) noexcept { return key; }
+};
+
+// Ordered map on top of any of the binary trees over MapEntry<K, V>. Every key
+// is held once (repeat stays 1), rank, select, floor and ceil all work on keys,
+// and a lookup that hits updates the value inside the node it found, so
+// operator[], try_emplace and insert_or_assign descend only once unless they
+// have to insert. Bulk loads keep the first entry of each key, as std::map
+// does, and the treap's insert_batch and union_with, which add up the repeats
+// of equal keys, are not available.
+template <typename Tree>
+class TreeMap : public Tree {
+   public:
+    using value_type = typename Tree::iterator::value_type;
+    using key_type = typename value_type::key_type;
+    using mapped_type = typename value_type::mapped_type;
+    using iterator = typename Tree::iterator;
+
+    using Tree::Tree;
+    TreeMap() = default;
+    template <typename InputIt>
+    TreeMap(InputIt first, InputIt last) { assign_sorted(first, last); }
+
+    template <typename InputIt>
+    void assign_sorted(InputIt first, InputIt last) { this->assignSorted(first, last, true); }
+    template <typename InputIt>
+    void insert_batch(InputIt first, InputIt last) = delete;
+    template <typename Other>
+    void union_with(Other& other) = delete;
+
+    // Inserting an entry whose key is present leaves the map unchanged. The
+    // tree's own emplace would reach the tree's insert rather than these, so
+    // the map brings its own.
+    void insert(const value_type& entry);
+    void insert(value_type&& entry);
+    template <typename... Args>
+    void emplace(Args&&... args) { insert(value_type(std::forward<Args>(args)...)); }
+    iterator insert(iterator hint, const value_type& entry);
+    iterator insert(iterator hint, value_type&& entry);
+
+    mapped_type& operator[](const key_type& key);
+    mapped_type& operator[](key_type&& key);
+    mapped_type& at(const key_type& key);
+    const mapped_type& at(const key_type& key) const;
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const key_type& key, Args&&... args);
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(key_type&& key, Args&&... args);
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(const key_type& key, M&& object);
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(key_type&& key, M&& object);
+    size_t erase(const key_type& key);
+};
+
+template <typename Tree>
+void TreeMap<Tree>::insert(const value_type& entry) {
+    if (this->findNode(entry.first) == nullptr)
+        this->insertValue(entry);
+}
+
+template <typename Tree>
+void TreeMap<Tree>::insert(value_type&& entry) {
+    if (this->findNode(entry.first) == nullptr)
+        this->insertValue(std::move(entry));
+}
+
+template <typename Tree>
+typename TreeMap<Tree>::iterator TreeMap<Tree>::insert(iterator hint, const value_type& entry) {
+    iterator found = this->find_from(hint, entry);
+    return found != this->end() ? found : Tree::insert(hint, entry);
+}
+
+template <typename Tree>
+typename TreeMap<Tree>::iterator TreeMap<Tree>::insert(iterator hint, value_type&& entry) {
+    iterator found = this->find_from(hint, entry);
+    return found != this->end() ? found : Tree::insert(hint, std::move(entry));
+}
+
+template <typename Tree>
+typename TreeMap<Tree>::mapped_type& TreeMap<Tree>::operator[](const key_type& key) {
+    return try_emplace(key).first->second;
+}
+
+template <typename Tree>
+typename TreeMap<Tree>::mapped_type& TreeMap<Tree>::operator[](key_type&& key) {
+    return try_emplace(std::move(key)).first->second;
+}
+
+template <typename Tree>
+typename TreeMap<Tree>::mapped_type& TreeMap<Tree>::at(const key_type& key) {
+    return const_cast<mapped_type&>(static_cast<const TreeMap&>(*this).at(key));
+}
+
+template <typename Tree>
+const typename TreeMap<Tree>::mapped_type& TreeMap<Tree>::at(const key_type& key) const {
+    auto node = this->findNode(key);
+    if (node == nullptr)
+        throw std::out_of_range("TreeMap::at");
+    return node->value.second;
+}
+
+// The key is only moved into a new node once the lookup has missed.
+template <typename Tree>
+template <typename... Args>
+std::pair<typename TreeMap<Tree>::iterator, bool> TreeMap<Tree>::try_emplace(const key_type& key, Args&&... args) {
+    if (auto node = this->findNode(key))
+        return {this->iteratorAt(node), false};
+    return {this->iteratorAt(this->insertValue(value_type(key, mapped_type(std::forward<Args>(args)...)))), true};
+}
+
+template <typename Tree>
+template <typename... Args>
+std::pair<typename TreeMap<Tree>::iterator, bool> TreeMap<Tree>::try_emplace(key_type&& key, Args&&... args) {
+    if (auto node = this->findNode(key))
+        return {this->iteratorAt(node), false};
+    return {this->iteratorAt(this->insertValue(value_type(std::move(key), mapped_type(std::forward<Args>(args)...)))), true};
+}
+
+template <typename Tree>
+template <typename M>
+std::pair<typename TreeMap<Tree>::iterator, bool> TreeMap<Tree>::insert_or_assign(const key_type& key, M&& object) {
+    if (auto node = this->findNode(key)) {
+        node->value.second = std::forward<M>(object);
+        return {this->iteratorAt(node), false};
+    }
+    return {this->iteratorAt(this->insertValue(value_type(key, std::forward<M>(object)))), true};
+}
+
+template <typename Tree>
+template <typename M>
+std::pair<typename TreeMap<Tree>::iterator, bool> TreeMap<Tree>::insert_or_assign(key_type&& key, M&& object) {
+    if (auto node = this->findNode(key)) {
+        node->value.second = std::forward<M>(object);
+        return {this->iteratorAt(node), false};
+    }
+    return {this->iteratorAt(this->insertValue(value_type(std::move(key), std::forward<M>(object)))), true};
+}
+
+// Returns the number of entries removed, which is 0 or 1.
+template <typename Tree>
+size_t TreeMap<Tree>::erase(const key_type& key) {
+    size_t before = this->size();
+    this->remove(key);
+    return before - this->size();
+}
+
+template <typename K, typename V, typename Compare = std::less<K>>
+using BinarySearchTreeMap = TreeMap<BinarySearchTree<MapEntry<K, V>, MapCompare<K, V, Compare>>>;
+template <typename K, typename V, typename Compare = std::less<K>>
+using AVLMap = TreeMap<AVLTree<MapEntry<K, V>, MapCompare<K, V, Compare>>>;
+template <typename K, typename V, typename Compare = std::less<K>>
+using WAVLMap = TreeMap<WAVLTree<MapEntry<K, V>, MapCompare<K, V, Compare>>>;
+template <typename K, typename V, typename Compare = std::less<K>>
+using AAMap = TreeMap<AATree<MapEntry<K, V>, MapCompare<K, V, Compare>>>;
+template <typename K, typename V, typename Compare = std::less<K>>
+using RBMap = TreeMap<RBTree<MapEntry<K, V>, MapCompare<K, V, Compare>>>;
+template <typename K, typename V, typename Compare = std::less<K>>
+using TopDownRBMap = TreeMap<TopDownRBTree<MapEntry<K, V>, MapCompare<K, V, Compare>>>;
+template <typename K, typename V, typename Compare = std::less<K>>
+using SplayMap = TreeMap<Splay<MapEntry<K, V>, MapCompare<K, V, Compare>>>;
+template <typename K, typename V, typename Compare = std::less<K>>
+using ScapegoatMap = TreeMap<ScapegoatTree<MapEntry<K, V>, MapCompare<K, V, Compare>>>;
+template <typename K, typename V, typename Compare = std::less<K>>
+using TreapMap = TreeMap<Treap<MapEntry<K, V>, MapCompare<K, V, Compare>>>;
+template <typename K, typename V, typename Compare = std::less<K>>
+using NonRotatingTreapMap = TreeMap<NonRotatingTreap<MapEntry<K, V>, MapCompare<K, V, Compare>>>;
+
+#endif  // TREE_MAP_HPP
@@ -0,0 +1,86 @@
+#ifndef TREE_STATS_HPP
+#define TREE_STATS_HPP
+
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+// Counters a tree keeps when its Stats policy is TreeStats. They only ever grow
+// until reset_statistics(); divide by the number of operations run in between
+// for per-operation figures.
+struct TreeStatistics {
+    size_t comparisons = 0;
+    // Nodes the descents step through, not counting rebalancing on the way up.
+    size_t visits = 0;
+    // Single rotations, wherever they happen: rebalancing, treap sift-up,
+    // splaying and AA skews and splits are all made of them.
+    size_t rotations = 0;
+    size_t rebuilds = 0;
+    size_t rebuiltNodes = 0;
+    size_t splays = 0;
+    // Sum of the depths the splayed nodes started from.
+    size_t splayPathLength = 0;
+    size_t skews = 0;
+    size_t splits = 0;
+};
+
+// The default policy: every hook is empty and inlines away, so a tree built
+// with it compiles to the same code as one with no hooks at all.
+struct NoTreeStats {
+    static constexpr bool enabled = false;
+
+    void visit() noexcept {}
+    void rotation() noexcept {}
+    void rebuild(size_t) noexcept {}
+    void splay(size_t) noexcept {}
+    void skew() noexcept {}
+    void split() noexcept {}
+};
+
+struct TreeStats : TreeStatistics {
+    static constexpr bool enabled = true;
+
+    void visit() noexcept { ++visits; }
+    void rotation() noexcept { ++rotations; }
+    void rebuild(size_t nodes) noexcept {
+        ++rebuilds;
+        rebuiltNodes += nodes;
+    }
+    void splay(size_t depth) noexcept {
+        ++splays;
+        splayPathLength += depth;
+    }
+    void skew() noexcept { ++skews; }
+    void split() noexcept { ++splits; }
+};
+
+// Counts the comparisons made through it. It derives from Compare so that it
+// still converts to one, and keeps Compare's is_transparent.
+template <typename Compare>
+struct CountingCompare : Compare {
+    mutable size_t comparisons = 0;
+
+    template <typename A, typename B>
+    bool operator()(const A& a, const B& b) const {
+        ++comparisons;
+        return Compare::operator()(a, b);
+    }
+};
+
+// The comparator a tree holds: Compare itself unless statistics are on.
+template <typename Compare, typename Stats>
+using StatsCompare = std::conditional_t<Stats::enabled, CountingCompare<Compare>, Compare>;
+
+// Shape of a tree as of one O(n) walk. Depths start at 0 for the root, and
+// depthHistogram[d] is the number of nodes at depth d.
+struct ShapeReport {
+    size_t nodes = 0;
+    size_t height = 0;
+    double averageDepth = 0;
+    std::vector<size_t> depthHistogram;
+    // Bytes one node takes, including the shared_ptr control block allocated
+    // along with it when nodes are linked through std::shared_ptr.
+    size_t bytesPerNode = 0;
+};
+
+#endif  // TREE_STATS_HPP
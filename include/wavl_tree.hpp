@@ -0,0 +1,296 @@
+#ifndef WAVL_TREE_HPP
+#define WAVL_TREE_HPP
+
+#include <algorithm>
+
+#include "binary_search_tree.hpp"
+
+template <typename T>
+struct WAVLTreeNode {
+   public:
+    T value;
+    std::weak_ptr<WAVLTreeNode<T>> parent;
+    std::shared_ptr<WAVLTreeNode<T>> children[2];
+    std::shared_ptr<WAVLTreeNode<T>>& left = children[0];
+    std::shared_ptr<WAVLTreeNode<T>>& right = children[1];
+    size_t size, count, repeat;
+    int rank;
+
+    WAVLTreeNode() = default;
+    WAVLTreeNode(T value, size_t repeat = 1)
+        : value(std::move(value)), size(repeat), count(repeat), repeat(repeat), rank(0) {}
+
+    ~WAVLTreeNode() = default;
+
+    inline void update() {
+        count = 1 + (left ? left->count : 0) + (right ? right->count : 0);
+        size = repeat + (left ? left->size : 0) + (right ? right->size : 0);
+    }
+};
+
+template <typename T, typename SizeType = std::uint32_t>
+struct CompactWAVLTreeNode : CompactNodeBase<CompactWAVLTreeNode<T, SizeType>, T, SizeType> {
+   public:
+    std::int8_t rank;
+
+    CompactWAVLTreeNode() = default;
+    CompactWAVLTreeNode(T value, SizeType repeat = 1)
+        : CompactNodeBase<CompactWAVLTreeNode<T, SizeType>, T, SizeType>(std::move(value), repeat), rank(0) {}
+};
+
+// Weak AVL tree (Haeupler, Sen and Tarjan). Every node has a rank, an empty
+// subtree has rank -1, and every child ranks one or two below its parent, with
+// the leaves at rank 0. Insertions rebalance exactly like an AVL tree, so a
+// tree that only ever grew is one; deletions only demote ranks up the path and
+// end with at most two rotations, which makes rebalancing O(1) amortized per
+// update, while the height stays below 2 log n.
+template <typename T, typename Compare = std::less<T>, typename Node = WAVLTreeNode<T>, typename Allocator = std::allocator<Node>, typename Stats = NoTreeStats>
+class WAVLTree : public BinarySearchTree<T, Compare, Node, Allocator, Stats, WAVLTree<T, Compare, Node, Allocator, Stats>> {
+    using Base = BinarySearchTree<T, Compare, Node, Allocator, Stats, WAVLTree>;
+    friend Base;
+    using Base::root;
+    using Base::compare;
+    using Base::createNode;
+    using Base::destroyNode;
+    using Base::rotate;
+    using Base::stats;
+    using Base::transplant;
+
+   protected:
+    static int rankOf(const NodePtr<Node>& node) noexcept { return node ? node->rank : -1; }
+
+    NodePtr<Node> buildSorted(NodePtr<Node> head, size_t n);
+    int assignRanks(const NodePtr<Node>& node);
+    void insertFixup(NodePtr<Node> node);
+    void removeFixup(NodePtr<Node> node, NodePtr<Node> parent);
+    int checkRanks(const NodePtr<Node>& node) const;
+    template <typename Value>
+    NodePtr<Node> insertValue(Value&& value) { return insertValue(std::forward<Value>(value), root); }
+    template <typename Value>
+    NodePtr<Node> insertValue(Value&& value, NodePtr<Node> from);
+    template <typename Key>
+    void removeKey(const Key& key);
+
+   public:
+    using typename Base::iterator;
+
+    WAVLTree() = default;
+    explicit WAVLTree(const Allocator& allocator) : Base(allocator) {}
+    template <typename InputIt>
+    WAVLTree(InputIt first, InputIt last) { this->assign_sorted(first, last); }
+    WAVLTree(const WAVLTree&) = delete;
+    WAVLTree(WAVLTree&&) = default;
+    WAVLTree& operator=(const WAVLTree&) = delete;
+    WAVLTree& operator=(WAVLTree&&) = default;
+    ~WAVLTree() = default;
+
+    void insert(const T& value) { insertValue(value); }
+    void insert(T&& value) { insertValue(std::move(value)); }
+    iterator insert(iterator hint, const T& value) { return this->iteratorAt(insertValue(value, this->fingerNode(hint, value))); }
+    iterator insert(iterator hint, T&& value) {
+        NodePtr<Node> from = this->fingerNode(hint, value);
+        return this->iteratorAt(insertValue(std::move(value), from));
+    }
+    void remove(const T& value) { removeKey(value); }
+    template <typename Key, typename C = Compare, typename = typename C::is_transparent>
+    void remove(const Key& key) { removeKey(key); }
+
+    void check();
+};
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+NodePtr<Node> WAVLTree<T, Compare, Node, Allocator, Stats>::buildSorted(NodePtr<Node> head, size_t n) {
+    NodePtr<Node> node = this->buildBalanced(head, n);
+    assignRanks(node);
+    return node;
+}
+
+// The subtree heights of a balanced tree differ by at most one, so ranking
+// every node by its height makes every rank difference 1 or 2.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+int WAVLTree<T, Compare, Node, Allocator, Stats>::assignRanks(const NodePtr<Node>& node) {
+    if (node == nullptr)
+        return -1;
+    node->rank = 1 + std::max(assignRanks(node->left), assignRanks(node->right));
+    return node->rank;
+}
+
+// node has just been linked in at rank 0 or promoted, and may now have its
+// parent's rank. Promotions carry that up while the sibling ranks one below
+// the parent; otherwise one single or double rotation ends it.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+void WAVLTree<T, Compare, Node, Allocator, Stats>::insertFixup(NodePtr<Node> node) {
+    for (NodePtr<Node> parent = node->parent.lock(); parent && parent->rank == node->rank; parent = node->parent.lock()) {
+        size_t direction = parent->right == node;
+        if (parent->rank - rankOf(childOf(parent, !direction)) == 1) {
+            ++(parent->rank);
+            node = parent;
+            continue;
+        }
+        NodePtr<Node> inner = childOf(node, !direction);
+        if (node->rank - rankOf(inner) == 2) {
+            rotate(parent, !direction);
+            --(parent->rank);
+        } else {
+            rotate(node, direction);
+            rotate(parent, !direction);
+            ++(inner->rank);
+            --(node->rank);
+            --(parent->rank);
+        }
+        break;
+    }
+}
+
+// node, possibly empty, has just taken the place of a removed node below
+// parent. A parent left as a leaf of rank 1 is demoted, and so is every parent
+// whose child now ranks three below it, together with the sibling if both of
+// its children rank two below it. A sibling one below with a child one below
+// it is rotated up instead, which ends it.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+void WAVLTree<T, Compare, Node, Allocator, Stats>::removeFixup(NodePtr<Node> node, NodePtr<Node> parent) {
+    if (parent && isLeaf(parent) && parent->rank == 1) {
+        parent->rank = 0;
+        node = parent;
+        parent = node->parent.lock();
+    }
+    while (parent && parent->rank - rankOf(node) == 3) {
+        size_t direction = parent->right == node;
+        NodePtr<Node> sibling = childOf(parent, !direction);
+        if (parent->rank - sibling->rank == 2) {
+            --(parent->rank);
+        } else if (sibling->rank - rankOf(sibling->left) == 2 && sibling->rank - rankOf(sibling->right) == 2) {
+            --(parent->rank);
+            --(sibling->rank);
+        } else {
+            NodePtr<Node> inner = childOf(sibling, direction);
+            if (sibling->rank - rankOf(childOf(sibling, !direction)) == 1) {
+                rotate(parent, direction);
+                ++(sibling->rank);
+                --(parent->rank);
+                if (isLeaf(parent))
+                    --(parent->rank);
+            } else {
+                rotate(sibling, !direction);
+                rotate(parent, direction);
+                inner->rank += 2;
+                --(sibling->rank);
+                parent->rank -= 2;
+            }
+            break;
+        }
+        node = parent;
+        parent = node->parent.lock();
+    }
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+template <typename Value>
+NodePtr<Node> WAVLTree<T, Compare, Node, Allocator, Stats>::insertValue(Value&& value, NodePtr<Node> from) {
+    if (root == nullptr)
+        return root = createNode(std::forward<Value>(value));
+
+    NodePtr<Node> node = std::move(from), parent = nullptr;
+    while (node != nullptr) {
+        stats.visit();
+        parent = node;
+        if (compare(value, node->value))
+            node = node->left;
+        else if (compare(node->value, value))
+            node = node->right;
+        else
+            break;
+    }
+    if (node != nullptr) {
+        ++(node->repeat);
+        for (NodePtr<Node> current = node; current != nullptr; current = current->parent.lock())
+            ++(current->size);
+        return node;
+    }
+
+    size_t direction = compare(parent->value, value);
+    node = createNode(std::forward<Value>(value));
+    childOf(parent, direction) = node;
+    node->parent = parent;
+    // Rotations keep the counts of the nodes they move, so they are brought up to
+    // date before the ranks are repaired.
+    for (NodePtr<Node> current = parent; current != nullptr; current = current->parent.lock()) {
+        ++(current->count);
+        ++(current->size);
+    }
+    insertFixup(node);
+    return node;
+}
+
+// The node leaves as in RBTree::removeKey, its successor taking over its place
+// and rank if it has two children. The counts are then adjusted as in
+// AVLTree::removeKey, all the way up, before the ranks are repaired.
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+template <typename Key>
+void WAVLTree<T, Compare, Node, Allocator, Stats>::removeKey(const Key& key) {
+    NodePtr<Node> node = this->findNode(key);
+    if (node == nullptr)
+        return;
+    if (node->repeat > 1) {
+        --(node->repeat);
+        for (; node != nullptr; node = node->parent.lock())
+            --(node->size);
+        return;
+    }
+
+    NodePtr<Node> child, parent, successor = nullptr;
+    if (node->left && node->right) {
+        successor = node->right;
+        while (successor->left)
+            successor = successor->left;
+        child = successor->right;
+        if (successor == node->right)
+            parent = successor;
+        else {
+            parent = successor->parent.lock();
+            transplant(successor, child);
+            successor->right = node->right;
+            successor->right->parent = successor;
+        }
+        transplant(node, successor);
+        successor->left = node->left;
+        successor->left->parent = successor;
+        successor->rank = node->rank;
+    } else {
+        child = node->left ? node->left : node->right;
+        parent = node->parent.lock();
+        transplant(node, child);
+    }
+
+    size_t moved = successor ? successor->repeat : 1;
+    for (NodePtr<Node> current = parent; current != nullptr; current = current->parent.lock()) {
+        if (current == successor) {
+            current->update();
+            moved = 1;
+            continue;
+        }
+        --(current->count);
+        current->size -= moved;
+    }
+    removeFixup(child, parent);
+    destroyNode(node);
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+int WAVLTree<T, Compare, Node, Allocator, Stats>::checkRanks(const NodePtr<Node>& node) const {
+    if (node == nullptr)
+        return -1;
+    int left = checkRanks(node->left), right = checkRanks(node->right);
+    assert(node->rank - left >= 1 && node->rank - left <= 2);
+    assert(node->rank - right >= 1 && node->rank - right <= 2);
+    assert(!isLeaf(node) || node->rank == 0);
+    return node->rank;
+}
+
+template <typename T, typename Compare, typename Node, typename Allocator, typename Stats>
+void WAVLTree<T, Compare, Node, Allocator, Stats>::check() {
+    Base::check();
+    checkRanks(root);
+}
+
+#endif  // WAVL_TREE_HPP
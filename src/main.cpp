@@ -1,8 +1,76 @@
 #include <benchmark/benchmark.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "aatree.hpp"
+#include "any_tree.hpp"
+#include "avltree.hpp"
 #include "binary_search_tree.hpp"
+#include "btree.hpp"
+#include "concurrent_treap.hpp"
+#include "node_pool.hpp"
+#include "persistent_tree.hpp"
+#include "rbtree.hpp"
+#include "scapegoat_tree.hpp"
+#include "sharded_tree.hpp"
 #include "splay.hpp"
 #include "treap.hpp"
+#include "tree_map.hpp"
+#include "wavl_tree.hpp"
+
+static size_t allocations = 0;
+static size_t allocatedBytes = 0;
+
+// The counting operators are kept out of line: inlined into their callers, GCC
+// pairs the malloc in one with the free in another and reports a mismatched
+// new and delete.
+[[gnu::noinline]] void* operator new(size_t size) {
+    ++allocations;
+    allocatedBytes += size;
+    if (void* pointer = std::malloc(size ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void* operator new(size_t size, std::align_val_t alignment) {
+    ++allocations;
+    allocatedBytes += size;
+    size_t align = static_cast<size_t>(alignment);
+    if (void* pointer = std::aligned_alloc(align, (size + align - 1) / align * align))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* pointer) noexcept { std::free(pointer); }
+[[gnu::noinline]] void operator delete(void* pointer, size_t) noexcept { std::free(pointer); }
+[[gnu::noinline]] void operator delete(void* pointer, std::align_val_t) noexcept { std::free(pointer); }
+[[gnu::noinline]] void operator delete(void* pointer, size_t, std::align_val_t) noexcept { std::free(pointer); }
+
+static std::vector<int> shuffledKeys(int n) {
+    std::vector<int> keys(n);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+    return keys;
+}
+
+// 0, 2, ..., 2 * (n - 1): an odd key lies between any two of them, for lookups
+// that miss and for inserts of new keys.
+static std::vector<int> evenKeys(size_t n) {
+    std::vector<int> keys(n);
+    for (size_t i = 0; i < n; ++i)
+        keys[i] = i * 2;
+    return keys;
+}
 
 static void BinarySearchTreeInsert(benchmark::State& state) {
     int n = state.range(0);
@@ -39,4 +107,997 @@ static void TreapInsert(benchmark::State& state) {
 
 BENCHMARK(TreapInsert)->RangeMultiplier(10)->Range(10, 10000);
 
-BENCHMARK_MAIN();
\ No newline at end of file
+template <typename Tree>
+static void InsertAllocations(benchmark::State& state) {
+    std::vector<int> keys = shuffledKeys(state.range(0));
+    size_t before = allocations;
+    for (auto _ : state) {
+        Tree tree;
+        for (int key : keys)
+            tree.insert(key);
+    }
+    state.counters["allocs/op"] = benchmark::Counter(allocations - before, benchmark::Counter::kAvgIterations);
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+template <typename Tree>
+static void InsertClearAllocations(benchmark::State& state) {
+    std::vector<int> keys = shuffledKeys(state.range(0));
+    Tree tree;
+    size_t before = allocations;
+    for (auto _ : state) {
+        for (int key : keys)
+            tree.insert(key);
+        tree.clear();
+    }
+    state.counters["allocs/op"] = benchmark::Counter(allocations - before, benchmark::Counter::kAvgIterations);
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+using PooledTreap = Treap<int, std::less<int>, TreapNode<int>, PoolAllocator<TreapNode<int>>>;
+using PooledAVLTree = AVLTree<int, std::less<int>, AVLTreeNode<int>, PoolAllocator<AVLTreeNode<int>>>;
+using PooledAATree = AATree<int, std::less<int>, AATreeNode<int>, PoolAllocator<AATreeNode<int>>>;
+using PooledRBTree = RBTree<int, std::less<int>, RBTreeNode<int>, PoolAllocator<RBTreeNode<int>>>;
+using CompactTreap = Treap<int, std::less<int>, CompactTreapNode<int>>;
+using CompactAVLTree = AVLTree<int, std::less<int>, CompactAVLTreeNode<int>>;
+using CompactAATree = AATree<int, std::less<int>, CompactAATreeNode<int>>;
+using CompactRBTree = RBTree<int, std::less<int>, CompactRBTreeNode<int>>;
+using CompactWAVLTree = WAVLTree<int, std::less<int>, CompactWAVLTreeNode<int>>;
+using PooledCompactAVLTree = AVLTree<int, std::less<int>, CompactAVLTreeNode<int>, PoolAllocator<CompactAVLTreeNode<int>>>;
+
+static_assert(sizeof(CompactBinaryNode<int>) <= 64);
+static_assert(sizeof(CompactTreapNode<int>) <= 64);
+static_assert(sizeof(CompactAVLTreeNode<int>) <= 64);
+static_assert(sizeof(CompactAATreeNode<int>) <= 64);
+static_assert(sizeof(CompactRBTreeNode<int>) <= 64);
+static_assert(sizeof(CompactWAVLTreeNode<int>) <= 64);
+
+BENCHMARK_TEMPLATE(InsertAllocations, Treap<int>)->RangeMultiplier(10)->Range(1000, 100000);
+BENCHMARK_TEMPLATE(InsertAllocations, PooledTreap)->RangeMultiplier(10)->Range(1000, 100000);
+BENCHMARK_TEMPLATE(InsertAllocations, AVLTree<int>)->RangeMultiplier(10)->Range(1000, 100000);
+BENCHMARK_TEMPLATE(InsertAllocations, PooledAVLTree)->RangeMultiplier(10)->Range(1000, 100000);
+BENCHMARK_TEMPLATE(InsertAllocations, AATree<int>)->RangeMultiplier(10)->Range(1000, 100000);
+BENCHMARK_TEMPLATE(InsertAllocations, PooledAATree)->RangeMultiplier(10)->Range(1000, 100000);
+BENCHMARK_TEMPLATE(InsertAllocations, RBTree<int>)->RangeMultiplier(10)->Range(1000, 100000);
+BENCHMARK_TEMPLATE(InsertAllocations, PooledRBTree)->RangeMultiplier(10)->Range(1000, 100000);
+BENCHMARK_TEMPLATE(InsertAllocations, CompactTreap)->RangeMultiplier(10)->Range(1000, 100000);
+BENCHMARK_TEMPLATE(InsertAllocations, CompactAVLTree)->RangeMultiplier(10)->Range(1000, 100000);
+BENCHMARK_TEMPLATE(InsertAllocations, PooledCompactAVLTree)->RangeMultiplier(10)->Range(1000, 100000);
+BENCHMARK_TEMPLATE(InsertAllocations, CompactAATree)->RangeMultiplier(10)->Range(1000, 100000);
+BENCHMARK_TEMPLATE(InsertAllocations, CompactRBTree)->RangeMultiplier(10)->Range(1000, 100000);
+BENCHMARK_TEMPLATE(InsertAllocations, BTree<int>)->RangeMultiplier(10)->Range(1000, 100000);
+
+BENCHMARK_TEMPLATE(InsertClearAllocations, AVLTree<int>)->RangeMultiplier(10)->Range(1000, 100000);
+BENCHMARK_TEMPLATE(InsertClearAllocations, PooledAVLTree)->RangeMultiplier(10)->Range(1000, 100000);
+BENCHMARK_TEMPLATE(InsertClearAllocations, PooledCompactAVLTree)->RangeMultiplier(10)->Range(1000, 100000);
+
+template <typename Tree>
+static void RangeScan(benchmark::State& state) {
+    int n = state.range(0);
+    std::vector<int> keys = shuffledKeys(n);
+    Tree tree;
+    for (int key : keys)
+        tree.insert(key);
+    std::mt19937 rng(7);
+    for (auto _ : state) {
+        int lo = rng() % n, hi = lo + 100;
+        long sum = 0;
+        for (auto it = tree.lower_bound(lo); it != tree.end() && *it < hi; ++it)
+            sum += *it;
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * 100);
+}
+
+BENCHMARK_TEMPLATE(RangeScan, AVLTree<int>)->RangeMultiplier(10)->Range(1000, 1000000);
+BENCHMARK_TEMPLATE(RangeScan, CompactAVLTree)->RangeMultiplier(10)->Range(1000, 1000000);
+BENCHMARK_TEMPLATE(RangeScan, CompactRBTree)->RangeMultiplier(10)->Range(1000, 1000000);
+
+template <typename Tree>
+static void SortedInsert(benchmark::State& state) {
+    int n = state.range(0);
+    for (auto _ : state) {
+        Tree tree;
+        for (int i = 0; i < n; ++i)
+            tree.insert(i);
+        benchmark::DoNotOptimize(tree.size());
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+// Appends through the iterator the previous insert returned, so that each
+// search starts next to where the key goes.
+template <typename Tree>
+static void SortedHintedInsert(benchmark::State& state) {
+    int n = state.range(0);
+    for (auto _ : state) {
+        Tree tree;
+        auto hint = tree.end();
+        for (int i = 0; i < n; ++i)
+            hint = tree.insert(hint, i);
+        benchmark::DoNotOptimize(tree.size());
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+template <typename Tree>
+static void SortedBulkLoad(benchmark::State& state) {
+    std::vector<int> keys(state.range(0));
+    std::iota(keys.begin(), keys.end(), 0);
+    for (auto _ : state) {
+        Tree tree(keys.begin(), keys.end());
+        benchmark::DoNotOptimize(tree.size());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+BENCHMARK_TEMPLATE(SortedInsert, CompactAVLTree)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(SortedBulkLoad, CompactAVLTree)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(SortedInsert, CompactAATree)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(SortedBulkLoad, CompactAATree)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(SortedInsert, CompactRBTree)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(SortedBulkLoad, CompactRBTree)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(SortedHintedInsert, CompactRBTree)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(SortedInsert, CompactTreap)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(SortedHintedInsert, CompactTreap)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(SortedBulkLoad, CompactTreap)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(SortedInsert, BTree<int>)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(SortedBulkLoad, BTree<int>)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(SortedBulkLoad, PooledCompactAVLTree)->RangeMultiplier(10)->Range(1000, 1000000)->Unit(benchmark::kMicrosecond);
+
+// Sorted micro-batches of 10k keys merged into a tree of state.range(0) keys.
+template <typename Tree>
+static void BatchIngest(benchmark::State& state) {
+    std::vector<int> keys(state.range(0));
+    std::iota(keys.begin(), keys.end(), 0);
+    std::vector<int> batch(10000);
+    std::mt19937 rng(7);
+    std::unique_ptr<Tree> tree;
+    for (auto _ : state) {
+        state.PauseTiming();
+        tree = std::make_unique<Tree>(keys.begin(), keys.end());
+        for (int& key : batch)
+            key = rng() % (keys.size() * 2);
+        std::sort(batch.begin(), batch.end());
+        state.ResumeTiming();
+        if (state.range(1))
+            tree->insert_batch(batch.begin(), batch.end());
+        else
+            for (int key : batch)
+                tree->insert(key);
+        benchmark::DoNotOptimize(tree->size());
+    }
+    state.SetItemsProcessed(state.iterations() * batch.size());
+}
+
+using CompactNonRotatingTreap = NonRotatingTreap<int, std::less<int>, CompactTreapNode<int>>;
+
+BENCHMARK_TEMPLATE(BatchIngest, CompactNonRotatingTreap)->ArgsProduct({{100000, 1000000}, {0, 1}})->Unit(benchmark::kMicrosecond);
+
+// Merges a shard of state.range(0) random keys into another one of the same
+// size, either through union_with or by inserting its keys one at a time.
+template <typename Tree>
+static void ShardUnion(benchmark::State& state) {
+    std::vector<int> keys = shuffledKeys(state.range(0) * 2);
+    std::vector<int> first(keys.begin(), keys.begin() + state.range(0));
+    std::vector<int> second(keys.begin() + state.range(0), keys.end());
+    std::sort(first.begin(), first.end());
+    std::sort(second.begin(), second.end());
+    std::unique_ptr<Tree> tree, other;
+    for (auto _ : state) {
+        state.PauseTiming();
+        tree = std::make_unique<Tree>(first.begin(), first.end());
+        other = std::make_unique<Tree>(second.begin(), second.end());
+        state.ResumeTiming();
+        if (state.range(1))
+            tree->union_with(*other);
+        else
+            for (auto it = other->begin(); it != other->end(); ++it)
+                tree->insert(*it);
+        benchmark::DoNotOptimize(tree->size());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_TEMPLATE(ShardUnion, CompactNonRotatingTreap)->ArgsProduct({{100000, 1000000}, {0, 1}})->UseRealTime()->Unit(benchmark::kMillisecond);
+
+using MerkleTreap = Treap<int, std::less<int>, MerkleTreapNode<int>, std::allocator<MerkleTreapNode<int>>, NoTreeStats, HashPriority<int>>;
+
+// Finds the keys on which two replicas of state.range(0) keys, built in
+// different orders, disagree; the second one misses state.range(1) of them.
+// Either both are walked in lock step (0) or the digests lead to the
+// differences (1).
+static void ReplicaDiff(benchmark::State& state) {
+    std::vector<int> keys = shuffledKeys(state.range(0));
+    MerkleTreap replica, other;
+    for (int key : keys)
+        replica.insert(key);
+    std::reverse(keys.begin(), keys.end());
+    for (size_t i = state.range(1); i < keys.size(); ++i)
+        other.insert(keys[i]);
+    for (auto _ : state) {
+        size_t differences = 0;
+        if (state.range(2)) {
+            if (!replica.same_contents(other))
+                replica.diff(other, [&](const int&, size_t, size_t) { ++differences; });
+        } else {
+            auto first = replica.begin(), second = other.begin();
+            while (first != replica.end() || second != other.end()) {
+                if (second == other.end() || (first != replica.end() && *first < *second))
+                    ++first;
+                else if (first == replica.end() || *second < *first)
+                    ++second;
+                else {
+                    differences += first.repeat() != second.repeat();
+                    ++first;
+                    ++second;
+                    continue;
+                }
+                ++differences;
+            }
+        }
+        benchmark::DoNotOptimize(differences);
+    }
+}
+
+BENCHMARK(ReplicaDiff)->ArgsProduct({{1000000}, {0, 10, 1000}, {0, 1}})->Unit(benchmark::kMicrosecond);
+
+// Random point lookups, half of them misses, against a tree of state.range(0)
+// keys bulk loaded as even numbers, either live or through its frozen snapshot.
+template <typename Tree>
+static void PointLookup(benchmark::State& state) {
+    std::vector<int> keys = evenKeys(state.range(0));
+    Tree tree(keys.begin(), keys.end());
+    std::mt19937 rng(7);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(tree.contains(rng() % (keys.size() * 2)));
+    state.SetItemsProcessed(state.iterations());
+}
+
+template <typename Tree>
+static void FrozenPointLookup(benchmark::State& state) {
+    std::vector<int> keys = evenKeys(state.range(0));
+    auto frozen = Tree(keys.begin(), keys.end()).freeze();
+    std::mt19937 rng(7);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(frozen.contains(rng() % (keys.size() * 2)));
+    state.SetItemsProcessed(state.iterations());
+}
+
+template <typename Tree>
+static void EytzingerPointLookup(benchmark::State& state) {
+    std::vector<int> keys = evenKeys(state.range(0));
+    auto index = Tree(keys.begin(), keys.end()).to_eytzinger();
+    std::mt19937 rng(7);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(index.contains(rng() % (keys.size() * 2)));
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(PointLookup, AVLTree<int>)->RangeMultiplier(10)->Range(100000, 10000000);
+BENCHMARK_TEMPLATE(PointLookup, CompactAVLTree)->RangeMultiplier(10)->Range(100000, 10000000);
+BENCHMARK_TEMPLATE(PointLookup, CompactRBTree)->RangeMultiplier(10)->Range(100000, 10000000);
+BENCHMARK_TEMPLATE(PointLookup, BTree<int>)->RangeMultiplier(10)->Range(100000, 10000000);
+BENCHMARK_TEMPLATE(FrozenPointLookup, CompactAVLTree)->RangeMultiplier(10)->Range(100000, 10000000);
+BENCHMARK_TEMPLATE(EytzingerPointLookup, CompactAVLTree)->RangeMultiplier(10)->Range(100000, 10000000);
+
+// Lookups that each land a few keys past the previous one, from the root or
+// from the iterator the previous lookup returned.
+template <typename Tree>
+static void NearbyLookup(benchmark::State& state) {
+    std::vector<int> keys(state.range(0));
+    std::iota(keys.begin(), keys.end(), 0);
+    Tree tree(keys.begin(), keys.end());
+    bool fromFinger = state.range(1);
+    std::mt19937 rng(7);
+    auto finger = tree.begin();
+    int key = 0;
+    for (auto _ : state) {
+        key = (key + 1 + rng() % 8) % keys.size();
+        finger = fromFinger ? tree.lower_bound_from(finger, key) : tree.lower_bound(key);
+        benchmark::DoNotOptimize(finger);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(NearbyLookup, CompactAVLTree)->ArgsProduct({{100000, 10000000}, {0, 1}});
+BENCHMARK_TEMPLATE(NearbyLookup, CompactRBTree)->ArgsProduct({{100000, 10000000}, {0, 1}});
+
+// Random rank() and select() calls against a tree of state.range(0) keys.
+template <typename Tree>
+static void RankSelect(benchmark::State& state) {
+    std::vector<int> keys(state.range(0));
+    std::iota(keys.begin(), keys.end(), 0);
+    Tree tree(keys.begin(), keys.end());
+    std::mt19937 rng(7);
+    for (auto _ : state) {
+        int key = rng() % keys.size();
+        benchmark::DoNotOptimize(tree.select(tree.rank(key)));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(RankSelect, CompactAVLTree)->RangeMultiplier(10)->Range(100000, 10000000);
+BENCHMARK_TEMPLATE(RankSelect, CompactRBTree)->RangeMultiplier(10)->Range(100000, 10000000);
+BENCHMARK_TEMPLATE(RankSelect, BTree<int>)->RangeMultiplier(10)->Range(100000, 10000000);
+
+// Random point lookups on a small tree called directly, where the call resolves
+// statically, and through AnyTree, where each one is a virtual call. On trees
+// this small the dispatch is a sizeable part of the lookup.
+template <typename Tree>
+static void StaticLookup(benchmark::State& state) {
+    Tree tree;
+    for (int key = 0; key < state.range(0); ++key)
+        tree.insert(key * 2);
+    std::mt19937 rng(7);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(tree.contains(rng() % (state.range(0) * 2)));
+    state.SetItemsProcessed(state.iterations());
+}
+
+template <typename Tree>
+static void ErasedLookup(benchmark::State& state) {
+    auto tree = AnyTree<int>::make<Tree>();
+    for (int key = 0; key < state.range(0); ++key)
+        tree.insert(key * 2);
+    std::mt19937 rng(7);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(tree.contains(rng() % (state.range(0) * 2)));
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(StaticLookup, AVLTree<int>)->Arg(16)->Arg(1024);
+BENCHMARK_TEMPLATE(ErasedLookup, AVLTree<int>)->Arg(16)->Arg(1024);
+BENCHMARK_TEMPLATE(StaticLookup, Splay<int>)->Arg(16)->Arg(1024);
+BENCHMARK_TEMPLATE(ErasedLookup, Splay<int>)->Arg(16)->Arg(1024);
+
+static std::vector<std::string> stringKeys(int n) {
+    std::vector<std::string> keys;
+    for (int key : shuffledKeys(n))
+        keys.push_back("customer/" + std::to_string(key) + "/orders/pending/archive");
+    return keys;
+}
+
+// Builds a tree of state.range(0) string keys, too long for the small string
+// buffer, handing them over by copy (0) or by move (1).
+template <typename Tree>
+static void StringInsert(benchmark::State& state) {
+    std::vector<std::string> keys = stringKeys(state.range(0));
+    bool move = state.range(1);
+    size_t inserting = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::vector<std::string> batch = keys;
+        Tree tree;
+        size_t before = allocations;
+        state.ResumeTiming();
+        for (std::string& key : batch) {
+            if (move)
+                tree.insert(std::move(key));
+            else
+                tree.insert(key);
+        }
+        state.PauseTiming();
+        inserting += allocations - before;
+        state.ResumeTiming();
+    }
+    state.counters["allocs/op"] = benchmark::Counter(inserting, benchmark::Counter::kAvgIterations);
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+// Looks up keys that arrive as string_views, as when they are sliced out of a
+// request, either through a std::string built from each (0) or directly with
+// the transparent comparator (1).
+template <typename Tree>
+static void StringViewLookup(benchmark::State& state) {
+    std::vector<std::string> keys = stringKeys(state.range(0));
+    Tree tree;
+    for (const std::string& key : keys)
+        tree.insert(key);
+    std::string buffer;
+    std::vector<std::pair<size_t, size_t>> spans;
+    for (const std::string& key : keys) {
+        spans.emplace_back(buffer.size(), key.size());
+        buffer += key;
+    }
+    bool transparent = state.range(1);
+    size_t i = 0, before = allocations;
+    for (auto _ : state) {
+        std::string_view view(buffer.data() + spans[i].first, spans[i].second);
+        if (transparent)
+            benchmark::DoNotOptimize(tree.contains(view));
+        else
+            benchmark::DoNotOptimize(tree.contains(std::string(view)));
+        i = i + 1 == spans.size() ? 0 : i + 1;
+    }
+    state.counters["allocs/op"] = benchmark::Counter(allocations - before, benchmark::Counter::kAvgIterations);
+    state.SetItemsProcessed(state.iterations());
+}
+
+using StringAVLTree = AVLTree<std::string, std::less<>>;
+using CompactStringAVLTree = AVLTree<std::string, std::less<>, CompactAVLTreeNode<std::string>>;
+using StringBTree = BTree<std::string, std::less<>>;
+
+BENCHMARK_TEMPLATE(StringInsert, StringAVLTree)->ArgsProduct({{100000}, {0, 1}})->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(StringInsert, CompactStringAVLTree)->ArgsProduct({{100000}, {0, 1}})->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(StringInsert, StringBTree)->ArgsProduct({{100000}, {0, 1}})->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(StringViewLookup, StringAVLTree)->ArgsProduct({{100000}, {0, 1}});
+BENCHMARK_TEMPLATE(StringViewLookup, CompactStringAVLTree)->ArgsProduct({{100000}, {0, 1}});
+BENCHMARK_TEMPLATE(StringViewLookup, StringBTree)->ArgsProduct({{100000}, {0, 1}});
+
+// Point lookups from state.threads() threads on a shared set of 1M even keys.
+// With state.range(0) set, thread 0 is a writer inserting and removing random
+// keys instead, so that readers keep running into fresh versions.
+static ConcurrentTreap<int>& sharedConcurrentTreap() {
+    static ConcurrentTreap<int> tree = [] {
+        std::vector<int> keys = evenKeys(1000000);
+        return ConcurrentTreap<int>(keys.begin(), keys.end());
+    }();
+    return tree;
+}
+
+static void ConcurrentRead(benchmark::State& state) {
+    ConcurrentTreap<int>& tree = sharedConcurrentTreap();
+    std::mt19937 rng(state.thread_index());
+    if (state.range(0) && state.thread_index() == 0) {
+        for (auto _ : state) {
+            int key = rng() % 2000000;
+            if (rng() % 2)
+                tree.insert(key);
+            else
+                tree.remove(key);
+        }
+        return;
+    }
+    auto reader = tree.reader();
+    for (auto _ : state)
+        benchmark::DoNotOptimize(reader.contains(rng() % 2000000));
+    state.SetItemsProcessed(state.iterations());
+}
+
+// The same workload on a compact AVL tree behind a reader-writer lock.
+static void LockedRead(benchmark::State& state) {
+    using Tree = AVLTree<int, std::less<int>, CompactAVLTreeNode<int>>;
+    static std::shared_mutex mutex;
+    static Tree tree = [] {
+        std::vector<int> keys = evenKeys(1000000);
+        return Tree(keys.begin(), keys.end());
+    }();
+    std::mt19937 rng(state.thread_index());
+    if (state.range(0) && state.thread_index() == 0) {
+        for (auto _ : state) {
+            int key = rng() % 2000000;
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            if (rng() % 2)
+                tree.insert(key);
+            else
+                tree.remove(key);
+        }
+        return;
+    }
+    for (auto _ : state) {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        benchmark::DoNotOptimize(tree.contains(rng() % 2000000));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(ConcurrentRead)->Arg(0)->ThreadRange(1, 32)->UseRealTime();
+BENCHMARK(ConcurrentRead)->Arg(1)->ThreadRange(2, 32)->UseRealTime();
+BENCHMARK(LockedRead)->Arg(0)->ThreadRange(1, 32)->UseRealTime();
+BENCHMARK(LockedRead)->Arg(1)->ThreadRange(2, 32)->UseRealTime();
+
+// Alternates inserting and removing random keys on a tree of state.range(0)
+// keys, half of which hit a key that is present.
+template <typename Tree>
+static void MixedChurn(benchmark::State& state) {
+    std::vector<int> keys = evenKeys(state.range(0));
+    Tree tree(keys.begin(), keys.end());
+    std::mt19937 rng(11);
+    bool insert = true;
+    for (auto _ : state) {
+        int key = rng() % (keys.size() * 2);
+        if (insert)
+            tree.insert(key);
+        else
+            tree.remove(key);
+        insert = !insert;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+using CompactTopDownRBTree = TopDownRBTree<int, std::less<int>, CompactRBTreeNode<int>>;
+
+BENCHMARK_TEMPLATE(MixedChurn, RBTree<int>)->Arg(1000000);
+BENCHMARK_TEMPLATE(MixedChurn, TopDownRBTree<int>)->Arg(1000000);
+BENCHMARK_TEMPLATE(MixedChurn, AVLTree<int>)->Arg(1000000);
+BENCHMARK_TEMPLATE(MixedChurn, WAVLTree<int>)->Arg(1000000);
+BENCHMARK_TEMPLATE(MixedChurn, AATree<int>)->Arg(1000000);
+BENCHMARK_TEMPLATE(MixedChurn, CompactRBTree)->Arg(1000000);
+BENCHMARK_TEMPLATE(MixedChurn, CompactTopDownRBTree)->Arg(1000000);
+BENCHMARK_TEMPLATE(MixedChurn, CompactAVLTree)->Arg(1000000);
+BENCHMARK_TEMPLATE(MixedChurn, CompactWAVLTree)->Arg(1000000);
+BENCHMARK_TEMPLATE(MixedChurn, CompactAATree)->Arg(1000000);
+
+template <typename Tree>
+static std::unique_ptr<ShardedTree<Tree>> evenShardedTree(size_t shards) {
+    std::vector<int> keys = evenKeys(1000000);
+    return std::make_unique<ShardedTree<Tree>>(keys.begin(), keys.end(), shards);
+}
+
+// Every thread inserts and removes odd keys spread over the whole key space, on
+// one shared tree of 1M even keys with a single shard (one lock) or 64.
+template <typename Tree>
+static void ShardedWrite(benchmark::State& state) {
+    static std::unique_ptr<ShardedTree<Tree>> trees[2] = {evenShardedTree<Tree>(1), evenShardedTree<Tree>(64)};
+    ShardedTree<Tree>& tree = *trees[state.range(0)];
+    std::mt19937 rng(state.thread_index());
+    for (auto _ : state) {
+        int key = rng() % 1000000 * 2 + 1;
+        tree.insert(key);
+        tree.remove(key);
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+
+BENCHMARK_TEMPLATE(ShardedWrite, CompactAVLTree)->Arg(0)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(ShardedWrite, CompactAVLTree)->Arg(1)->ThreadRange(1, 64)->UseRealTime();
+
+// Keeps a version of the tree of state.range(0) keys before every update. The
+// persistent trees share all but the copied path with the kept version; a
+// mutable tree has to be frozen into a full copy.
+template <typename Tree>
+static void VersionedUpdate(benchmark::State& state) {
+    std::vector<int> keys = shuffledKeys(state.range(0));
+    std::sort(keys.begin(), keys.end());
+    Tree tree(keys.begin(), keys.end());
+    std::mt19937 rng(7);
+    size_t before = allocations;
+    for (auto _ : state) {
+        int key = rng() % keys.size();
+        Tree version = tree.snapshot();
+        tree.remove(key);
+        tree.insert(key);
+        benchmark::DoNotOptimize(version.size());
+    }
+    state.counters["allocs/op"] = benchmark::Counter(allocations - before, benchmark::Counter::kAvgIterations);
+    state.SetItemsProcessed(state.iterations());
+}
+
+template <typename Tree>
+static void FrozenVersionedUpdate(benchmark::State& state) {
+    std::vector<int> keys = shuffledKeys(state.range(0));
+    std::sort(keys.begin(), keys.end());
+    Tree tree(keys.begin(), keys.end());
+    std::mt19937 rng(7);
+    size_t before = allocations;
+    for (auto _ : state) {
+        int key = rng() % keys.size();
+        auto version = tree.freeze();
+        tree.remove(key);
+        tree.insert(key);
+        benchmark::DoNotOptimize(version.size());
+    }
+    state.counters["allocs/op"] = benchmark::Counter(allocations - before, benchmark::Counter::kAvgIterations);
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(VersionedUpdate, PersistentTreap<int>)->RangeMultiplier(10)->Range(1000, 1000000);
+BENCHMARK_TEMPLATE(VersionedUpdate, PersistentAVLTree<int>)->RangeMultiplier(10)->Range(1000, 1000000);
+BENCHMARK_TEMPLATE(FrozenVersionedUpdate, CompactAVLTree)->RangeMultiplier(10)->Range(1000, 1000000);
+
+// Sequential keys make every new key the splayed root with the old tree as its
+// left child, which builds a fully degenerate chain in O(n).
+template <typename Tree>
+static void DegenerateTeardown(benchmark::State& state) {
+    int n = state.range(0);
+    for (auto _ : state) {
+        state.PauseTiming();
+        Tree tree;
+        for (int i = 0; i < n; ++i)
+            tree.insert(i);
+        state.ResumeTiming();
+        tree.clear();
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+template <typename Tree>
+static void BalancedTeardown(benchmark::State& state) {
+    std::vector<int> keys = shuffledKeys(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto tree = std::make_unique<Tree>();
+        for (int key : keys)
+            tree->insert(key);
+        state.ResumeTiming();
+        tree.reset();
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+using CompactSplay = Splay<int, std::less<int>, CompactBinaryNode<int>>;
+using PooledCompactSplay = Splay<int, std::less<int>, CompactBinaryNode<int>, PoolAllocator<CompactBinaryNode<int>>>;
+
+BENCHMARK_TEMPLATE(DegenerateTeardown, Splay<int>)->RangeMultiplier(10)->Range(1000000, 10000000)->Iterations(3)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(DegenerateTeardown, CompactSplay)->RangeMultiplier(10)->Range(1000000, 10000000)->Iterations(3)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(DegenerateTeardown, PooledCompactSplay)->RangeMultiplier(10)->Range(1000000, 10000000)->Iterations(3)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BalancedTeardown, AVLTree<int>)->RangeMultiplier(10)->Range(1000000, 10000000)->Iterations(3)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BalancedTeardown, CompactAVLTree)->RangeMultiplier(10)->Range(1000000, 10000000)->Iterations(3)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BalancedTeardown, PooledCompactAVLTree)->RangeMultiplier(10)->Range(1000000, 10000000)->Iterations(3)->Unit(benchmark::kMillisecond);
+
+// What a map looked like before TreeMap: the keys in an ordered set for rank
+// and range queries, and their values in a hash table on the side.
+template <typename Set>
+struct SetWithSideTable {
+    Set keys;
+    std::unordered_map<int, int> values;
+
+    int& operator[](int key) {
+        if (!keys.contains(key))
+            keys.insert(key);
+        return values[key];
+    }
+};
+
+// Bumps the counter of a random key out of state.range(0) that are all present,
+// as when a frequency table is being filled.
+template <typename Map>
+static void MapUpdate(benchmark::State& state) {
+    int n = state.range(0);
+    std::vector<int> keys(n);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+    Map map;
+    for (int key : keys)
+        map[key] = 0;
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(7));
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(++map[keys[i]]);
+        i = i + 1 == keys.size() ? 0 : i + 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(MapUpdate, AVLMap<int, int>)->Arg(100000);
+BENCHMARK_TEMPLATE(MapUpdate, TreapMap<int, int>)->Arg(100000);
+BENCHMARK_TEMPLATE(MapUpdate, RBMap<int, int>)->Arg(100000);
+BENCHMARK_TEMPLATE(MapUpdate, SetWithSideTable<AVLTree<int>>)->Arg(100000);
+BENCHMARK_TEMPLATE(MapUpdate, SetWithSideTable<Treap<int>>)->Arg(100000);
+
+// Workload matrix: tree × operation × key distribution × size, registered at
+// startup as Workload/<tree>/<operation>/<distribution>/<n>. The full matrix
+// builds trees of up to 10^7 keys, so pick a slice with --benchmark_filter, e.g.
+// --benchmark_filter='Workload/AVLTree/contains_hit/.*/100000'.
+enum class Operation { Insert, Remove, ContainsHit, ContainsMiss, Rank, Select, FloorCeil, RangeScan, NSmallest, Mixed50, Mixed90, Mixed99 };
+enum class Distribution { Sequential, Uniform, Zipfian, Clustered, Adversarial };
+
+static const char* const operationNames[] = {"insert", "remove", "contains_hit", "contains_miss", "rank", "select",
+                                             "floor_ceil", "range_scan", "nsmallest", "mixed_r50", "mixed_r90", "mixed_r99"};
+static const char* const distributionNames[] = {"sequential", "uniform", "zipfian", "clustered", "adversarial"};
+
+// Returns n indices into [0, n) in the order the distribution visits them. All
+// but the Zipfian one are permutations, so a batch of n inserts builds the same
+// set of keys whatever the order.
+static std::vector<int> workloadIndices(Distribution distribution, int n) {
+    std::vector<int> indices(n);
+    switch (distribution) {
+        case Distribution::Sequential:
+            std::iota(indices.begin(), indices.end(), 0);
+            break;
+        case Distribution::Uniform:
+            indices = shuffledKeys(n);
+            break;
+        case Distribution::Zipfian: {
+            // Gray et al.'s generator with the skew YCSB uses. Ranks are scattered
+            // through a fixed permutation so that the hot keys are spread over the
+            // tree instead of all being its leftmost ones.
+            const double theta = 0.99;
+            double zetan = 0;
+            for (int i = 1; i <= n; ++i)
+                zetan += 1 / std::pow(i, theta);
+            double zeta2 = 1 + std::pow(0.5, theta);
+            double alpha = 1 / (1 - theta);
+            double eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+            std::vector<int> scatter = shuffledKeys(n);
+            std::mt19937 rng(7);
+            std::uniform_real_distribution<double> uniform(0, 1);
+            for (int& index : indices) {
+                double u = uniform(rng), uz = u * zetan;
+                int rank = uz < 1 ? 0 : uz < zeta2 ? 1 : std::min(n - 1, static_cast<int>(n * std::pow(eta * u - eta + 1, alpha)));
+                index = scatter[rank];
+            }
+            break;
+        }
+        case Distribution::Clustered: {
+            // Runs of 64 consecutive keys, the runs in random order.
+            std::vector<int> runs((n + 63) / 64);
+            std::iota(runs.begin(), runs.end(), 0);
+            std::shuffle(runs.begin(), runs.end(), std::mt19937(7));
+            size_t i = 0;
+            for (int run : runs)
+                for (int index = run * 64; index < std::min(n, run * 64 + 64); ++index)
+                    indices[i++] = index;
+            break;
+        }
+        case Distribution::Adversarial:
+            // Alternates between the two ends and closes in, so every insert goes
+            // down the outermost path: unbalanced trees degenerate into a zigzag
+            // and splay trees keep splaying from full depth.
+            for (int i = 0; i < n; ++i)
+                indices[i] = i % 2 == 0 ? i / 2 : n - 1 - i / 2;
+            break;
+    }
+    return indices;
+}
+
+// The read operations on one tree and size share a tree of the keys 0, 2, ...,
+// 2n - 2 inserted in random order, which is kept until another one is asked for,
+// so the odd keys are all misses. The mixed workloads only swap a key out and
+// back in, so they leave it as they found it.
+static std::shared_ptr<void> workloadTree;
+static std::string workloadTreeId;
+static double workloadBytesPerKey = 0;
+
+template <typename Tree>
+static Tree& sharedWorkloadTree(const std::string& name, int n) {
+    std::string id = name + "/" + std::to_string(n);
+    if (workloadTreeId != id) {
+        workloadTree.reset();
+        std::vector<int> keys = shuffledKeys(n);
+        size_t before = allocatedBytes;
+        auto tree = std::make_shared<Tree>();
+        for (int key : keys)
+            tree->insert(2 * key);
+        workloadBytesPerKey = static_cast<double>(allocatedBytes - before) / n;
+        workloadTree = tree;
+        workloadTreeId = id;
+    }
+    return *static_cast<Tree*>(workloadTree.get());
+}
+
+// Batch operations insert or remove n keys in the order of the distribution per
+// iteration; all others do one operation per iteration on the shared tree.
+template <typename Tree>
+static void Workload(benchmark::State& state, std::string name, Operation operation, Distribution distribution) {
+    int n = state.range(0);
+    std::vector<int> indices = workloadIndices(distribution, n);
+    double bytesPerKey = 0;
+    if (operation == Operation::Insert || operation == Operation::Remove) {
+        workloadTree.reset();
+        workloadTreeId.clear();
+        std::vector<int> keys = shuffledKeys(n);
+        for (auto _ : state) {
+            state.PauseTiming();
+            auto tree = std::make_unique<Tree>();
+            size_t before = allocatedBytes;
+            if (operation == Operation::Remove) {
+                for (int key : keys)
+                    tree->insert(2 * key);
+                bytesPerKey = static_cast<double>(allocatedBytes - before) / tree->size();
+            }
+            state.ResumeTiming();
+            if (operation == Operation::Insert) {
+                for (int index : indices)
+                    tree->insert(2 * index);
+                state.PauseTiming();
+                bytesPerKey = static_cast<double>(allocatedBytes - before) / tree->size();
+            } else {
+                for (int index : indices)
+                    tree->remove(2 * index);
+                state.PauseTiming();
+            }
+            tree.reset();
+            state.ResumeTiming();
+        }
+        state.counters["bytes/key"] = bytesPerKey;
+        state.SetItemsProcessed(state.iterations() * n);
+        return;
+    }
+
+    Tree& tree = sharedWorkloadTree<Tree>(name, n);
+    size_t readPercent = operation == Operation::Mixed50 ? 50 : operation == Operation::Mixed90 ? 90 : 99;
+    size_t i = 0;
+    for (auto _ : state) {
+        int key = 2 * indices[i];
+        switch (operation) {
+            case Operation::ContainsHit:
+                benchmark::DoNotOptimize(tree.contains(key));
+                break;
+            case Operation::ContainsMiss:
+                benchmark::DoNotOptimize(tree.contains(key + 1));
+                break;
+            case Operation::Rank:
+                benchmark::DoNotOptimize(tree.rank(key));
+                break;
+            case Operation::Select:
+                benchmark::DoNotOptimize(tree.select(indices[i] + 1));
+                break;
+            case Operation::FloorCeil:
+                benchmark::DoNotOptimize(tree.floor(key + 1));
+                benchmark::DoNotOptimize(tree.ceil(key + 1));
+                break;
+            case Operation::RangeScan: {
+                int sum = 0, visited = 0;
+                for (auto it = tree.lower_bound(key); visited < 100 && it != tree.end(); ++it, ++visited)
+                    sum += *it;
+                benchmark::DoNotOptimize(sum);
+                break;
+            }
+            case Operation::NSmallest:
+                benchmark::DoNotOptimize(tree.nsmallest(100));
+                break;
+            default:
+                // i * 37 runs through every residue mod 100, spreading the writes
+                // evenly instead of bunching them at the end of each 100 operations.
+                if (i * 37 % 100 < readPercent) {
+                    benchmark::DoNotOptimize(tree.contains(key));
+                } else {
+                    tree.remove(key);
+                    tree.insert(key);
+                }
+                break;
+        }
+        i = i + 1 == indices.size() ? 0 : i + 1;
+    }
+    state.counters["bytes/key"] = workloadBytesPerKey;
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Unbalanced trees stop at 10^5 keys and skip the batches that would make them
+// degenerate past 10^3, which would take quadratic time.
+template <typename Tree>
+static void registerWorkloads(const std::string& name, bool balanced) {
+    for (int n : {1000, 100000, 10000000}) {
+        if (!balanced && n > 100000)
+            continue;
+        for (int op = 0; op <= static_cast<int>(Operation::Mixed99); ++op) {
+            Operation operation = static_cast<Operation>(op);
+            bool batch = operation == Operation::Insert || operation == Operation::Remove;
+            for (int dist = 0; dist <= static_cast<int>(Distribution::Adversarial); ++dist) {
+                Distribution distribution = static_cast<Distribution>(dist);
+                // nsmallest does not depend on the keys, so it is only run once.
+                if (operation == Operation::NSmallest && distribution != Distribution::Uniform)
+                    continue;
+                if (!balanced && batch && n > 1000 && (distribution == Distribution::Sequential || distribution == Distribution::Adversarial))
+                    continue;
+                std::string label = "Workload/" + name + "/" + operationNames[op];
+                if (operation != Operation::NSmallest)
+                    label += std::string("/") + distributionNames[dist];
+                auto* registered = benchmark::RegisterBenchmark(label.c_str(), Workload<Tree>, name, operation, distribution)->Arg(n);
+                if (batch)
+                    registered->Unit(benchmark::kMillisecond);
+            }
+        }
+    }
+}
+
+static const bool workloadsRegistered = [] {
+    registerWorkloads<BinarySearchTree<int>>("BinarySearchTree", false);
+    registerWorkloads<Splay<int>>("Splay", true);
+    registerWorkloads<Treap<int>>("Treap", true);
+    registerWorkloads<NonRotatingTreap<int>>("NonRotatingTreap", true);
+    registerWorkloads<AVLTree<int>>("AVLTree", true);
+    registerWorkloads<WAVLTree<int>>("WAVLTree", true);
+    registerWorkloads<RBTree<int>>("RBTree", true);
+    registerWorkloads<AATree<int>>("AATree", true);
+    registerWorkloads<ScapegoatTree<int>>("ScapegoatTree", true);
+    return true;
+}();
+
+// Exports a tree's counters per operation, and its shape as of the end of the
+// run, as Google Benchmark user counters.
+static void reportStatistics(benchmark::State& state, const TreeStatistics& statistics, size_t operations) {
+    auto perOperation = [&](size_t value) { return static_cast<double>(value) / operations; };
+    state.counters["comparisons/op"] = perOperation(statistics.comparisons);
+    state.counters["visits/op"] = perOperation(statistics.visits);
+    state.counters["rotations/op"] = perOperation(statistics.rotations);
+    if (statistics.rebuilds) {
+        state.counters["rebuilds/op"] = perOperation(statistics.rebuilds);
+        state.counters["rebuilt/rebuild"] = static_cast<double>(statistics.rebuiltNodes) / statistics.rebuilds;
+    }
+    if (statistics.splays)
+        state.counters["splay_depth"] = static_cast<double>(statistics.splayPathLength) / statistics.splays;
+    if (statistics.skews || statistics.splits) {
+        state.counters["skews/op"] = perOperation(statistics.skews);
+        state.counters["splits/op"] = perOperation(statistics.splits);
+    }
+}
+
+static void reportShape(benchmark::State& state, const ShapeReport& shape) {
+    state.counters["height"] = shape.height;
+    state.counters["avg_depth"] = shape.averageDepth;
+    state.counters["bytes/node"] = shape.bytesPerNode;
+}
+
+// Inserts state.range(0) shuffled keys into an empty tree, then looks each of
+// them up or removes them all again, reporting the counters of one phase
+// (state.range(1) = 0 for the inserts, 1 for the lookups, 2 for the removals).
+// The shape is that of the tree after the inserts.
+template <typename Tree>
+static void Instrumented(benchmark::State& state) {
+    std::vector<int> keys = shuffledKeys(state.range(0));
+    int phase = state.range(1);
+    std::vector<int> order = keys;
+    std::shuffle(order.begin(), order.end(), std::mt19937(5));
+    TreeStatistics statistics;
+    ShapeReport shape;
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto tree = std::make_unique<Tree>();
+        if (phase != 0) {
+            for (int key : keys)
+                tree->insert(key);
+            shape = tree->shape_report();
+            tree->reset_statistics();
+        }
+        state.ResumeTiming();
+        for (int key : phase == 2 ? order : keys) {
+            if (phase == 0)
+                tree->insert(key);
+            else if (phase == 1)
+                benchmark::DoNotOptimize(tree->contains(key));
+            else
+                tree->remove(key);
+        }
+        state.PauseTiming();
+        statistics = tree->statistics();
+        if (phase == 0)
+            shape = tree->shape_report();
+        tree.reset();
+        state.ResumeTiming();
+    }
+    reportStatistics(state, statistics, keys.size());
+    reportShape(state, shape);
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+using InstrumentedAVLTree = AVLTree<int, std::less<int>, AVLTreeNode<int>, std::allocator<AVLTreeNode<int>>, TreeStats>;
+using InstrumentedWAVLTree = WAVLTree<int, std::less<int>, WAVLTreeNode<int>, std::allocator<WAVLTreeNode<int>>, TreeStats>;
+using InstrumentedRBTree = RBTree<int, std::less<int>, RBTreeNode<int>, std::allocator<RBTreeNode<int>>, TreeStats>;
+using InstrumentedAATree = AATree<int, std::less<int>, AATreeNode<int>, std::allocator<AATreeNode<int>>, TreeStats>;
+using InstrumentedSplay = Splay<int, std::less<int>, BinaryNode<int>, std::allocator<BinaryNode<int>>, TreeStats>;
+using InstrumentedTreap = Treap<int, std::less<int>, TreapNode<int>, std::allocator<TreapNode<int>>, TreeStats>;
+using InstrumentedScapegoatTree = ScapegoatTree<int, std::less<int>, BinaryNode<int>, std::allocator<BinaryNode<int>>, TreeStats>;
+
+BENCHMARK_TEMPLATE(Instrumented, InstrumentedAVLTree)->ArgsProduct({{100000}, {0, 1, 2}})->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(Instrumented, InstrumentedWAVLTree)->ArgsProduct({{100000}, {0, 1, 2}})->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(Instrumented, InstrumentedRBTree)->ArgsProduct({{100000}, {0, 1, 2}})->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(Instrumented, InstrumentedAATree)->ArgsProduct({{100000}, {0, 1}})->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(Instrumented, InstrumentedSplay)->ArgsProduct({{100000}, {0, 1}})->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(Instrumented, InstrumentedTreap)->ArgsProduct({{100000}, {0, 1}})->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(Instrumented, InstrumentedScapegoatTree)->ArgsProduct({{100000}, {0, 1}})->Unit(benchmark::kMillisecond);
+
+// Lookups cycling through a uniform or a Zipfian stream of hits on a splay
+// tree of state.range(0) keys, under each splaying policy. The tree is built
+// in random order and never reset, so the figures include the policy settling
+// the tree into shape for the stream.
+template <typename Tree>
+static void SplayLookup(benchmark::State& state) {
+    int n = state.range(0);
+    std::vector<int> indices = workloadIndices(static_cast<Distribution>(state.range(1)), n);
+    Tree tree;
+    for (int key : shuffledKeys(n))
+        tree.insert(key);
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.contains(indices[i]));
+        i = i + 1 == indices.size() ? 0 : i + 1;
+    }
+    reportShape(state, tree.shape_report());
+    state.SetItemsProcessed(state.iterations());
+}
+
+template <typename Policy>
+using PolicySplay = Splay<int, std::less<int>, BinaryNode<int>, std::allocator<BinaryNode<int>>, NoTreeStats, Policy>;
+
+static const std::vector<std::vector<int64_t>> splayStreams = {
+    {1000, 100000}, {static_cast<int64_t>(Distribution::Uniform), static_cast<int64_t>(Distribution::Zipfian)}};
+BENCHMARK_TEMPLATE(SplayLookup, PolicySplay<FullSplay>)->ArgsProduct(splayStreams);
+BENCHMARK_TEMPLATE(SplayLookup, PolicySplay<SemiSplay>)->ArgsProduct(splayStreams);
+BENCHMARK_TEMPLATE(SplayLookup, PolicySplay<PeriodicSplay<16>>)->ArgsProduct(splayStreams);
+BENCHMARK_TEMPLATE(SplayLookup, PolicySplay<DeepSplay<2>>)->ArgsProduct(splayStreams);
+BENCHMARK_TEMPLATE(SplayLookup, AVLTree<int>)->ArgsProduct(splayStreams);
+
+BENCHMARK_MAIN();
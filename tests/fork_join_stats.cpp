@@ -0,0 +1,46 @@
+#undef NDEBUG
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "treap.hpp"
+
+// The set operations fork once both operands reach forkGrain nodes. With
+// statistics on, they must not: the counters and the counting comparator are
+// plain fields of the tree. Built with -fsanitize=thread, so that a race on
+// them fails the test.
+int main() {
+    using Tree = NonRotatingTreap<int, std::less<int>, TreapNode<int>, std::allocator<TreapNode<int>>, TreeStats>;
+    const int n = 1 << 17;
+    std::vector<int> evens, odds;
+    for (int i = 0; i < n; ++i)
+        (i % 2 ? odds : evens).push_back(i);
+
+    auto build = [](const std::vector<int>& keys, std::uint64_t seed) {
+        Tree tree{RandomPriority(seed)};
+        tree.assign_sorted(keys.begin(), keys.end());
+        tree.reset_statistics();
+        return tree;
+    };
+
+    Tree left = build(evens, 1), right = build(odds, 2);
+    left.union_with(right);
+    TreeStatistics united = left.statistics();
+    left.check();
+    assert(left.size() == static_cast<size_t>(n));
+    assert(united.comparisons > 0 && united.visits > 0);
+
+    // Counting is deterministic once nothing runs concurrently.
+    Tree again = build(evens, 1), other = build(odds, 2);
+    again.union_with(other);
+    assert(again.statistics().comparisons == united.comparisons);
+    assert(again.statistics().visits == united.visits);
+
+    Tree common(evens.begin(), evens.end()), half(evens.begin(), evens.begin() + n / 4);
+    common.intersect_with(half);
+    assert(common.size() == static_cast<size_t>(n / 4));
+    common.difference_with(left);
+    assert(common.size() == 0);
+    return 0;
+}
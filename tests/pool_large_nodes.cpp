@@ -0,0 +1,54 @@
+#undef NDEBUG
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "avltree.hpp"
+#include "node_pool.hpp"
+
+// Values that make the node too large, or too strictly aligned, for the
+// pool's chunks, so that every node comes from the upstream resource.
+struct Big {
+    int key;
+    char payload[300];
+};
+struct alignas(2 * alignof(std::max_align_t)) Aligned {
+    int key;
+};
+
+template <typename Value>
+struct KeyLess {
+    bool operator()(const Value& a, const Value& b) const { return a.key < b.key; }
+};
+
+// clear() and the destructor free the nodes of a pool-backed tree of trivially
+// destructible nodes by releasing the pool instead of visiting them. Built
+// with -fsanitize=address, so that a node the pool does not release is
+// reported as a leak.
+template <typename Value>
+void check() {
+    using Node = CompactAVLTreeNode<Value>;
+    using Tree = AVLTree<Value, KeyLess<Value>, Node, PoolAllocator<Node>>;
+    Tree tree;
+    for (int i = 0; i < 1000; ++i)
+        tree.insert(Value{i});
+    for (int i = 0; i < 1000; i += 2)
+        tree.remove(Value{i});
+    tree.check();
+    assert(tree.size() == 500);
+    for (auto it = tree.begin(); it != tree.end(); ++it)
+        assert(reinterpret_cast<std::uintptr_t>(&*it) % alignof(Value) == 0);
+    tree.clear();
+    assert(tree.empty());
+    for (int i = 0; i < 1000; ++i)
+        tree.insert(Value{i});
+    assert(tree.size() == 1000);
+}
+
+int main() {
+    check<Big>();
+    check<Aligned>();
+    return 0;
+}
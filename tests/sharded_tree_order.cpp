@@ -0,0 +1,40 @@
+#undef NDEBUG
+
+#include <cassert>
+#include <functional>
+#include <type_traits>
+
+#include "avltree.hpp"
+#include "sharded_tree.hpp"
+#include "treap.hpp"
+
+// The shards are cut and searched in the order of the trees they hold, here a
+// descending one, which a bound comparator defaulting to std::less used to get
+// wrong: the first split left one half empty and rebalance() retried it forever.
+template <typename Tree>
+void check() {
+    static_assert(std::is_same<typename Tree::key_compare, std::greater<int>>::value, "key_compare");
+    const int n = 20000;
+    ShardedTree<Tree> tree(8);
+    for (int i = 0; i < n; ++i)
+        tree.insert(i * 7919 % n);
+    tree.check();
+    assert(tree.size() == static_cast<size_t>(n));
+    assert(tree.shard_count() > 1);
+    assert(tree.min() == n - 1 && tree.max() == 0);
+    for (int i = 0; i < n; i += 97) {
+        assert(tree.contains(i));
+        assert(tree.rank(i) == static_cast<size_t>(n - i));
+        assert(tree.select(n - i) == i);
+    }
+    for (int i = 0; i < n; i += 2)
+        tree.remove(i);
+    tree.check();
+    assert(tree.size() == static_cast<size_t>(n / 2));
+}
+
+int main() {
+    check<AVLTree<int, std::greater<int>>>();
+    check<Treap<int, std::greater<int>>>();
+    return 0;
+}
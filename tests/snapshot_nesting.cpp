@@ -0,0 +1,37 @@
+#undef NDEBUG
+
+#include <cassert>
+#include <vector>
+
+#include "concurrent_treap.hpp"
+
+// A Snapshot must keep its version alive while the same Reader runs one-off
+// queries or takes further snapshots, each of which enters and leaves the
+// Reader's slot. Built with -fsanitize=address, so that reading a node the
+// writer already freed fails the test.
+int main() {
+    std::vector<int> keys;
+    for (int i = 0; i < 1000; ++i)
+        keys.push_back(2 * i);
+    ConcurrentTreap<int> tree(keys.begin(), keys.end());
+    auto reader = tree.reader();
+
+    auto snapshot = reader.snapshot();
+    assert(reader.contains(4));
+    {
+        auto inner = reader.snapshot();
+        assert(inner.size() == 1000);
+    }
+    for (int i = 0; i < 1000; ++i) {
+        tree.remove(2 * i);
+        tree.insert(2 * i + 1);
+    }
+
+    assert(snapshot.size() == 1000);
+    for (int i = 0; i < 1000; ++i) {
+        assert(snapshot.contains(2 * i));
+        assert(snapshot.rank(2 * i) == static_cast<size_t>(i + 1));
+    }
+    assert(!reader.contains(4) && reader.contains(5));
+    return 0;
+}
@@ -0,0 +1,98 @@
+#undef NDEBUG
+
+#include <cassert>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "tree_map.hpp"
+
+template <typename Map, typename = void>
+struct HasInsertBatch : std::false_type {};
+template <typename Map>
+struct HasInsertBatch<Map, std::void_t<decltype(std::declval<Map&>().insert_batch(std::declval<const typename Map::iterator::value_type*>(), std::declval<const typename Map::iterator::value_type*>()))>>
+    : std::true_type {};
+
+template <typename Map, typename = void>
+struct HasUnionWith : std::false_type {};
+template <typename Map>
+struct HasUnionWith<Map, std::void_t<decltype(std::declval<Map&>().union_with(std::declval<Map&>()))>> : std::true_type {};
+
+// Holds exactly the keys 5 and 6, once each, with the values of the first
+// entries of the input.
+template <typename Map>
+void checkDistinct(Map& map) {
+    map.check();
+    assert(map.size() == 2);
+    for (auto it = map.begin(); it != map.end(); ++it)
+        assert(it.repeat() == 1);
+    assert(map.at(5) == "first five");
+    assert(map.at(6) == "six");
+    assert(map.rank(6) == 2);
+    assert(map.erase(5) == 1);
+    assert(!map.contains(5));
+    assert(map.size() == 1);
+}
+
+// Every bulk path of the map keeps the first entry of each key, where the
+// tree underneath would have counted the others as repeats.
+template <typename Map>
+void checkMap() {
+    using Entry = typename Map::value_type;
+    const std::vector<Entry> entries = {Entry(5, "first five"), Entry(5, "second five"), Entry(6, "six")};
+
+    Map built(entries.begin(), entries.end());
+    checkDistinct(built);
+
+    Map assigned;
+    assigned.insert(Entry(7, "seven"));
+    assigned.assign_sorted(entries.begin(), entries.end());
+    assert(!assigned.contains(7));
+    checkDistinct(assigned);
+
+    for (const Entry& entry : entries) {
+        Map inserted;
+        inserted.insert(entries[0]);
+        inserted.insert(entry);
+        inserted.emplace(entry);
+        inserted.insert(inserted.end(), entry);
+        inserted.insert(Entry(6, "six"));
+        checkDistinct(inserted);
+    }
+
+    static_assert(!HasInsertBatch<Map>::value && !HasUnionWith<Map>::value, "bulk paths that add up repeats are hidden");
+
+    Map map(entries.begin(), entries.end());
+    const Map& view = map;
+    map.at(6) = "changed";
+    static_assert(std::is_same<decltype(view.at(6)), const std::string&>::value, "const at");
+    static_assert(std::is_same<decltype(map.at(6)), std::string&>::value, "non-const at");
+    assert(view.at(6) == "changed");
+    bool thrown = false;
+    try {
+        view.at(4);
+    } catch (const std::out_of_range&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+int main() {
+    checkMap<BinarySearchTreeMap<int, std::string>>();
+    checkMap<AVLMap<int, std::string>>();
+    checkMap<WAVLMap<int, std::string>>();
+    checkMap<AAMap<int, std::string>>();
+    checkMap<RBMap<int, std::string>>();
+    checkMap<TopDownRBMap<int, std::string>>();
+    checkMap<SplayMap<int, std::string>>();
+    checkMap<ScapegoatMap<int, std::string>>();
+    checkMap<TreapMap<int, std::string>>();
+    checkMap<NonRotatingTreapMap<int, std::string>>();
+
+    // The treap's own batch operations still work on trees that are not maps.
+    static_assert(HasInsertBatch<NonRotatingTreap<int>>::value, "insert_batch");
+    static_assert(HasUnionWith<NonRotatingTreap<int>>::value, "union_with");
+    return 0;
+}